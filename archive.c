@@ -0,0 +1,397 @@
+/*
+ * lmc - Little Man Computer
+ * Copyright (C) 2020 David McMackins II
+ *
+ * Redistributions, modified or unmodified, in whole or in part, must retain
+ * applicable copyright or other legal privilege notices, these conditions, and
+ * the following license terms and disclaimer.  Subject to these conditions,
+ * the holder(s) of copyright or other legal privileges, author(s) or
+ * assembler(s), and contributors of this work hereby grant to any person who
+ * obtains a copy of this work in any form:
+ *
+ * 1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ * use, and/or otherwise deal in the licensed material without restriction.
+ *
+ * 2. A perpetual, worldwide, non-exclusive, royalty-free, irrevocable patent
+ * license to reproduce, modify, distribute, publish, sell, use, and/or
+ * otherwise deal in the licensed material without restriction, for any and all
+ * patents:
+ *
+ *     a. Held by each such holder of copyright or other legal privilege,
+ *     author or assembler, or contributor, necessarily infringed by the
+ *     contributions alone or by combination with the work, of that privilege
+ *     holder, author or assembler, or contributor.
+ *
+ *     b. Necessarily infringed by the work at the time that holder of
+ *     copyright or other privilege, author or assembler, or contributor made
+ *     any contribution to the work.
+ *
+ * NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ * LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ * A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ * ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ * ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT, TORT,
+ * OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR THE USE
+ * OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "archive.h"
+
+/*
+ * An archive is a header, the contents of its entries, each piece padded
+ * to 8 bytes, and then an index with one record per entry. Names are
+ * stored NUL-terminated and expected outputs as 32-bit numbers, so both
+ * can be used straight from the mapping. Numbers are in the byte order of
+ * the host that built the archive, which the header records.
+ */
+
+#define ARCHIVE_MAGIC "LMCARCH"
+#define ARCHIVE_VERSION 1
+#define ARCHIVE_BYTE_ORDER UINT32_C(0x01020304)
+#define ARCHIVE_NONE UINT64_MAX /* offset of an absent input or output */
+
+struct archive_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint64_t count;
+	uint64_t index_offset;
+};
+
+struct archive_index
+{
+	uint64_t name_offset;
+	uint64_t name_len;
+	uint64_t image_offset;
+	uint64_t image_len;
+	uint64_t input_offset;
+	uint64_t input_len;
+	uint64_t expected_offset;
+	uint64_t num_expected;
+};
+
+/* whether [offset, offset + len) lies within size bytes */
+static int
+in_bounds(uint64_t offset, uint64_t len, uint64_t size)
+{
+	return offset <= size && len <= size - offset;
+}
+
+static int
+check_index(const struct lmc_archive *archive, const char *path)
+{
+	uint64_t i, size = archive->size;
+
+	for (i = 0; i < archive->header->count; ++i)
+	{
+		const struct archive_index *e = &archive->index[i];
+
+		if (!in_bounds(e->name_offset, e->name_len + 1, size)
+			|| archive->map[e->name_offset + e->name_len] != '\0'
+			|| !in_bounds(e->image_offset, e->image_len, size)
+			|| (e->input_offset != ARCHIVE_NONE
+				&& !in_bounds(e->input_offset, e->input_len,
+					size))
+			|| (e->expected_offset != ARCHIVE_NONE
+				&& (e->expected_offset % sizeof (int32_t)
+					|| e->num_expected > size
+					|| !in_bounds(e->expected_offset,
+						e->num_expected
+							* sizeof (int32_t),
+						size))))
+		{
+			fprintf(stderr, "%s: entry %lu is damaged\n", path,
+				(unsigned long) i);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+int
+archive_open(struct lmc_archive *archive, const char *path)
+{
+	const struct archive_header *header;
+	struct stat st;
+	void *map;
+	int fd;
+
+	memset(archive, 0, sizeof *archive);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		fprintf(stderr, "Error opening %s: %s\n", path,
+			strerror(errno));
+		return 1;
+	}
+
+	if (fstat(fd, &st))
+	{
+		fprintf(stderr, "Error opening %s: %s\n", path,
+			strerror(errno));
+		close(fd);
+		return 1;
+	}
+
+	if ((size_t) st.st_size < sizeof *header)
+	{
+		fprintf(stderr, "%s is not an archive\n", path);
+		close(fd);
+		return 1;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (MAP_FAILED == map)
+	{
+		fprintf(stderr, "Error mapping %s: %s\n", path,
+			strerror(errno));
+		return 1;
+	}
+
+	archive->map = map;
+	archive->size = st.st_size;
+	archive->header = header = map;
+
+	if (memcmp(header->magic, ARCHIVE_MAGIC, sizeof header->magic) != 0
+		|| header->version != ARCHIVE_VERSION)
+	{
+		fprintf(stderr, "%s is not an archive\n", path);
+		goto fail;
+	}
+
+	if (header->byte_order != ARCHIVE_BYTE_ORDER)
+	{
+		fprintf(stderr, "%s was built on a host of another byte order\n",
+			path);
+		goto fail;
+	}
+
+	if (header->index_offset % 8 || header->count > archive->size
+		|| !in_bounds(header->index_offset,
+			header->count * sizeof *archive->index, archive->size))
+	{
+		fprintf(stderr, "%s: index is damaged\n", path);
+		goto fail;
+	}
+
+	archive->index = (const void *) (archive->map + header->index_offset);
+	if (check_index(archive, path))
+		goto fail;
+
+	return 0;
+
+fail:
+	archive_close(archive);
+	return 1;
+}
+
+void
+archive_close(struct lmc_archive *archive)
+{
+	if (archive->map)
+		munmap((void *) archive->map, archive->size);
+
+	memset(archive, 0, sizeof *archive);
+}
+
+unsigned long
+archive_count(const struct lmc_archive *archive)
+{
+	return (unsigned long) archive->header->count;
+}
+
+void
+archive_get(const struct lmc_archive *archive, unsigned long i,
+	struct lmc_archive_entry *entry)
+{
+	const struct archive_index *e = &archive->index[i];
+
+	entry->name = (const char *) archive->map + e->name_offset;
+	entry->image = archive->map + e->image_offset;
+	entry->image_len = e->image_len;
+
+	entry->input = NULL;
+	entry->input_len = 0;
+	if (e->input_offset != ARCHIVE_NONE)
+	{
+		entry->input = (const char *) archive->map + e->input_offset;
+		entry->input_len = e->input_len;
+	}
+
+	entry->expected = NULL;
+	entry->num_expected = 0;
+	if (e->expected_offset != ARCHIVE_NONE)
+	{
+		entry->expected = (const void *) (archive->map
+			+ e->expected_offset);
+		entry->num_expected = e->num_expected;
+	}
+}
+
+/* writes len bytes and pads them to 8; returns where they start, or
+   ARCHIVE_NONE on error */
+static uint64_t
+put(struct lmc_archive_writer *w, const void *data, size_t len)
+{
+	static const char zeroes[8];
+	uint64_t offset = w->pos;
+	size_t pad = (8 - len % 8) % 8;
+
+	if (fwrite(data, 1, len, w->f) != len
+		|| fwrite(zeroes, 1, pad, w->f) != pad)
+	{
+		return ARCHIVE_NONE;
+	}
+
+	w->pos += len + pad;
+	return offset;
+}
+
+int
+archive_create(struct lmc_archive_writer *w, const char *path)
+{
+	struct archive_header header;
+
+	memset(w, 0, sizeof *w);
+	w->path = path;
+	w->f = fopen(path, "wb");
+	if (!w->f)
+	{
+		fprintf(stderr, "Error opening %s: %s\n", path,
+			strerror(errno));
+		return 1;
+	}
+
+	/* written again with the count and index offset at the end */
+	memset(&header, 0, sizeof header);
+	if (put(w, &header, sizeof header) == ARCHIVE_NONE)
+	{
+		fprintf(stderr, "Error writing %s: %s\n", path,
+			strerror(errno));
+		archive_abandon(w);
+		return 1;
+	}
+
+	return 0;
+}
+
+int
+archive_add(struct lmc_archive_writer *w,
+	const struct lmc_archive_entry *entry)
+{
+	struct archive_index *e;
+
+	if (w->count == w->size)
+	{
+		void *temp;
+
+		w->size = w->size ? w->size * 2 : 256;
+		temp = realloc(w->index, w->size * sizeof *w->index);
+		if (!temp)
+		{
+			fprintf(stderr, "Out of memory\n");
+			return 1;
+		}
+
+		w->index = temp;
+	}
+
+	e = &w->index[w->count];
+	e->name_len = strlen(entry->name);
+	e->name_offset = put(w, entry->name, e->name_len + 1);
+	e->image_len = entry->image_len;
+	e->image_offset = put(w, entry->image, entry->image_len);
+
+	e->input_offset = ARCHIVE_NONE;
+	e->input_len = 0;
+	if (entry->input)
+	{
+		e->input_len = entry->input_len;
+		e->input_offset = put(w, entry->input, entry->input_len);
+	}
+
+	e->expected_offset = ARCHIVE_NONE;
+	e->num_expected = 0;
+	if (entry->expected)
+	{
+		e->num_expected = entry->num_expected;
+		e->expected_offset = put(w, entry->expected,
+			entry->num_expected * sizeof *entry->expected);
+	}
+
+	if (ARCHIVE_NONE == e->name_offset || ARCHIVE_NONE == e->image_offset
+		|| (entry->input && ARCHIVE_NONE == e->input_offset)
+		|| (entry->expected && ARCHIVE_NONE == e->expected_offset))
+	{
+		fprintf(stderr, "Error writing %s: %s\n", w->path,
+			strerror(errno));
+		return 1;
+	}
+
+	++w->count;
+	return 0;
+}
+
+int
+archive_finish(struct lmc_archive_writer *w)
+{
+	struct archive_header header;
+
+	memcpy(header.magic, ARCHIVE_MAGIC, sizeof header.magic);
+	header.version = ARCHIVE_VERSION;
+	header.byte_order = ARCHIVE_BYTE_ORDER;
+	header.count = w->count;
+	header.index_offset = w->pos;
+
+	if ((w->count && put(w, w->index, w->count * sizeof *w->index)
+			== ARCHIVE_NONE)
+		|| fseek(w->f, 0L, SEEK_SET)
+		|| fwrite(&header, sizeof header, 1, w->f) != 1)
+	{
+		fprintf(stderr, "Error writing %s: %s\n", w->path,
+			strerror(errno));
+		archive_abandon(w);
+		return 1;
+	}
+
+	free(w->index);
+	w->index = NULL;
+	if (fclose(w->f))
+	{
+		w->f = NULL;
+		fprintf(stderr, "Error writing %s: %s\n", w->path,
+			strerror(errno));
+		archive_abandon(w);
+		return 1;
+	}
+
+	w->f = NULL;
+	return 0;
+}
+
+void
+archive_abandon(struct lmc_archive_writer *w)
+{
+	if (w->f)
+		fclose(w->f);
+
+	remove(w->path);
+	free(w->index);
+	w->f = NULL;
+	w->index = NULL;
+}
@@ -0,0 +1,112 @@
+/*
+ * lmc - Little Man Computer
+ * Copyright (C) 2020 David McMackins II
+ *
+ * Redistributions, modified or unmodified, in whole or in part, must retain
+ * applicable copyright or other legal privilege notices, these conditions, and
+ * the following license terms and disclaimer.  Subject to these conditions,
+ * the holder(s) of copyright or other legal privileges, author(s) or
+ * assembler(s), and contributors of this work hereby grant to any person who
+ * obtains a copy of this work in any form:
+ *
+ * 1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ * use, and/or otherwise deal in the licensed material without restriction.
+ *
+ * 2. A perpetual, worldwide, non-exclusive, royalty-free, irrevocable patent
+ * license to reproduce, modify, distribute, publish, sell, use, and/or
+ * otherwise deal in the licensed material without restriction, for any and all
+ * patents:
+ *
+ *     a. Held by each such holder of copyright or other legal privilege,
+ *     author or assembler, or contributor, necessarily infringed by the
+ *     contributions alone or by combination with the work, of that privilege
+ *     holder, author or assembler, or contributor.
+ *
+ *     b. Necessarily infringed by the work at the time that holder of
+ *     copyright or other privilege, author or assembler, or contributor made
+ *     any contribution to the work.
+ *
+ * NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ * LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ * A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ * ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ * ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT, TORT,
+ * OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR THE USE
+ * OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#ifndef LMC_ARCHIVE_H
+#define LMC_ARCHIVE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+struct archive_header;
+struct archive_index;
+
+/* an archive of images, each with an optional input and expected output,
+   mapped read-only so entries can be used where they lie */
+struct lmc_archive
+{
+	const unsigned char *map;
+	size_t size;
+	const struct archive_header *header;
+	const struct archive_index *index;
+};
+
+struct lmc_archive_entry
+{
+	const char *name; /* NUL-terminated */
+	const unsigned char *image;
+	size_t image_len;
+	const char *input; /* NULL if there's none */
+	size_t input_len;
+	const int32_t *expected; /* NULL if there's none */
+	size_t num_expected;
+};
+
+/* checks every offset in the index, so that entries can be used without
+   checking them again */
+int
+archive_open(struct lmc_archive *archive, const char *path);
+
+void
+archive_close(struct lmc_archive *archive);
+
+unsigned long
+archive_count(const struct lmc_archive *archive);
+
+void
+archive_get(const struct lmc_archive *archive, unsigned long i,
+	struct lmc_archive_entry *entry);
+
+/* builds an archive an entry at a time; the index is written last */
+struct lmc_archive_writer
+{
+	FILE *f;
+	const char *path;
+	struct archive_index *index;
+	unsigned long count;
+	unsigned long size;
+	uint64_t pos;
+};
+
+int
+archive_create(struct lmc_archive_writer *w, const char *path);
+
+/* input and expected may be NULL; the entry is copied */
+int
+archive_add(struct lmc_archive_writer *w,
+	const struct lmc_archive_entry *entry);
+
+/* writes the index and closes the file */
+int
+archive_finish(struct lmc_archive_writer *w);
+
+/* closes and removes an unfinished archive */
+void
+archive_abandon(struct lmc_archive_writer *w);
+
+#endif
@@ -0,0 +1,104 @@
+#!/bin/sh
+#
+# Assembles every bench/*.lma with lmasm and times it under each engine
+# lmc knows about, checking the output against the .out file next to it.
+# Runs are timed by lmc itself with --stats-json, so only the execution
+# is measured, not starting the process or loading the image, and no
+# timer outside POSIX is needed.
+#
+# Environment:
+#   LMC, LMASM    binaries to use (default ./lmc and ./lmasm)
+#   BENCH_WARMUP  untimed runs per engine (default 1)
+#   BENCH_REPS    timed runs per engine (default 5)
+#   BENCH_OUT     where to put images and outputs (default bench/out)
+#
+# Exits nonzero if any run fails or produces the wrong output.
+
+LMC=${LMC:-./lmc}
+LMASM=${LMASM:-./lmasm}
+WARMUP=${BENCH_WARMUP:-1}
+REPS=${BENCH_REPS:-5}
+BENCH_DIR=$(dirname "$0")
+OUT_DIR=${BENCH_OUT:-$BENCH_DIR/out}
+
+mkdir -p "$OUT_DIR" || exit 1
+
+status=0
+printf '%-10s %-8s %12s %10s %10s %9s  %s\n' benchmark engine \
+	instructions median_ms p99_ms MIPS result
+
+for src in "$BENCH_DIR"/*.lma
+do
+	name=$(basename "$src" .lma)
+	image=$OUT_DIR/$name.lexe
+	input=$BENCH_DIR/$name.in
+	expected=$BENCH_DIR/$name.out
+
+	if ! "$LMASM" "$src" "$image" >/dev/null
+	then
+		echo "$name: failed to assemble"
+		status=1
+		continue
+	fi
+
+	for engine in $("$LMC" --list-engines)
+	do
+		output=$OUT_DIR/$name.$engine.out
+		stats=$OUT_DIR/$name.$engine.json
+		result=ok
+		insns=0
+		times=
+		i=0
+
+		while [ $i -lt $((WARMUP + REPS)) ]
+		do
+			rm -f "$stats"
+			"$LMC" -q --engine "$engine" --stats-json "$stats" \
+				"$image" <"$input" >"$output"
+			rc=$?
+
+			if [ $rc -ne 0 ] || ! cmp -s "$output" "$expected"
+			then
+				result=FAIL
+			fi
+
+			if [ $i -ge "$WARMUP" ] && [ -f "$stats" ]
+			then
+				insns=$(sed 's/.*"instructions": \([0-9]*\).*/\1/' \
+					"$stats")
+				times="$times $(sed \
+					's/.*"wall_seconds": \([0-9.]*\).*/\1/' \
+					"$stats")"
+			fi
+
+			i=$((i + 1))
+		done
+
+		echo $times | tr ' ' '\n' | sort -n | awk \
+			-v name="$name" -v engine="$engine" -v insns="$insns" \
+			-v result="$result" '
+			{ t[NR] = $1 }
+			END {
+				if (NR % 2)
+					median = t[(NR + 1) / 2]
+				else
+					median = (t[NR / 2] + t[NR / 2 + 1]) / 2
+
+				k = int(0.99 * NR)
+				if (k < 0.99 * NR)
+					++k
+
+				printf "%-10s %-8s %12d %10.3f %10.3f %9.2f  %s\n",
+					name, engine, insns, median * 1e3,
+					t[k] * 1e3, median ? insns / median / 1e6 : 0,
+					result
+			}'
+
+		if [ $result != ok ]
+		then
+			status=1
+		fi
+	done
+done
+
+exit $status
@@ -0,0 +1,51 @@
+#!/bin/sh
+#
+# Checks every engine against the reference interpreter with lmdiff, on a
+# corpus of sources and on a batch of programs from lmgen.
+#
+# Environment:
+#   LMASM, LMGEN, LMDIFF  binaries to use (default ./lmasm, ./lmgen and
+#                         ./lmdiff)
+#   VERIFY_PROGRAMS       generated programs to check (default 200)
+#   VERIFY_SEED           seed of the first one (default 1)
+#   VERIFY_CORPUS         directory of .lma sources and their .in inputs
+#                         (default bench)
+#   VERIFY_OUT            where to put images (default bench/out/verify)
+#
+# Exits nonzero if any engine diverges.
+
+LMASM=${LMASM:-./lmasm}
+LMGEN=${LMGEN:-./lmgen}
+LMDIFF=${LMDIFF:-./lmdiff}
+PROGRAMS=${VERIFY_PROGRAMS:-200}
+SEED=${VERIFY_SEED:-1}
+BENCH_DIR=$(dirname "$0")
+CORPUS_DIR=${VERIFY_CORPUS:-$BENCH_DIR}
+OUT_DIR=${VERIFY_OUT:-$BENCH_DIR/out/verify}
+
+mkdir -p "$OUT_DIR" || exit 1
+
+for src in "$CORPUS_DIR"/*.lma
+do
+	name=$(basename "$src" .lma)
+
+	"$LMASM" "$src" "$OUT_DIR/$name.lexe" >/dev/null || exit 1
+	cp "$CORPUS_DIR/$name.in" "$OUT_DIR/$name.in" || exit 1
+done
+
+# vary every knob with the seed so the batch covers a spread of shapes
+i=0
+while [ $i -lt "$PROGRAMS" ]
+do
+	seed=$((SEED + i))
+
+	"$LMGEN" --seed $seed --image --depth $((seed % 4)) \
+		--trips $((1 + seed % 50)) --loops $((seed % 30)) \
+		--self-mod $((seed % 20)) --io $((seed % 15)) \
+		--size $((10 + seed % 91)) -o "$OUT_DIR/gen$seed.lexe" \
+		--input "$OUT_DIR/gen$seed.in" 2>/dev/null || exit 1
+
+	i=$((i + 1))
+done
+
+"$LMDIFF" "$OUT_DIR"/*.lexe
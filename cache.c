@@ -0,0 +1,332 @@
+/*
+ * cache.c - Persistent run results
+ * Copyright (C) 2020 David McMackins II
+ *
+ * Redistributions, modified or unmodified, in whole or in part, must retain
+ * applicable copyright or other legal privilege notices, these conditions, and
+ * the following license terms and disclaimer.  Subject to these conditions,
+ * the holder(s) of copyright or other legal privileges, author(s) or
+ * assembler(s), and contributors of this work hereby grant to any person who
+ * obtains a copy of this work in any form:
+ *
+ * 1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ * use, and/or otherwise deal in the licensed material without restriction.
+ *
+ * 2. A perpetual, worldwide, non-exclusive, royalty-free, irrevocable patent
+ * license to reproduce, modify, distribute, publish, sell, use, and/or
+ * otherwise deal in the licensed material without restriction, for any and all
+ * patents:
+ *
+ *     a. Held by each such holder of copyright or other legal privilege,
+ *     author or assembler, or contributor, necessarily infringed by the
+ *     contributions alone or by combination with the work, of that privilege
+ *     holder, author or assembler, or contributor.
+ *
+ *     b. Necessarily infringed by the work at the time that holder of
+ *     copyright or other privilege, author or assembler, or contributor made
+ *     any contribution to the work.
+ *
+ * NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ * LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ * A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ * ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ * ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT, TORT,
+ * OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR THE USE
+ * OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "cache.h"
+
+/*
+ * The file is a header, an open-addressed table of CACHE_SLOTS slots and
+ * then the entries, each one the key followed by the output.  Entries are
+ * only ever appended.  Readers take a shared lock on the whole file and
+ * map it; writers take an exclusive one.
+ */
+
+#define CACHE_MAGIC "LMCCACHE"
+#define CACHE_VERSION 1
+#define CACHE_SLOTS 16384
+#define CACHE_MAX_PROBES 64
+
+struct cache_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t slots;
+	uint64_t data_end;
+};
+
+struct cache_slot
+{
+	uint64_t hash;
+	uint64_t offset; /* 0 if the slot is free */
+	uint32_t key_len;
+	uint32_t output_len;
+};
+
+#define CACHE_INDEX_SIZE \
+	(sizeof (struct cache_header) + CACHE_SLOTS * sizeof (struct cache_slot))
+
+static uint64_t
+hash_key(const unsigned char *key, size_t len)
+{
+	uint64_t h = UINT64_C(0xcbf29ce484222325);
+	size_t i;
+
+	for (i = 0; i < len; ++i)
+	{
+		h ^= key[i];
+		h *= UINT64_C(0x100000001b3);
+	}
+
+	return h;
+}
+
+static int
+lock(int fd, short type)
+{
+	struct flock fl;
+
+	memset(&fl, 0, sizeof fl);
+	fl.l_type = type;
+	fl.l_whence = SEEK_SET;
+
+	while (fcntl(fd, F_SETLKW, &fl) == -1)
+	{
+		if (errno != EINTR)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int
+write_all(int fd, const void *buf, size_t len, off_t offset)
+{
+	const char *p = buf;
+
+	while (len)
+	{
+		ssize_t n = pwrite(fd, p, len, offset);
+
+		if (n < 0)
+		{
+			if (EINTR == errno)
+				continue;
+
+			return -1;
+		}
+
+		p += n;
+		len -= n;
+		offset += n;
+	}
+
+	return 0;
+}
+
+static int
+cache_error(const struct lmc_cache *cache)
+{
+	fprintf(stderr, "Error using cache %s: %s\n", cache->path,
+		strerror(errno));
+	lock(cache->fd, F_UNLCK);
+	return -1;
+}
+
+int
+cache_open(struct lmc_cache *cache, const char *path)
+{
+	struct cache_header header;
+	struct stat st;
+
+	cache->path = path;
+	cache->fd = open(path, O_RDWR | O_CREAT, 0666);
+	if (cache->fd < 0)
+	{
+		fprintf(stderr, "Error opening %s: %s\n", path,
+			strerror(errno));
+		return -1;
+	}
+
+	if (lock(cache->fd, F_WRLCK) || fstat(cache->fd, &st))
+		goto fail;
+
+	if (0 == st.st_size)
+	{
+		memset(&header, 0, sizeof header);
+		memcpy(header.magic, CACHE_MAGIC, sizeof header.magic);
+		header.version = CACHE_VERSION;
+		header.slots = CACHE_SLOTS;
+		header.data_end = CACHE_INDEX_SIZE;
+
+		if (ftruncate(cache->fd, CACHE_INDEX_SIZE)
+			|| write_all(cache->fd, &header, sizeof header, 0))
+		{
+			goto fail;
+		}
+	}
+	else if ((size_t) st.st_size < CACHE_INDEX_SIZE
+		|| pread(cache->fd, &header, sizeof header, 0)
+			!= sizeof header
+		|| memcmp(header.magic, CACHE_MAGIC, sizeof header.magic)
+		|| header.version != CACHE_VERSION
+		|| header.slots != CACHE_SLOTS)
+	{
+		fprintf(stderr, "%s is not an lmc cache\n", path);
+		lock(cache->fd, F_UNLCK);
+		cache_close(cache);
+		return -1;
+	}
+
+	lock(cache->fd, F_UNLCK);
+	return 0;
+
+fail:
+	cache_error(cache);
+	cache_close(cache);
+	return -1;
+}
+
+void
+cache_close(struct lmc_cache *cache)
+{
+	if (cache->fd >= 0)
+		close(cache->fd);
+
+	cache->fd = -1;
+}
+
+int
+cache_lookup(struct lmc_cache *cache, const void *key, size_t key_len,
+	FILE *out)
+{
+	const struct cache_slot *slots;
+	const unsigned char *map;
+	struct stat st;
+	uint64_t hash = hash_key(key, key_len);
+	int i, rc = 0;
+
+	if (lock(cache->fd, F_RDLCK) || fstat(cache->fd, &st))
+		return cache_error(cache);
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, cache->fd, 0);
+	if (MAP_FAILED == map)
+		return cache_error(cache);
+
+	slots = (const struct cache_slot *)
+		(map + sizeof (struct cache_header));
+
+	for (i = 0; i < CACHE_MAX_PROBES; ++i)
+	{
+		const struct cache_slot *slot =
+			&slots[(hash + i) % CACHE_SLOTS];
+
+		if (!slot->offset)
+			break;
+
+		if (slot->hash != hash || slot->key_len != key_len
+			|| slot->offset + slot->key_len + slot->output_len
+				> (uint64_t) st.st_size
+			|| memcmp(map + slot->offset, key, key_len) != 0)
+		{
+			continue;
+		}
+
+		if (fwrite(map + slot->offset + key_len, 1, slot->output_len,
+				out) != slot->output_len)
+		{
+			rc = -1;
+		}
+		else
+		{
+			rc = 1;
+		}
+
+		break;
+	}
+
+	munmap((void *) map, st.st_size);
+	lock(cache->fd, F_UNLCK);
+	return rc;
+}
+
+int
+cache_store(struct lmc_cache *cache, const void *key, size_t key_len,
+	const void *output, size_t output_len)
+{
+	struct cache_header *header;
+	struct cache_slot *slots, *slot = NULL;
+	void *map;
+	uint64_t hash = hash_key(key, key_len);
+	int i;
+
+	if (key_len > UINT32_MAX || output_len > UINT32_MAX)
+		return 0;
+
+	if (lock(cache->fd, F_WRLCK))
+		return cache_error(cache);
+
+	map = mmap(NULL, CACHE_INDEX_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+		cache->fd, 0);
+	if (MAP_FAILED == map)
+		return cache_error(cache);
+
+	header = map;
+	slots = (struct cache_slot *) (header + 1);
+
+	for (i = 0; i < CACHE_MAX_PROBES; ++i)
+	{
+		struct cache_slot *probe = &slots[(hash + i) % CACHE_SLOTS];
+
+		/* another process may have finished the same run first;
+		   on a collision this only skips storing ours */
+		if (probe->offset && probe->hash == hash
+			&& probe->key_len == key_len)
+		{
+			break;
+		}
+
+		if (!probe->offset)
+		{
+			slot = probe;
+			break;
+		}
+	}
+
+	if (slot)
+	{
+		off_t offset = header->data_end;
+
+		if (write_all(cache->fd, key, key_len, offset)
+			|| write_all(cache->fd, output, output_len,
+				offset + key_len))
+		{
+			munmap(map, CACHE_INDEX_SIZE);
+			return cache_error(cache);
+		}
+
+		slot->hash = hash;
+		slot->key_len = key_len;
+		slot->output_len = output_len;
+		slot->offset = offset;
+		header->data_end = offset + key_len + output_len;
+	}
+
+	munmap(map, CACHE_INDEX_SIZE);
+	lock(cache->fd, F_UNLCK);
+	return 0;
+}
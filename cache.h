@@ -0,0 +1,71 @@
+/*
+ * cache.h - Persistent run results
+ * Copyright (C) 2020 David McMackins II
+ *
+ * Redistributions, modified or unmodified, in whole or in part, must retain
+ * applicable copyright or other legal privilege notices, these conditions, and
+ * the following license terms and disclaimer.  Subject to these conditions,
+ * the holder(s) of copyright or other legal privileges, author(s) or
+ * assembler(s), and contributors of this work hereby grant to any person who
+ * obtains a copy of this work in any form:
+ *
+ * 1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ * use, and/or otherwise deal in the licensed material without restriction.
+ *
+ * 2. A perpetual, worldwide, non-exclusive, royalty-free, irrevocable patent
+ * license to reproduce, modify, distribute, publish, sell, use, and/or
+ * otherwise deal in the licensed material without restriction, for any and all
+ * patents:
+ *
+ *     a. Held by each such holder of copyright or other legal privilege,
+ *     author or assembler, or contributor, necessarily infringed by the
+ *     contributions alone or by combination with the work, of that privilege
+ *     holder, author or assembler, or contributor.
+ *
+ *     b. Necessarily infringed by the work at the time that holder of
+ *     copyright or other privilege, author or assembler, or contributor made
+ *     any contribution to the work.
+ *
+ * NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ * LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ * A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ * ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ * ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT, TORT,
+ * OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR THE USE
+ * OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#ifndef LMC_CACHE_H
+#define LMC_CACHE_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+/* a file of finished runs, shared by any number of lmc processes; keys are
+   compared in full, so a hash collision can only cost a lookup */
+struct lmc_cache
+{
+	const char *path;
+	int fd;
+};
+
+/* creates the file if it doesn't exist */
+int
+cache_open(struct lmc_cache *cache, const char *path);
+
+void
+cache_close(struct lmc_cache *cache);
+
+/* writes the output stored under key to out; returns 1 on a hit, 0 on a
+   miss, or -1 on error */
+int
+cache_lookup(struct lmc_cache *cache, const void *key, size_t key_len,
+	FILE *out);
+
+/* does nothing if the key is already stored or the table is full */
+int
+cache_store(struct lmc_cache *cache, const void *key, size_t key_len,
+	const void *output, size_t output_len);
+
+#endif
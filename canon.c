@@ -0,0 +1,291 @@
+/*
+ * canon.c - canonical forms of loaded programs
+ * Copyright (C) 2020 David McMackins II
+ *
+ * Redistributions, modified or unmodified, in whole or in part, must retain
+ * applicable copyright or other legal privilege notices, these conditions, and
+ * the following license terms and disclaimer.  Subject to these conditions,
+ * the holder(s) of copyright or other legal privileges, author(s) or
+ * assembler(s), and contributors of this work hereby grant to any person who
+ * obtains a copy of this work in any form:
+ *
+ * 1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ * use, and/or otherwise deal in the licensed material without restriction.
+ *
+ * 2. A perpetual, worldwide, non-exclusive, royalty-free, irrevocable patent
+ * license to reproduce, modify, distribute, publish, sell, use, and/or
+ * otherwise deal in the licensed material without restriction, for any and all
+ * patents:
+ *
+ *     a. Held by each such holder of copyright or other legal privilege,
+ *     author or assembler, or contributor, necessarily infringed by the
+ *     contributions alone or by combination with the work, of that privilege
+ *     holder, author or assembler, or contributor.
+ *
+ *     b. Necessarily infringed by the work at the time that holder of
+ *     copyright or other privilege, author or assembler, or contributor made
+ *     any contribution to the work.
+ *
+ * NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ * LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ * A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ * ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ * ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT, TORT,
+ * OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR THE USE
+ * OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "canon.h"
+
+enum mailbox_use
+{
+	USE_RUN = 1,
+	USE_READ = 2,
+	USE_WRITE = 4
+};
+
+struct canon_slot
+{
+	uint64_t hash;
+	unsigned char *key; /* followed by the value; NULL if empty */
+	size_t key_len;
+	size_t value_len;
+};
+
+#define MEMO_INITIAL_SLOTS 256
+
+static void
+visit(unsigned char *use, int *stack, int *depth, int mailbox)
+{
+	if (use[mailbox] & USE_RUN)
+		return;
+
+	use[mailbox] |= USE_RUN;
+	stack[(*depth)++] = mailbox;
+}
+
+/* follows every path from mailbox 0, marking what can run and what those
+   instructions can read and write; a path ends where the machine would
+   halt, whether or not that's an error */
+static void
+trace_uses(const struct lmc *lmc, unsigned char *use, int *stack)
+{
+	int depth = 0;
+
+	visit(use, stack, &depth, 0);
+	while (depth)
+	{
+		int mailbox = stack[--depth];
+		int instruction = lmc->mailboxes[mailbox];
+		int opcode = instruction / NUM_MAILBOXES;
+		int addr = instruction % NUM_MAILBOXES;
+		int next = (mailbox + 1) % NUM_MAILBOXES;
+
+		if (instruction < 0)
+			continue;
+
+		switch (opcode)
+		{
+		case 1:
+		case 2:
+		case 5:
+			use[addr] |= USE_READ;
+			visit(use, stack, &depth, next);
+			break;
+
+		case 3:
+			use[addr] |= USE_WRITE;
+			visit(use, stack, &depth, next);
+			break;
+
+		case 6:
+			visit(use, stack, &depth, addr);
+			break;
+
+		case 7:
+		case 8:
+			visit(use, stack, &depth, next);
+			visit(use, stack, &depth, addr);
+			break;
+
+		case 9:
+			if (1 == addr || 2 == addr)
+				visit(use, stack, &depth, next);
+			break;
+
+		default: /* HLT or a bad instruction */
+			break;
+		}
+	}
+}
+
+int
+canon_image(struct lmc *lmc)
+{
+	unsigned char *use;
+	int *stack;
+	int i, used;
+
+	use = calloc(NUM_MAILBOXES, 1);
+	stack = malloc(NUM_MAILBOXES * sizeof *stack);
+	if (!use || !stack)
+		goto end;
+
+	trace_uses(lmc, use, stack);
+
+	/* what runs is only known from the image if none of it is
+	   overwritten */
+	for (i = 0; i < NUM_MAILBOXES; ++i)
+	{
+		if ((use[i] & USE_RUN) && (use[i] & USE_WRITE))
+			goto end;
+	}
+
+	for (i = 0; i < NUM_MAILBOXES; ++i)
+	{
+		if (!(use[i] & (USE_RUN | USE_READ)))
+			lmc->mailboxes[i] = 0;
+	}
+
+end:
+	free(use);
+	free(stack);
+
+	for (used = NUM_MAILBOXES; used && !lmc->mailboxes[used - 1]; --used)
+		;
+
+	return used;
+}
+
+static uint64_t
+hash_key(const unsigned char *key, size_t len)
+{
+	uint64_t h = UINT64_C(0xcbf29ce484222325);
+	size_t i;
+
+	for (i = 0; i < len; ++i)
+	{
+		h ^= key[i];
+		h *= UINT64_C(0x100000001b3);
+	}
+
+	return h;
+}
+
+int
+canon_memo_init(struct canon_memo *memo)
+{
+	memo->slots = calloc(MEMO_INITIAL_SLOTS, sizeof *memo->slots);
+	if (!memo->slots)
+		return -1;
+
+	memo->mask = MEMO_INITIAL_SLOTS - 1;
+	memo->used = 0;
+	return 0;
+}
+
+void
+canon_memo_free(struct canon_memo *memo)
+{
+	size_t i;
+
+	for (i = 0; i <= memo->mask; ++i)
+		free(memo->slots[i].key);
+
+	free(memo->slots);
+	memo->slots = NULL;
+}
+
+/* the slot holding key, or the empty one it would go in */
+static struct canon_slot *
+find_slot(struct canon_slot *slots, size_t mask, uint64_t hash,
+	const void *key, size_t key_len)
+{
+	size_t i;
+
+	for (i = hash & mask; slots[i].key; i = (i + 1) & mask)
+	{
+		if (slots[i].hash == hash && slots[i].key_len == key_len
+			&& !memcmp(slots[i].key, key, key_len))
+		{
+			break;
+		}
+	}
+
+	return &slots[i];
+}
+
+const void *
+canon_memo_find(const struct canon_memo *memo, const void *key,
+	size_t key_len, size_t *value_len)
+{
+	const struct canon_slot *slot;
+
+	slot = find_slot(memo->slots, memo->mask, hash_key(key, key_len), key,
+		key_len);
+	if (!slot->key)
+		return NULL;
+
+	*value_len = slot->value_len;
+	return slot->key + slot->key_len;
+}
+
+/* doubles the table once it's half full */
+static int
+grow(struct canon_memo *memo)
+{
+	struct canon_slot *slots;
+	size_t i, mask = memo->mask * 2 + 1;
+
+	slots = calloc(mask + 1, sizeof *slots);
+	if (!slots)
+		return -1;
+
+	for (i = 0; i <= memo->mask; ++i)
+	{
+		const struct canon_slot *old = &memo->slots[i];
+
+		if (old->key)
+		{
+			*find_slot(slots, mask, old->hash, old->key,
+				old->key_len) = *old;
+		}
+	}
+
+	free(memo->slots);
+	memo->slots = slots;
+	memo->mask = mask;
+	return 0;
+}
+
+int
+canon_memo_store(struct canon_memo *memo, const void *key, size_t key_len,
+	const void *value, size_t value_len)
+{
+	struct canon_slot *slot;
+	uint64_t hash = hash_key(key, key_len);
+
+	if (memo->used * 2 >= memo->mask && grow(memo))
+		return -1;
+
+	slot = find_slot(memo->slots, memo->mask, hash, key, key_len);
+	if (slot->key)
+		return 0;
+
+	/* one byte more so that an empty key and value still get one */
+	slot->key = malloc(key_len + value_len + 1);
+	if (!slot->key)
+		return -1;
+
+	memcpy(slot->key, key, key_len);
+	memcpy(slot->key + key_len, value, value_len);
+	slot->hash = hash;
+	slot->key_len = key_len;
+	slot->value_len = value_len;
+	++memo->used;
+	return 0;
+}
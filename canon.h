@@ -0,0 +1,79 @@
+/*
+ * canon.h - canonical forms of loaded programs
+ * Copyright (C) 2020 David McMackins II
+ *
+ * Redistributions, modified or unmodified, in whole or in part, must retain
+ * applicable copyright or other legal privilege notices, these conditions, and
+ * the following license terms and disclaimer.  Subject to these conditions,
+ * the holder(s) of copyright or other legal privileges, author(s) or
+ * assembler(s), and contributors of this work hereby grant to any person who
+ * obtains a copy of this work in any form:
+ *
+ * 1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ * use, and/or otherwise deal in the licensed material without restriction.
+ *
+ * 2. A perpetual, worldwide, non-exclusive, royalty-free, irrevocable patent
+ * license to reproduce, modify, distribute, publish, sell, use, and/or
+ * otherwise deal in the licensed material without restriction, for any and all
+ * patents:
+ *
+ *     a. Held by each such holder of copyright or other legal privilege,
+ *     author or assembler, or contributor, necessarily infringed by the
+ *     contributions alone or by combination with the work, of that privilege
+ *     holder, author or assembler, or contributor.
+ *
+ *     b. Necessarily infringed by the work at the time that holder of
+ *     copyright or other privilege, author or assembler, or contributor made
+ *     any contribution to the work.
+ *
+ * NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ * LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ * A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ * ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ * ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT, TORT,
+ * OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR THE USE
+ * OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#ifndef LMC_CANON_H
+#define LMC_CANON_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lmc.h"
+
+/* zeroes every mailbox that can neither be run nor read, so programs that
+   differ only in those load identically; programs that store into their
+   own code are left as they are. Returns how many mailboxes are left
+   before the trailing zeroes. */
+int
+canon_image(struct lmc *lmc);
+
+/* results of runs, keyed by the canonical program and whatever else
+   decides how it runs; keys are compared in full */
+struct canon_memo
+{
+	struct canon_slot *slots;
+	size_t mask;
+	size_t used;
+};
+
+int
+canon_memo_init(struct canon_memo *memo);
+
+void
+canon_memo_free(struct canon_memo *memo);
+
+/* the value stored under key, or NULL */
+const void *
+canon_memo_find(const struct canon_memo *memo, const void *key,
+	size_t key_len, size_t *value_len);
+
+/* copies key and value; does nothing if the key is already stored */
+int
+canon_memo_store(struct canon_memo *memo, const void *key, size_t key_len,
+	const void *value, size_t value_len);
+
+#endif
@@ -0,0 +1,556 @@
+/*
+ * lmc - Little Man Computer
+ * Copyright (C) 2020 David McMackins II
+ *
+ * Redistributions, modified or unmodified, in whole or in part, must retain
+ * applicable copyright or other legal privilege notices, these conditions, and
+ * the following license terms and disclaimer.  Subject to these conditions,
+ * the holder(s) of copyright or other legal privileges, author(s) or
+ * assembler(s), and contributors of this work hereby grant to any person who
+ * obtains a copy of this work in any form:
+ *
+ * 1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ * use, and/or otherwise deal in the licensed material without restriction.
+ *
+ * 2. A perpetual, worldwide, non-exclusive, royalty-free, irrevocable patent
+ * license to reproduce, modify, distribute, publish, sell, use, and/or
+ * otherwise deal in the licensed material without restriction, for any and all
+ * patents:
+ *
+ *     a. Held by each such holder of copyright or other legal privilege,
+ *     author or assembler, or contributor, necessarily infringed by the
+ *     contributions alone or by combination with the work, of that privilege
+ *     holder, author or assembler, or contributor.
+ *
+ *     b. Necessarily infringed by the work at the time that holder of
+ *     copyright or other privilege, author or assembler, or contributor made
+ *     any contribution to the work.
+ *
+ * NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ * LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ * A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ * ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ * ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT, TORT,
+ * OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR THE USE
+ * OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lmc.h"
+#include "predecode.h"
+#include "tier.h"
+
+void
+bad_instruction(struct lmc *lmc)
+{
+	struct lmc_cpu *cpu = &lmc->cpu;
+
+	fprintf(stderr, "Bad instruction! (%d)\n", cpu->instruction);
+	fprintf(stderr, "a  = %d\n", cpu->a);
+	fprintf(stderr, "pc = %d\n", cpu->pc);
+	fprintf(stderr, "opcode = %d\n", cpu->opcode);
+	fprintf(stderr, "addr   = %d\n", cpu->addr);
+	fprintf(stderr, "neg    = %d\n", !!cpu->neg);
+	fprintf(stderr, "halt   = %d\n", !!cpu->halted);
+
+	cpu->halted = true;
+	cpu->error = true;
+}
+
+static void
+lmc_halt(struct lmc *lmc)
+{
+	lmc->cpu.halted = true;
+}
+
+static void
+lmc_add(struct lmc *lmc)
+{
+	lmc->cpu.a += lmc->mailboxes[lmc->cpu.addr];
+	lmc->cpu.neg = lmc->cpu.a > MAX_VALUE;
+	if (lmc->cpu.neg)
+		lmc->cpu.a -= MAX_VALUE + 1;
+}
+
+static void
+lmc_sub(struct lmc *lmc)
+{
+	lmc->cpu.a -= lmc->mailboxes[lmc->cpu.addr];
+	lmc->cpu.neg = lmc->cpu.a < 0;
+	if (lmc->cpu.neg)
+		lmc->cpu.a += MAX_VALUE + 1;
+}
+
+static void
+lmc_store(struct lmc *lmc)
+{
+	lmc->mailboxes[lmc->cpu.addr] = lmc->cpu.a;
+}
+
+static void
+lmc_load(struct lmc *lmc)
+{
+	lmc->cpu.a = lmc->mailboxes[lmc->cpu.addr];
+}
+
+static void
+lmc_branch(struct lmc *lmc)
+{
+	lmc->cpu.pc = lmc->cpu.addr;
+}
+
+static void
+lmc_branch_zero(struct lmc *lmc)
+{
+	if (0 == lmc->cpu.a)
+		lmc->cpu.pc = lmc->cpu.addr;
+}
+
+static void
+lmc_branch_positive(struct lmc *lmc)
+{
+	if (!lmc->cpu.neg)
+		lmc->cpu.pc = lmc->cpu.addr;
+}
+
+static void
+lmc_io(struct lmc *lmc)
+{
+	int rc;
+
+	switch (lmc->cpu.addr)
+	{
+	case 1:
+		++lmc->inputs;
+		rc = 0;
+		while (rc != 1 || lmc->cpu.a < 0 || lmc->cpu.a > MAX_VALUE)
+		{
+			if (!lmc->quiet)
+				fprintf(lmc->out, "Input number (0-%d): ",
+					MAX_VALUE);
+
+			rc = fscanf(lmc->in, "%d", &lmc->cpu.a);
+			if (EOF == rc)
+			{
+				fprintf(stderr, "Unexpected end of input\n");
+				lmc->cpu.halted = true;
+				lmc->cpu.error = true;
+				break;
+			}
+
+			if (0 == rc) /* skip whatever isn't a number */
+				rc = fscanf(lmc->in, "%*s");
+		}
+		break;
+
+	case 2:
+		++lmc->outputs;
+		if (lmc->output)
+			lmc->output(lmc, lmc->cpu.a);
+		else
+			fprintf(lmc->out, "%d\n", lmc->cpu.a);
+		break;
+
+	default:
+		bad_instruction(lmc);
+		break;
+	}
+}
+
+const lmc_op OPS[NUM_OPCODES] =
+{
+	lmc_halt,
+	lmc_add,
+	lmc_sub,
+	lmc_store,
+	NULL, /* no 4xx instruction in ISA */
+	lmc_load,
+	lmc_branch,
+	lmc_branch_zero,
+	lmc_branch_positive,
+	lmc_io
+};
+
+static const char *const MNEMONICS[NUM_OPCODES] =
+{
+	"HLT",
+	"ADD",
+	"SUB",
+	"STA",
+	NULL,
+	"LDA",
+	"BRA",
+	"BRZ",
+	"BRP",
+	NULL /* depends on the address field */
+};
+
+const char *
+lmc_mnemonic(int instruction)
+{
+	int opcode = instruction / NUM_MAILBOXES;
+
+	if (opcode < 0 || opcode >= NUM_OPCODES)
+		return NULL;
+
+	if (9 == opcode)
+	{
+		switch (instruction % NUM_MAILBOXES)
+		{
+		case 1:
+			return "INP";
+
+		case 2:
+			return "OUT";
+
+		default:
+			return NULL;
+		}
+	}
+
+	return MNEMONICS[opcode];
+}
+
+const struct lmc_engine ENGINES[] =
+{
+	{ "loop", lmc_run, lmc_run_for },
+	{ "predecoded", lmc_run_predecoded, lmc_run_predecoded_for },
+	{ "tiered", lmc_run_tiered, lmc_run_tiered_for },
+	{ "resident", lmc_run_resident, lmc_run_resident_for },
+	{ NULL, NULL, NULL }
+};
+
+unsigned char *
+lmc_read_image(const char *path, size_t *len)
+{
+	FILE *input_file;
+	unsigned char *image;
+	size_t max = (size_t) NUM_MAILBOXES * NUM_DIGITS + 1;
+
+	input_file = fopen(path, "rb");
+	if (!input_file)
+	{
+		fprintf(stderr, "Error opening %s: %s\n", path,
+			strerror(errno));
+		return NULL;
+	}
+
+	/* one byte more than fits, so an image that's too big shows */
+	image = malloc(max);
+	if (!image)
+	{
+		fprintf(stderr, "Out of memory\n");
+		fclose(input_file);
+		return NULL;
+	}
+
+	*len = fread(image, 1, max, input_file);
+	if (ferror(input_file))
+	{
+		fprintf(stderr, "Error loading %s: %s\n", path,
+			strerror(errno));
+		fclose(input_file);
+		free(image);
+		return NULL;
+	}
+
+	fclose(input_file);
+	return image;
+}
+
+int
+lmc_decode_image(struct lmc *lmc, const unsigned char *image, size_t len,
+	const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < len; ++i)
+	{
+		int *mailbox;
+
+		if (image[i] > 9) /* not a digit */
+		{
+			fprintf(stderr, "Digit %d at position %d is too big\n",
+				image[i], (int) i);
+			return -1;
+		}
+
+		if (i / NUM_DIGITS == NUM_MAILBOXES)
+		{
+			fprintf(stderr, "%s has more than %d mailboxes\n", name,
+				NUM_MAILBOXES);
+			return -1;
+		}
+
+		mailbox = &lmc->mailboxes[i / NUM_DIGITS];
+		*mailbox *= 10;
+		*mailbox += image[i];
+	}
+
+	if ((i % NUM_DIGITS) != 0)
+	{
+		fprintf(stderr,
+			"File size is not a multiple of the number of digits per mailbox\n");
+		return -1;
+	}
+
+	return (int) (i / NUM_DIGITS);
+}
+
+int
+lmc_load_image(struct lmc *lmc, const char *path)
+{
+	unsigned char *image;
+	size_t len;
+	int rc;
+
+	image = lmc_read_image(path, &len);
+	if (!image)
+		return -1;
+
+	rc = lmc_decode_image(lmc, image, len, path);
+	free(image);
+	return rc;
+}
+
+const struct lmc_engine *
+lmc_find_engine(const char *name)
+{
+	int i;
+
+	for (i = 0; ENGINES[i].name; ++i)
+	{
+		if (strcmp(ENGINES[i].name, name) == 0)
+			return &ENGINES[i];
+	}
+
+	return NULL;
+}
+
+void
+lmc_step(struct lmc *lmc)
+{
+	struct lmc_cpu *cpu = &lmc->cpu;
+	int instruction;
+
+	if (cpu->halted)
+		return;
+
+	instruction = lmc->mailboxes[cpu->pc];
+	cpu->instruction = instruction;
+	cpu->opcode = instruction / NUM_MAILBOXES;
+	cpu->addr = instruction % NUM_MAILBOXES;
+	cpu->pc = (cpu->pc + 1) % NUM_MAILBOXES;
+
+	switch (cpu->opcode)
+	{
+	case 0:
+		cpu->halted = true;
+		break;
+
+	case 1:
+		cpu->a += lmc->mailboxes[cpu->addr];
+		cpu->neg = cpu->a > MAX_VALUE;
+		if (cpu->neg)
+			cpu->a -= MAX_VALUE + 1;
+		break;
+
+	case 2:
+		cpu->a -= lmc->mailboxes[cpu->addr];
+		cpu->neg = cpu->a < 0;
+		if (cpu->neg)
+			cpu->a += MAX_VALUE + 1;
+		break;
+
+	case 3:
+		lmc->mailboxes[cpu->addr] = cpu->a;
+		break;
+
+	case 5:
+		cpu->a = lmc->mailboxes[cpu->addr];
+		break;
+
+	case 6:
+		cpu->pc = cpu->addr;
+		break;
+
+	case 7:
+		if (0 == cpu->a)
+			cpu->pc = cpu->addr;
+		break;
+
+	case 8:
+		if (!cpu->neg)
+			cpu->pc = cpu->addr;
+		break;
+
+	case 9:
+		lmc_io(lmc);
+		break;
+
+	default:
+		bad_instruction(lmc);
+		break;
+	}
+}
+
+void
+lmc_run(struct lmc *lmc)
+{
+	while (!lmc->cpu.halted)
+	{
+		lmc_op op;
+
+		lmc->cpu.instruction = lmc->mailboxes[lmc->cpu.pc++];
+		lmc->cpu.opcode = lmc->cpu.instruction / NUM_MAILBOXES;
+		lmc->cpu.addr = lmc->cpu.instruction % NUM_MAILBOXES;
+
+		if (lmc->cpu.pc == NUM_MAILBOXES) /* wrap around, don't run off */
+			lmc->cpu.pc = 0;
+
+		if (lmc->cpu.opcode > 9 || (op = OPS[lmc->cpu.opcode]) == NULL)
+		{
+			bad_instruction(lmc);
+			break;
+		}
+
+		op(lmc);
+	}
+}
+
+uint64_t
+lmc_run_for(struct lmc *lmc, uint64_t steps)
+{
+	uint64_t n;
+
+	for (n = 0; n < steps && !lmc->cpu.halted; ++n)
+	{
+		lmc_op op;
+
+		lmc->cpu.instruction = lmc->mailboxes[lmc->cpu.pc++];
+		lmc->cpu.opcode = lmc->cpu.instruction / NUM_MAILBOXES;
+		lmc->cpu.addr = lmc->cpu.instruction % NUM_MAILBOXES;
+
+		if (lmc->cpu.pc == NUM_MAILBOXES) /* wrap around, don't run off */
+			lmc->cpu.pc = 0;
+
+		if (lmc->cpu.opcode > 9 || (op = OPS[lmc->cpu.opcode]) == NULL)
+		{
+			bad_instruction(lmc);
+			return n + 1;
+		}
+
+		op(lmc);
+	}
+
+	return n;
+}
+
+static void
+sync_resident(struct lmc *lmc, int a, int pc, int instruction, int result)
+{
+	struct lmc_cpu *cpu = &lmc->cpu;
+
+	cpu->a = a;
+	cpu->pc = pc;
+	cpu->neg = result < 0 || result > MAX_VALUE;
+	cpu->instruction = instruction;
+	cpu->opcode = instruction / NUM_MAILBOXES;
+	cpu->addr = instruction % NUM_MAILBOXES;
+}
+
+/*
+ * lmc_run_for() with the CPU in locals. The negative flag is kept as the
+ * last ADD or SUB before wrapping, and only worked out by BRP; the decoded
+ * fields are only written back when the loop stops or something else
+ * needs them.
+ */
+uint64_t
+lmc_run_resident_for(struct lmc *lmc, uint64_t steps)
+{
+	int *mailboxes = lmc->mailboxes;
+	int a = lmc->cpu.a, pc = lmc->cpu.pc, instruction = lmc->cpu.instruction;
+	int result = lmc->cpu.neg ? -1 : 0;
+	uint64_t n;
+
+	if (lmc->cpu.halted)
+		return 0;
+
+	for (n = 0; n < steps; ++n)
+	{
+		int addr;
+
+		instruction = mailboxes[pc];
+		addr = instruction % NUM_MAILBOXES;
+		if (++pc == NUM_MAILBOXES)
+			pc = 0;
+
+		switch (instruction / NUM_MAILBOXES)
+		{
+		case 0:
+			sync_resident(lmc, a, pc, instruction, result);
+			lmc->cpu.halted = true;
+			return n + 1;
+
+		case 1:
+			result = a + mailboxes[addr];
+			a = result > MAX_VALUE ? result - (MAX_VALUE + 1) : result;
+			break;
+
+		case 2:
+			result = a - mailboxes[addr];
+			a = result < 0 ? result + MAX_VALUE + 1 : result;
+			break;
+
+		case 3:
+			mailboxes[addr] = a;
+			break;
+
+		case 5:
+			a = mailboxes[addr];
+			break;
+
+		case 6:
+			pc = addr;
+			break;
+
+		case 7:
+			if (0 == a)
+				pc = addr;
+			break;
+
+		case 8:
+			if (result >= 0 && result <= MAX_VALUE)
+				pc = addr;
+			break;
+
+		case 9:
+			sync_resident(lmc, a, pc, instruction, result);
+			lmc_io(lmc);
+			if (lmc->cpu.halted)
+				return n + 1;
+
+			a = lmc->cpu.a;
+			break;
+
+		default:
+			sync_resident(lmc, a, pc, instruction, result);
+			bad_instruction(lmc);
+			return n + 1;
+		}
+	}
+
+	sync_resident(lmc, a, pc, instruction, result);
+	return n;
+}
+
+void
+lmc_run_resident(struct lmc *lmc)
+{
+	lmc_run_resident_for(lmc, UINT64_MAX);
+}
@@ -0,0 +1,794 @@
+/*
+ * lmc - Little Man Computer emulator
+ * Copyright (C) 2020 David McMackins II
+ *
+ * Redistributions, modified or unmodified, in whole or in part, must retain
+ * applicable copyright or other legal privilege notices, these conditions, and
+ * the following license terms and disclaimer.  Subject to these conditions,
+ * the holder(s) of copyright or other legal privileges, author(s) or
+ * assembler(s), and contributors of this work hereby grant to any person who
+ * obtains a copy of this work in any form:
+ *
+ * 1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ * use, and/or otherwise deal in the licensed material without restriction.
+ *
+ * 2. A perpetual, worldwide, non-exclusive, royalty-free, irrevocable patent
+ * license to reproduce, modify, distribute, publish, sell, use, and/or
+ * otherwise deal in the licensed material without restriction, for any and all
+ * patents:
+ *
+ *     a. Held by each such holder of copyright or other legal privilege,
+ *     author or assembler, or contributor, necessarily infringed by the
+ *     contributions alone or by combination with the work, of that privilege
+ *     holder, author or assembler, or contributor.
+ *
+ *     b. Necessarily infringed by the work at the time that holder of
+ *     copyright or other privilege, author or assembler, or contributor made
+ *     any contribution to the work.
+ *
+ * NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ * LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ * A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ * ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ * ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT, TORT,
+ * OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR THE USE
+ * OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "debug.h"
+#include "history.h"
+#include "lmc.h"
+#include "predecode.h"
+#include "srcmap.h"
+
+#define DEBUG_LINE_LEN 256
+#define DEBUG_MAX_ARGS 2
+
+struct debug
+{
+	struct lmc_predecoded p;
+	struct lmc_io_log log;
+	struct lmc_history history; /* no snapshots if time travel is off */
+	uint64_t now; /* instructions executed */
+	const struct lmc_srcmap *map;
+
+	/* NUM_MAILBOXES of them, kept here while a replay runs without */
+	unsigned char *saved_traps;
+};
+
+/* a trap found while replaying */
+struct debug_stop
+{
+	uint64_t time;
+	enum predecode_stop stop;
+	int pc;
+	int mailbox;
+	int value; /* before a write */
+	int new_value;
+};
+
+struct debug_command
+{
+	const char *name;
+	const char *alias;
+	int min_args;
+	int max_args;
+	int traps; /* for the watchpoint commands */
+
+	/* returns 0 to carry on, 1 to quit, -1 on error */
+	int (*run)(struct debug *d, const struct debug_command *self,
+		char **argv);
+
+	const char *help;
+};
+
+static void
+print_instruction(const struct debug *d, int mailbox)
+{
+	int instruction = d->p.lmc->mailboxes[mailbox];
+	int opcode = instruction / NUM_MAILBOXES;
+	const char *name = lmc_mnemonic(instruction);
+	bool label, line;
+	char buf[8];
+
+	if (!name)
+		sprintf(buf, "???");
+	else if (0 == opcode || 9 == opcode)
+		sprintf(buf, "%s", name);
+	else
+		sprintf(buf, "%s %d", name, instruction % NUM_MAILBOXES);
+
+	label = d->map && strcmp(d->map->labels[mailbox], "-") != 0;
+	line = d->map && d->map->lines[mailbox];
+
+	printf("%3d: %0*d  %-*s", mailbox, NUM_DIGITS, instruction,
+		label || line ? 7 : 0, buf);
+
+	if (label)
+		printf("  %s", d->map->labels[mailbox]);
+
+	if (line)
+		printf("  %s:%d", d->map->file, d->map->lines[mailbox]);
+
+	putchar('\n');
+}
+
+/* a mailbox number, or a label if we have a source map */
+static int
+parse_mailbox(const struct debug *d, const char *s)
+{
+	char *end;
+	long n;
+	int i;
+
+	n = strtol(s, &end, 10);
+	if (end != s && '\0' == *end)
+	{
+		if (n >= 0 && n < NUM_MAILBOXES)
+			return (int) n;
+
+		printf("Mailbox %s out of range\n", s);
+		return -1;
+	}
+
+	/* labels name the run of mailboxes after them, so the first one is
+	   where the label itself is */
+	for (i = 0; d->map && i < NUM_MAILBOXES; ++i)
+	{
+		if (strcmp(d->map->labels[i], s) == 0)
+			return i;
+	}
+
+	printf("No such mailbox or label: %s\n", s);
+	return -1;
+}
+
+static int
+parse_count(const char *s, int max)
+{
+	char *end;
+	long n;
+
+	n = strtol(s, &end, 10);
+	if (end == s || *end != '\0' || n < 0 || n > max)
+	{
+		printf("Bad number: %s\n", s);
+		return -1;
+	}
+
+	return (int) n;
+}
+
+static void
+report_stop(const struct debug *d)
+{
+	const struct lmc_predecoded *p = &d->p;
+	const struct lmc_cpu *cpu = &p->lmc->cpu;
+
+	switch (p->stop)
+	{
+	case STOP_BREAK:
+		printf("Breakpoint at ");
+		break;
+
+	case STOP_READ:
+		printf("Watchpoint: mailbox %d read by mailbox %d, value %d\n",
+			p->stop_mailbox, p->stop_pc,
+			p->lmc->mailboxes[p->stop_mailbox]);
+		break;
+
+	case STOP_WRITE:
+		printf("Watchpoint: mailbox %d written by mailbox %d, "
+			"%d -> %d\n", p->stop_mailbox, p->stop_pc,
+			p->stop_value, p->lmc->mailboxes[p->stop_mailbox]);
+		break;
+
+	case STOP_NONE:
+		break;
+	}
+
+	if (cpu->halted)
+		printf(cpu->error ? "Halted on error\n" : "Halted\n");
+	else
+		print_instruction(d, cpu->pc);
+}
+
+/* runs forward for steps instructions, or until a trap or halt if steps is
+   0, keeping the time and taking snapshots as they fall due */
+static void
+forward(struct debug *d, uint64_t steps)
+{
+	struct lmc *lmc = d->p.lmc;
+	uint64_t done = 0;
+
+	for (;;)
+	{
+		uint64_t n = steps ? steps - done : UINT64_MAX;
+
+		if (d->history.snapshots
+			&& history_next(&d->history, d->now) - d->now < n)
+		{
+			n = history_next(&d->history, d->now) - d->now;
+		}
+
+		n = predecode_run(&d->p, n);
+		d->now += n;
+		done += n;
+
+		if (d->history.snapshots)
+			history_take(&d->history, d->now, lmc, &d->log);
+
+		if (d->p.stop != STOP_NONE || lmc->cpu.halted
+			|| (steps && done == steps))
+		{
+			break;
+		}
+	}
+}
+
+static uint64_t
+history_start(const struct debug *d)
+{
+	return d->history.snapshots[0].time;
+}
+
+/* puts the machine back as it was after time instructions: from the
+   nearest snapshot, replaying with the traps taken out */
+static void
+travel(struct debug *d, uint64_t time)
+{
+	uint64_t now;
+
+	now = history_restore(&d->history, history_find(&d->history, time),
+		d->p.lmc, &d->log);
+
+	memcpy(d->saved_traps, d->p.traps, sizeof d->p.traps);
+	memset(d->p.traps, 0, sizeof d->p.traps);
+	predecode_reload(&d->p);
+	d->p.stop = STOP_NONE;
+
+	if (time > now)
+		predecode_run(&d->p, time - now);
+
+	memcpy(d->p.traps, d->saved_traps, sizeof d->p.traps);
+	predecode_reload(&d->p);
+	d->p.stop = STOP_NONE;
+	d->now = time;
+}
+
+static void
+found_stop(struct debug *d, uint64_t now, struct debug_stop *found)
+{
+	const struct lmc_predecoded *p = &d->p;
+
+	found->time = now;
+	found->stop = p->stop;
+	found->pc = p->stop_pc;
+	found->mailbox = p->stop_mailbox;
+	found->value = p->stop_value;
+	found->new_value = p->lmc->mailboxes[p->stop_mailbox];
+}
+
+/* finds the last trap before time, replaying one snapshot interval at a
+   time from the latest; leaves the machine somewhere in the past */
+static bool
+scan(struct debug *d, uint64_t time, struct debug_stop *found)
+{
+	struct lmc_predecoded *p = &d->p;
+	struct lmc *lmc = p->lmc;
+	size_t i = history_find(&d->history, time ? time - 1 : 0);
+
+	for (;;)
+	{
+		uint64_t now, end = time;
+		bool any = false;
+
+		if (i + 1 < d->history.count
+			&& d->history.snapshots[i + 1].time < end)
+		{
+			end = d->history.snapshots[i + 1].time;
+		}
+
+		now = history_restore(&d->history, i, lmc, &d->log);
+		predecode_reload(p);
+		p->stop = STOP_NONE;
+
+		/* a breakpoint right at the snapshot; the run steps over it */
+		if (now < end && (p->traps[lmc->cpu.pc] & TRAP_BREAK))
+		{
+			p->stop = STOP_BREAK;
+			p->stop_pc = lmc->cpu.pc;
+			found_stop(d, now, found);
+			any = true;
+		}
+
+		while (now < end && !lmc->cpu.halted)
+		{
+			now += predecode_run(p, end - now);
+			if (p->stop != STOP_NONE && now < time)
+			{
+				found_stop(d, now, found);
+				any = true;
+			}
+		}
+
+		if (any)
+			return true;
+
+		if (0 == i--)
+			return false;
+	}
+}
+
+static int
+cmd_break(struct debug *d, const struct debug_command *self, char **argv)
+{
+	int mailbox = parse_mailbox(d, argv[0]);
+
+	UNUSED(self);
+
+	if (mailbox < 0)
+		return -1;
+
+	predecode_trap(&d->p, mailbox, TRAP_BREAK, true);
+	printf("Breakpoint at ");
+	print_instruction(d, mailbox);
+	return 0;
+}
+
+static int
+cmd_watch(struct debug *d, const struct debug_command *self, char **argv)
+{
+	int mailbox = parse_mailbox(d, argv[0]);
+
+	if (mailbox < 0)
+		return -1;
+
+	predecode_trap(&d->p, mailbox, self->traps, true);
+	printf("Watching mailbox %d for %s\n", mailbox,
+		TRAP_READ == self->traps ? "reads"
+		: TRAP_WRITE == self->traps ? "writes" : "reads and writes");
+	return 0;
+}
+
+static int
+cmd_delete(struct debug *d, const struct debug_command *self, char **argv)
+{
+	int mailbox = parse_mailbox(d, argv[0]);
+
+	UNUSED(self);
+
+	if (mailbox < 0)
+		return -1;
+
+	predecode_trap(&d->p, mailbox, TRAP_BREAK | TRAP_READ | TRAP_WRITE,
+		false);
+	return 0;
+}
+
+static int
+cmd_info(struct debug *d, const struct debug_command *self, char **argv)
+{
+	int i;
+
+	UNUSED(self);
+	UNUSED(argv);
+
+	for (i = 0; i < NUM_MAILBOXES; ++i)
+	{
+		int traps = d->p.traps[i];
+
+		if (!traps)
+			continue;
+
+		printf("%s%s%s ", traps & TRAP_BREAK ? "break " : "",
+			traps & TRAP_READ ? "read " : "",
+			traps & TRAP_WRITE ? "write " : "");
+		print_instruction(d, i);
+	}
+
+	return 0;
+}
+
+static int
+cmd_step(struct debug *d, const struct debug_command *self, char **argv)
+{
+	int steps = 1;
+
+	UNUSED(self);
+
+	if (argv[0] && (steps = parse_count(argv[0], 1000000000)) < 0)
+		return -1;
+
+	if (d->p.lmc->cpu.halted)
+	{
+		printf("The program has halted\n");
+		return 0;
+	}
+
+	if (steps)
+		forward(d, steps);
+
+	report_stop(d);
+	return 0;
+}
+
+static int
+cmd_continue(struct debug *d, const struct debug_command *self, char **argv)
+{
+	UNUSED(self);
+	UNUSED(argv);
+
+	if (d->p.lmc->cpu.halted)
+	{
+		printf("The program has halted\n");
+		return 0;
+	}
+
+	forward(d, 0);
+	report_stop(d);
+	return 0;
+}
+
+static bool
+can_travel(const struct debug *d)
+{
+	if (!d->history.snapshots)
+	{
+		printf("Time travel is off\n");
+		return false;
+	}
+
+	if (d->now == history_start(d))
+	{
+		printf("At the start of the recorded history\n");
+		return false;
+	}
+
+	return true;
+}
+
+static int
+cmd_reverse_step(struct debug *d, const struct debug_command *self,
+	char **argv)
+{
+	int steps = 1;
+
+	UNUSED(self);
+
+	if (argv[0] && (steps = parse_count(argv[0], 1000000000)) < 0)
+		return -1;
+
+	if (!can_travel(d))
+		return 0;
+
+	if ((uint64_t) steps > d->now - history_start(d))
+		travel(d, history_start(d));
+	else
+		travel(d, d->now - steps);
+
+	report_stop(d);
+	return 0;
+}
+
+static void
+arrive(struct debug *d, const struct debug_stop *found)
+{
+	travel(d, found->time);
+	d->p.stop = found->stop;
+	d->p.stop_pc = found->pc;
+	d->p.stop_mailbox = found->mailbox;
+	d->p.stop_value = found->value;
+}
+
+static int
+cmd_reverse_continue(struct debug *d, const struct debug_command *self,
+	char **argv)
+{
+	struct debug_stop found;
+
+	UNUSED(self);
+	UNUSED(argv);
+
+	if (!can_travel(d))
+		return 0;
+
+	if (scan(d, d->now, &found))
+	{
+		arrive(d, &found);
+	}
+	else
+	{
+		travel(d, history_start(d));
+		printf("No earlier stop; at the start of the recorded "
+			"history\n");
+	}
+
+	report_stop(d);
+	return 0;
+}
+
+static int
+cmd_last_write(struct debug *d, const struct debug_command *self,
+	char **argv)
+{
+	struct debug_stop found;
+	int mailbox = parse_mailbox(d, argv[0]);
+	uint64_t now = d->now;
+	bool written;
+
+	UNUSED(self);
+
+	if (mailbox < 0)
+		return -1;
+
+	if (!d->history.snapshots)
+	{
+		printf("Time travel is off\n");
+		return 0;
+	}
+
+	memcpy(d->saved_traps, d->p.traps, sizeof d->p.traps);
+	memset(d->p.traps, 0, sizeof d->p.traps);
+	d->p.traps[mailbox] = TRAP_WRITE;
+
+	written = scan(d, now, &found);
+
+	memcpy(d->p.traps, d->saved_traps, sizeof d->p.traps);
+	travel(d, now);
+
+	if (written)
+	{
+		printf("Mailbox %d last written by mailbox %d at instruction %"
+			PRIu64 ", %d -> %d\n", mailbox, found.pc,
+			found.time - 1, found.value, found.new_value);
+	}
+	else
+	{
+		printf("Mailbox %d not written since instruction %" PRIu64
+			"\n", mailbox, history_start(d));
+	}
+
+	return 0;
+}
+
+static int
+cmd_regs(struct debug *d, const struct debug_command *self, char **argv)
+{
+	const struct lmc_cpu *cpu = &d->p.lmc->cpu;
+
+	UNUSED(self);
+	UNUSED(argv);
+
+	printf("a = %d  pc = %d  neg = %d  halted = %d  error = %d  "
+		"time = %" PRIu64 "\n", cpu->a, cpu->pc, !!cpu->neg,
+		!!cpu->halted, !!cpu->error, d->now);
+	return 0;
+}
+
+static int
+cmd_print(struct debug *d, const struct debug_command *self, char **argv)
+{
+	int mailbox = parse_mailbox(d, argv[0]), count = 1, i;
+
+	UNUSED(self);
+
+	if (mailbox < 0)
+		return -1;
+
+	if (argv[1] && (count = parse_count(argv[1], NUM_MAILBOXES)) < 0)
+		return -1;
+
+	for (i = mailbox; i < mailbox + count && i < NUM_MAILBOXES; ++i)
+		print_instruction(d, i);
+
+	return 0;
+}
+
+static int
+cmd_set(struct debug *d, const struct debug_command *self, char **argv)
+{
+	int mailbox = parse_mailbox(d, argv[0]), value;
+
+	UNUSED(self);
+
+	if (mailbox < 0 || (value = parse_count(argv[1], MAX_VALUE)) < 0)
+		return -1;
+
+	d->p.lmc->mailboxes[mailbox] = value;
+	predecode_update(&d->p, mailbox);
+
+	/* replay can't reproduce this, so the past and the logged future
+	   are gone */
+	if (d->history.snapshots)
+	{
+		d->log.num_inputs = d->log.input_pos;
+		d->log.outputs = d->log.output_pos;
+		history_rebase(&d->history, d->now, d->p.lmc, &d->log);
+	}
+	print_instruction(d, mailbox);
+	return 0;
+}
+
+static int
+cmd_quit(struct debug *d, const struct debug_command *self, char **argv)
+{
+	UNUSED(d);
+	UNUSED(self);
+	UNUSED(argv);
+	return 1;
+}
+
+static int
+cmd_help(struct debug *d, const struct debug_command *self, char **argv);
+
+static const struct debug_command COMMANDS[] =
+{
+	{ "break", "b", 1, 1, 0, cmd_break,
+		"break <where>       stop before executing a mailbox" },
+	{ "watch", "w", 1, 1, TRAP_WRITE, cmd_watch,
+		"watch <where>       stop after a mailbox is written" },
+	{ "rwatch", NULL, 1, 1, TRAP_READ, cmd_watch,
+		"rwatch <where>      stop after a mailbox is read" },
+	{ "awatch", NULL, 1, 1, TRAP_READ | TRAP_WRITE, cmd_watch,
+		"awatch <where>      stop after a mailbox is read or written" },
+	{ "delete", "d", 1, 1, 0, cmd_delete,
+		"delete <where>      remove breakpoints and watchpoints" },
+	{ "info", "i", 0, 0, 0, cmd_info,
+		"info                list breakpoints and watchpoints" },
+	{ "step", "s", 0, 1, 0, cmd_step,
+		"step [count]        execute one or count instructions" },
+	{ "continue", "c", 0, 0, 0, cmd_continue,
+		"continue            run to the next stop or halt" },
+	{ "reverse-step", "rs", 0, 1, 0, cmd_reverse_step,
+		"reverse-step [n]    go back one or n instructions" },
+	{ "reverse-continue", "rc", 0, 0, 0, cmd_reverse_continue,
+		"reverse-continue    go back to the previous stop" },
+	{ "last-write", "lw", 1, 1, 0, cmd_last_write,
+		"last-write <where>  find the last write to a mailbox" },
+	{ "regs", "r", 0, 0, 0, cmd_regs,
+		"regs                show the CPU registers" },
+	{ "print", "p", 1, 2, 0, cmd_print,
+		"print <where> [n]   show n mailboxes" },
+	{ "set", NULL, 2, 2, 0, cmd_set,
+		"set <where> <value> change a mailbox" },
+	{ "help", "h", 0, 0, 0, cmd_help,
+		"help                show this" },
+	{ "quit", "q", 0, 0, 0, cmd_quit,
+		"quit                stop debugging" },
+	{ NULL, NULL, 0, 0, 0, NULL, NULL }
+};
+
+static int
+cmd_help(struct debug *d, const struct debug_command *self, char **argv)
+{
+	int i;
+
+	UNUSED(d);
+	UNUSED(self);
+	UNUSED(argv);
+
+	for (i = 0; COMMANDS[i].name; ++i)
+		printf("  %s\n", COMMANDS[i].help);
+
+	printf("<where> is a mailbox number, or a label with --source-map\n");
+	return 0;
+}
+
+int
+debug_run(struct lmc *lmc, FILE *commands, bool interactive,
+	const struct lmc_srcmap *map, size_t history_budget)
+{
+	struct debug d;
+	char line[DEBUG_LINE_LEN];
+	int rc = 0;
+
+	memset(&d.log, 0, sizeof d.log);
+	d.history.snapshots = NULL;
+	d.now = 0;
+	d.map = map;
+
+	d.saved_traps = malloc(sizeof d.p.traps);
+	if (!d.saved_traps)
+	{
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+
+	predecode_init(&d.p, lmc);
+	d.p.log = &d.log;
+	predecode_reload(&d.p);
+
+	if (history_budget)
+	{
+		if (history_init(&d.history, history_budget))
+		{
+			free(d.saved_traps);
+			return 1;
+		}
+
+		history_take(&d.history, 0, lmc, &d.log);
+	}
+
+	if (interactive)
+	{
+		printf("Type help for a list of commands\n");
+		print_instruction(&d, lmc->cpu.pc);
+	}
+
+	for (;;)
+	{
+		const struct debug_command *command;
+		char *argv[DEBUG_MAX_ARGS + 1], *name, *arg;
+		int argc = 0;
+
+		if (interactive)
+		{
+			printf("(lmc) ");
+			fflush(stdout);
+		}
+
+		if (!fgets(line, sizeof line, commands))
+			break;
+
+		name = strtok(line, " \t\r\n");
+		if (!name || '#' == name[0])
+			continue;
+
+		for (command = COMMANDS; command->name; ++command)
+		{
+			if (strcmp(name, command->name) == 0 || (command->alias
+				&& strcmp(name, command->alias) == 0))
+			{
+				break;
+			}
+		}
+
+		memset(argv, 0, sizeof argv);
+		while ((arg = strtok(NULL, " \t\r\n")) && argc <= DEBUG_MAX_ARGS)
+			argv[argc++] = arg;
+
+		if (!command->name)
+		{
+			printf("Unknown command %s; try help\n", name);
+			rc = -1;
+		}
+		else if (argc < command->min_args || argc > command->max_args)
+		{
+			printf("Usage: %s\n", command->help);
+			rc = -1;
+		}
+		else
+		{
+			rc = command->run(&d, command, argv);
+		}
+
+		fflush(stdout);
+
+		/* a script that goes wrong shouldn't carry on regardless */
+		if (rc < 0 && !interactive)
+		{
+			rc = 1;
+			break;
+		}
+
+		if (rc > 0)
+		{
+			rc = 0;
+			break;
+		}
+
+		rc = 0;
+	}
+
+	history_free(&d.history);
+	free(d.log.inputs);
+	free(d.saved_traps);
+	return rc;
+}
@@ -0,0 +1,341 @@
+/*
+ * grade.c - checking a run's output as it's printed
+ * Copyright (C) 2020 David McMackins II
+ *
+ * Redistributions, modified or unmodified, in whole or in part, must retain
+ * applicable copyright or other legal privilege notices, these conditions, and
+ * the following license terms and disclaimer.  Subject to these conditions,
+ * the holder(s) of copyright or other legal privileges, author(s) or
+ * assembler(s), and contributors of this work hereby grant to any person who
+ * obtains a copy of this work in any form:
+ *
+ * 1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ * use, and/or otherwise deal in the licensed material without restriction.
+ *
+ * 2. A perpetual, worldwide, non-exclusive, royalty-free, irrevocable patent
+ * license to reproduce, modify, distribute, publish, sell, use, and/or
+ * otherwise deal in the licensed material without restriction, for any and all
+ * patents:
+ *
+ *     a. Held by each such holder of copyright or other legal privilege,
+ *     author or assembler, or contributor, necessarily infringed by the
+ *     contributions alone or by combination with the work, of that privilege
+ *     holder, author or assembler, or contributor.
+ *
+ *     b. Necessarily infringed by the work at the time that holder of
+ *     copyright or other privilege, author or assembler, or contributor made
+ *     any contribution to the work.
+ *
+ * NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ * LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ * A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ * ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ * ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT, TORT,
+ * OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR THE USE
+ * OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "grade.h"
+
+static void
+check_output(struct lmc *lmc, int value)
+{
+	struct grade_check *check = lmc->output_data;
+
+	if (check->out)
+		fprintf(check->out, "%d\n", value);
+
+	if (!check->values)
+		return;
+
+	if (check->pos == check->count)
+		check->extra = true;
+	else if (value != check->values[check->pos])
+		check->wrong = true;
+	else
+	{
+		++check->pos;
+		return;
+	}
+
+	check->got = value;
+	lmc->cpu.halted = true;
+}
+
+void
+grade_start(struct grade_check *check, struct lmc *lmc,
+	const int32_t *values, unsigned long count, FILE *out)
+{
+	memset(check, 0, sizeof *check);
+	check->out = out;
+	check->values = values;
+	check->count = count;
+
+	lmc->output = check_output;
+	lmc->output_data = check;
+}
+
+bool
+grade_verdict(const struct lmc *lmc, const struct grade_check *check,
+	uint64_t max_steps, char why[GRADE_WHY_LEN])
+{
+	int pc = (lmc->cpu.pc + NUM_MAILBOXES - 1) % NUM_MAILBOXES;
+	bool starved = lmc->cpu.error
+		&& 9 * NUM_MAILBOXES + 1 == lmc->cpu.instruction; /* INP */
+
+	if (check->wrong)
+	{
+		sprintf(why, "output %lu is %d, expected %d", check->pos + 1,
+			check->got, (int) check->values[check->pos]);
+	}
+	else if (check->extra)
+	{
+		sprintf(why, "extra output %d after %lu values", check->got,
+			check->count);
+	}
+	else if (!lmc->cpu.halted)
+	{
+		sprintf(why, "still running after %" PRIu64 " instructions",
+			max_steps);
+	}
+	else if (starved && check->values)
+	{
+		sprintf(why, "ran out of input after %lu of %lu outputs",
+			check->pos, check->count);
+	}
+	else if (starved)
+	{
+		strcpy(why, "ran out of input");
+	}
+	else if (lmc->cpu.error)
+	{
+		sprintf(why, "bad instruction %0*d at mailbox %d",
+			NUM_DIGITS, lmc->cpu.instruction, pc);
+	}
+	else if (check->pos < check->count)
+	{
+		sprintf(why, "halted after %lu of %lu outputs", check->pos,
+			check->count);
+	}
+	else if (!check->values)
+	{
+		strcpy(why, "halted");
+		return true;
+	}
+	else
+	{
+		sprintf(why, "%lu outputs", check->pos);
+		return true;
+	}
+
+	return false;
+}
+
+char *
+grade_resolve(const char *manifest, const char *path)
+{
+	const char *slash = strrchr(manifest, '/');
+	size_t dir_len = slash && path[0] != '/' ? slash - manifest + 1 : 0;
+	char *full;
+
+	full = malloc(dir_len + strlen(path) + 1);
+	if (!full)
+		return NULL;
+
+	memcpy(full, manifest, dir_len);
+	strcpy(full + dir_len, path);
+	return full;
+}
+
+int32_t *
+grade_read_numbers(const char *path, bool input, unsigned long *count)
+{
+	FILE *f;
+	int32_t *values = NULL;
+	size_t size = 0;
+	int value, rc;
+
+	*count = 0;
+	f = fopen(path, "r");
+	if (!f)
+	{
+		fprintf(stderr, "Error opening %s: %s\n", path,
+			strerror(errno));
+		return NULL;
+	}
+
+	while ((rc = fscanf(f, "%d", &value)) != EOF)
+	{
+		if (rc != 1 && input)
+		{
+			/* skip whatever isn't a number, as lmc_io does */
+			if (fscanf(f, "%*s") == EOF)
+				break;
+
+			continue;
+		}
+
+		if (rc != 1)
+		{
+			fprintf(stderr, "%s: output %lu is not a number\n", path,
+				*count + 1);
+			goto fail;
+		}
+
+		if (value < 0 || value > MAX_VALUE)
+		{
+			if (input)
+				continue;
+
+			fprintf(stderr, "%s: output %lu is out of range\n",
+				path, *count + 1);
+			goto fail;
+		}
+
+		if (*count == size)
+		{
+			void *temp;
+
+			size = size ? size * 2 : 64;
+			temp = realloc(values, size * sizeof *values);
+			if (!temp)
+			{
+				fprintf(stderr, "Out of memory\n");
+				goto fail;
+			}
+
+			values = temp;
+		}
+
+		values[(*count)++] = value;
+	}
+
+	if (ferror(f))
+	{
+		fprintf(stderr, "Error reading %s: %s\n", path,
+			strerror(errno));
+		goto fail;
+	}
+
+	fclose(f);
+
+	/* an empty file still has numbers, none of them */
+	if (!values)
+		values = malloc(sizeof *values);
+
+	if (!values)
+		fprintf(stderr, "Out of memory\n");
+
+	return values;
+
+fail:
+	fclose(f);
+	free(values);
+	return NULL;
+}
+
+void
+grade_free_tests(struct grade_test *tests, int num_tests)
+{
+	int i;
+
+	for (i = 0; i < num_tests; ++i)
+	{
+		free(tests[i].name);
+		free(tests[i].input_path);
+		free(tests[i].expected_path);
+	}
+
+	free(tests);
+}
+
+int
+grade_load_manifest(const char *path, struct grade_test **tests_out)
+{
+	struct grade_test *tests = NULL;
+	FILE *f;
+	char *line = NULL;
+	size_t line_size = 0;
+	int num_tests = 0, size = 0, line_num = 0;
+
+	f = fopen(path, "r");
+	if (!f)
+	{
+		fprintf(stderr, "Error opening %s: %s\n", path,
+			strerror(errno));
+		return -1;
+	}
+
+	while (getline(&line, &line_size, f) != -1)
+	{
+		struct grade_test *test;
+		char *fields[3], *extra;
+
+		++line_num;
+		fields[0] = strtok(line, " \t\r\n");
+		if (!fields[0] || '#' == fields[0][0])
+			continue;
+
+		fields[1] = strtok(NULL, " \t\r\n");
+		fields[2] = fields[1] ? strtok(NULL, " \t\r\n") : NULL;
+		extra = fields[2] ? strtok(NULL, " \t\r\n") : NULL;
+		if (!fields[2] || extra)
+		{
+			fprintf(stderr, "%s:%d: expected <name> <input> "
+				"<expected output>\n", path, line_num);
+			goto fail;
+		}
+
+		if (num_tests == size)
+		{
+			void *temp;
+
+			size = size ? size * 2 : 16;
+			temp = realloc(tests, size * sizeof *tests);
+			if (!temp)
+			{
+				fprintf(stderr, "Out of memory\n");
+				goto fail;
+			}
+
+			tests = temp;
+		}
+
+		test = &tests[num_tests++];
+		test->name = strdup(fields[0]);
+		test->input_path = grade_resolve(path, fields[1]);
+		test->expected_path = grade_resolve(path, fields[2]);
+		if (!test->name || !test->input_path || !test->expected_path)
+		{
+			fprintf(stderr, "Out of memory\n");
+			goto fail;
+		}
+	}
+
+	if (ferror(f))
+	{
+		fprintf(stderr, "Error reading %s: %s\n", path,
+			strerror(errno));
+		goto fail;
+	}
+
+	free(line);
+	fclose(f);
+	*tests_out = tests;
+	return num_tests;
+
+fail:
+	free(line);
+	fclose(f);
+	grade_free_tests(tests, num_tests);
+	return -1;
+}
@@ -0,0 +1,102 @@
+/*
+ * grade.h - checking a run's output as it's printed
+ * Copyright (C) 2020 David McMackins II
+ *
+ * Redistributions, modified or unmodified, in whole or in part, must retain
+ * applicable copyright or other legal privilege notices, these conditions, and
+ * the following license terms and disclaimer.  Subject to these conditions,
+ * the holder(s) of copyright or other legal privileges, author(s) or
+ * assembler(s), and contributors of this work hereby grant to any person who
+ * obtains a copy of this work in any form:
+ *
+ * 1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ * use, and/or otherwise deal in the licensed material without restriction.
+ *
+ * 2. A perpetual, worldwide, non-exclusive, royalty-free, irrevocable patent
+ * license to reproduce, modify, distribute, publish, sell, use, and/or
+ * otherwise deal in the licensed material without restriction, for any and all
+ * patents:
+ *
+ *     a. Held by each such holder of copyright or other legal privilege,
+ *     author or assembler, or contributor, necessarily infringed by the
+ *     contributions alone or by combination with the work, of that privilege
+ *     holder, author or assembler, or contributor.
+ *
+ *     b. Necessarily infringed by the work at the time that holder of
+ *     copyright or other privilege, author or assembler, or contributor made
+ *     any contribution to the work.
+ *
+ * NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ * LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ * A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ * ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ * ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT, TORT,
+ * OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR THE USE
+ * OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#ifndef LMC_GRADE_H
+#define LMC_GRADE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "lmc.h"
+
+/* a line of an lmgrade manifest, with its paths resolved */
+struct grade_test
+{
+	char *name;
+	char *input_path;
+	char *expected_path;
+};
+
+/* long enough for any verdict */
+#define GRADE_WHY_LEN 128
+
+/* what a run should output, checked as it outputs it */
+struct grade_check
+{
+	FILE *out; /* where outputs are kept, NULL to drop them */
+	const int32_t *values; /* NULL if anything goes */
+	unsigned long count;
+	unsigned long pos;
+	bool wrong; /* stopped at values[pos] */
+	bool extra; /* stopped after all of them */
+	int got;
+};
+
+/* hooks check up to lmc's outputs; the machine is halted at the first
+   wrong or extra one */
+void
+grade_start(struct grade_check *check, struct lmc *lmc,
+	const int32_t *values, unsigned long count, FILE *out);
+
+/* writes why a run that was given max_steps passed or failed; returns
+   true if it passed */
+bool
+grade_verdict(const struct lmc *lmc, const struct grade_check *check,
+	uint64_t max_steps, char why[GRADE_WHY_LEN]);
+
+/* path as seen from the directory of the manifest that names it; NULL if
+   out of memory */
+char *
+grade_resolve(const char *manifest, const char *path);
+
+/* reads a file of numbers into an array to free, which is never NULL on
+   success. Input is read as INP reads it, skipping whatever isn't a
+   number from 0 to MAX_VALUE; in expected output, those are errors. */
+int32_t *
+grade_read_numbers(const char *path, bool input, unsigned long *count);
+
+/* reads the <name> <input> <expected output> lines of a manifest, skipping
+   blank lines and those starting with #; returns how many or -1 on
+   error */
+int
+grade_load_manifest(const char *path, struct grade_test **tests);
+
+void
+grade_free_tests(struct grade_test *tests, int num_tests);
+
+#endif
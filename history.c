@@ -0,0 +1,168 @@
+/*
+ * lmc - Little Man Computer emulator
+ * Copyright (C) 2020 David McMackins II
+ *
+ * Redistributions, modified or unmodified, in whole or in part, must retain
+ * applicable copyright or other legal privilege notices, these conditions, and
+ * the following license terms and disclaimer.  Subject to these conditions,
+ * the holder(s) of copyright or other legal privileges, author(s) or
+ * assembler(s), and contributors of this work hereby grant to any person who
+ * obtains a copy of this work in any form:
+ *
+ * 1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ * use, and/or otherwise deal in the licensed material without restriction.
+ *
+ * 2. A perpetual, worldwide, non-exclusive, royalty-free, irrevocable patent
+ * license to reproduce, modify, distribute, publish, sell, use, and/or
+ * otherwise deal in the licensed material without restriction, for any and all
+ * patents:
+ *
+ *     a. Held by each such holder of copyright or other legal privilege,
+ *     author or assembler, or contributor, necessarily infringed by the
+ *     contributions alone or by combination with the work, of that privilege
+ *     holder, author or assembler, or contributor.
+ *
+ *     b. Necessarily infringed by the work at the time that holder of
+ *     copyright or other privilege, author or assembler, or contributor made
+ *     any contribution to the work.
+ *
+ * NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ * LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ * A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ * ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ * ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT, TORT,
+ * OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR THE USE
+ * OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "history.h"
+#include "lmc.h"
+#include "predecode.h"
+
+#define HISTORY_START_INTERVAL 256
+
+int
+history_init(struct lmc_history *h, size_t budget)
+{
+	h->capacity = budget / sizeof *h->snapshots;
+	if (h->capacity < 2)
+		h->capacity = 2;
+
+	h->snapshots = malloc(h->capacity * sizeof *h->snapshots);
+	if (!h->snapshots)
+	{
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+
+	h->count = 0;
+	h->interval = HISTORY_START_INTERVAL;
+	return 0;
+}
+
+void
+history_free(struct lmc_history *h)
+{
+	free(h->snapshots);
+	h->snapshots = NULL;
+}
+
+uint64_t
+history_next(const struct lmc_history *h, uint64_t now)
+{
+	return (now / h->interval + 1) * h->interval;
+}
+
+static void
+take(struct lmc_history *h, uint64_t now, const struct lmc *lmc,
+	const struct lmc_io_log *log)
+{
+	struct lmc_snapshot *s = &h->snapshots[h->count++];
+
+	s->time = now;
+	memcpy(s->mailboxes, lmc->mailboxes, sizeof s->mailboxes);
+	s->cpu = lmc->cpu;
+	s->input_pos = log->input_pos;
+	s->output_pos = log->output_pos;
+}
+
+/* keeps the first snapshot and those on the doubled interval */
+static void
+thin(struct lmc_history *h)
+{
+	size_t i, kept = 1;
+
+	h->interval *= 2;
+	for (i = 1; i < h->count; ++i)
+	{
+		if (h->snapshots[i].time % h->interval == 0)
+			h->snapshots[kept++] = h->snapshots[i];
+	}
+
+	h->count = kept;
+}
+
+void
+history_take(struct lmc_history *h, uint64_t now, const struct lmc *lmc,
+	const struct lmc_io_log *log)
+{
+	if (now % h->interval != 0)
+		return;
+
+	if (h->count && h->snapshots[h->count - 1].time >= now)
+		return;
+
+	if (h->count == h->capacity)
+	{
+		thin(h);
+		if (now % h->interval != 0)
+			return;
+	}
+
+	take(h, now, lmc, log);
+}
+
+void
+history_rebase(struct lmc_history *h, uint64_t now, const struct lmc *lmc,
+	const struct lmc_io_log *log)
+{
+	h->count = 0;
+	take(h, now, lmc, log);
+}
+
+size_t
+history_find(const struct lmc_history *h, uint64_t time)
+{
+	size_t lo = 0, hi = h->count;
+
+	/* the first snapshot is never after any time we can go back to */
+	while (hi - lo > 1)
+	{
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (h->snapshots[mid].time <= time)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+uint64_t
+history_restore(const struct lmc_history *h, size_t i, struct lmc *lmc,
+	struct lmc_io_log *log)
+{
+	const struct lmc_snapshot *s = &h->snapshots[i];
+
+	memcpy(lmc->mailboxes, s->mailboxes, sizeof lmc->mailboxes);
+	lmc->cpu = s->cpu;
+	log->input_pos = s->input_pos;
+	log->output_pos = s->output_pos;
+	return s->time;
+}
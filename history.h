@@ -0,0 +1,103 @@
+/*
+ * lmc - Little Man Computer emulator
+ * Copyright (C) 2020 David McMackins II
+ *
+ * Redistributions, modified or unmodified, in whole or in part, must retain
+ * applicable copyright or other legal privilege notices, these conditions, and
+ * the following license terms and disclaimer.  Subject to these conditions,
+ * the holder(s) of copyright or other legal privileges, author(s) or
+ * assembler(s), and contributors of this work hereby grant to any person who
+ * obtains a copy of this work in any form:
+ *
+ * 1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ * use, and/or otherwise deal in the licensed material without restriction.
+ *
+ * 2. A perpetual, worldwide, non-exclusive, royalty-free, irrevocable patent
+ * license to reproduce, modify, distribute, publish, sell, use, and/or
+ * otherwise deal in the licensed material without restriction, for any and all
+ * patents:
+ *
+ *     a. Held by each such holder of copyright or other legal privilege,
+ *     author or assembler, or contributor, necessarily infringed by the
+ *     contributions alone or by combination with the work, of that privilege
+ *     holder, author or assembler, or contributor.
+ *
+ *     b. Necessarily infringed by the work at the time that holder of
+ *     copyright or other privilege, author or assembler, or contributor made
+ *     any contribution to the work.
+ *
+ * NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ * LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ * A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ * ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ * ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT, TORT,
+ * OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR THE USE
+ * OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#ifndef LMC_HISTORY_H
+#define LMC_HISTORY_H
+
+#include <stddef.h>
+
+#include "lmc.h"
+#include "predecode.h"
+
+#define HISTORY_DEFAULT_BUDGET (16 * 1024 * 1024)
+
+struct lmc_snapshot
+{
+	uint64_t time; /* instructions executed when it was taken */
+	int mailboxes[NUM_MAILBOXES];
+	struct lmc_cpu cpu;
+	size_t input_pos;
+	uint64_t output_pos;
+};
+
+/*
+ * Snapshots of the machine every interval instructions, oldest first. When
+ * the memory budget is used up, every other snapshot is dropped and the
+ * interval doubles, so any run fits and going back to an arbitrary point
+ * never replays more than interval instructions. Together with the I/O
+ * log, that replay is exact.
+ */
+struct lmc_history
+{
+	struct lmc_snapshot *snapshots;
+	size_t count;
+	size_t capacity;
+	uint64_t interval;
+};
+
+int
+history_init(struct lmc_history *h, size_t budget);
+
+void
+history_free(struct lmc_history *h);
+
+/* the time after now at which the next snapshot is due */
+uint64_t
+history_next(const struct lmc_history *h, uint64_t now);
+
+/* takes a snapshot if one is due at now and it's later than the last */
+void
+history_take(struct lmc_history *h, uint64_t now, const struct lmc *lmc,
+	const struct lmc_io_log *log);
+
+/* forgets everything and starts again from the machine as it is now, for
+   when it was changed in a way that replay can't reproduce */
+void
+history_rebase(struct lmc_history *h, uint64_t now, const struct lmc *lmc,
+	const struct lmc_io_log *log);
+
+/* the index of the latest snapshot taken at or before time */
+size_t
+history_find(const struct lmc_history *h, uint64_t time);
+
+/* puts the machine back as it was at snapshots[i]; returns its time */
+uint64_t
+history_restore(const struct lmc_history *h, size_t i, struct lmc *lmc,
+	struct lmc_io_log *log);
+
+#endif
@@ -0,0 +1,370 @@
+/*
+ * lmc - Little Man Computer
+ * Copyright (C) 2020 David McMackins II
+ *
+ * Redistributions, modified or unmodified, in whole or in part, must retain
+ * applicable copyright or other legal privilege notices, these conditions, and
+ * the following license terms and disclaimer.  Subject to these conditions,
+ * the holder(s) of copyright or other legal privileges, author(s) or
+ * assembler(s), and contributors of this work hereby grant to any person who
+ * obtains a copy of this work in any form:
+ *
+ * 1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ * use, and/or otherwise deal in the licensed material without restriction.
+ *
+ * 2. A perpetual, worldwide, non-exclusive, royalty-free, irrevocable patent
+ * license to reproduce, modify, distribute, publish, sell, use, and/or
+ * otherwise deal in the licensed material without restriction, for any and all
+ * patents:
+ *
+ *     a. Held by each such holder of copyright or other legal privilege,
+ *     author or assembler, or contributor, necessarily infringed by the
+ *     contributions alone or by combination with the work, of that privilege
+ *     holder, author or assembler, or contributor.
+ *
+ *     b. Necessarily infringed by the work at the time that holder of
+ *     copyright or other privilege, author or assembler, or contributor made
+ *     any contribution to the work.
+ *
+ * NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ * LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ * A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ * ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ * ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT, TORT,
+ * OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR THE USE
+ * OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "imgcache.h"
+
+#if IMAGE_CACHE_SUPPORTED
+
+/*
+ * The segment is a header and a fixed table of entries, each a decoded
+ * image and the identity of the file it came from. Everything zero is an
+ * empty cache. Files are matched by identity rather than content, because
+ * hashing the content would mean reading and checking it, which is all
+ * that loading an image costs.
+ *
+ * Readers take no locks. Each entry has a sequence number that is odd
+ * while it's being written; a reader copies the entry out and keeps the
+ * copy only if the number was even and unchanged throughout. Writers
+ * serialize on an fcntl lock on the segment, which the kernel drops if a
+ * writer dies, and an entry a dead writer left odd is simply reused. No
+ * process holds on to an entry after copying it, so a full table evicts
+ * the entry least recently loaded without waiting for anyone.
+ */
+
+#define IMAGE_CACHE_MAGIC UINT64_C(0x4c4d43494d414745) /* LMCIMAGE */
+#define IMAGE_CACHE_VERSION 1
+#define IMAGE_CACHE_SLOTS 64
+
+/* any change to a file changes its times, and replacing it changes its
+   inode */
+struct image_key
+{
+	uint64_t dev;
+	uint64_t ino;
+	uint64_t size;
+	uint64_t mtime_sec;
+	uint64_t mtime_nsec;
+	uint64_t ctime_sec;
+	uint64_t ctime_nsec;
+};
+
+struct image_entry
+{
+	uint32_t seq;
+	uint32_t count; /* mailboxes */
+	struct image_key key;
+	uint64_t last_used;
+	int mailboxes[NUM_MAILBOXES];
+};
+
+struct image_segment
+{
+	uint64_t magic;
+	uint32_t version;
+	uint32_t num_mailboxes; /* builds of other sizes can't share */
+	uint64_t clock; /* ticks once per hit or publish */
+	struct image_entry entries[IMAGE_CACHE_SLOTS];
+};
+
+static int
+get_key(const char *path, struct image_key *key)
+{
+	struct stat st;
+
+	if (stat(path, &st))
+		return 1;
+
+	memset(key, 0, sizeof *key);
+	key->dev = st.st_dev;
+	key->ino = st.st_ino;
+	key->size = st.st_size;
+	key->mtime_sec = st.st_mtim.tv_sec;
+	key->mtime_nsec = st.st_mtim.tv_nsec;
+	key->ctime_sec = st.st_ctim.tv_sec;
+	key->ctime_nsec = st.st_ctim.tv_nsec;
+	return 0;
+}
+
+static int
+lock(int fd, short type)
+{
+	struct flock fl;
+
+	memset(&fl, 0, sizeof fl);
+	fl.l_type = type;
+	fl.l_whence = SEEK_SET;
+
+	while (fcntl(fd, F_SETLKW, &fl) == -1)
+	{
+		if (errno != EINTR)
+			return -1;
+	}
+
+	return 0;
+}
+
+int
+image_cache_open(struct lmc_image_cache *cache, const char *name)
+{
+	struct stat st;
+	void *map;
+
+	cache->name = name;
+	cache->seg = NULL;
+	cache->fd = shm_open(name, O_RDWR | O_CREAT, 0600);
+	if (cache->fd < 0)
+	{
+		fprintf(stderr, "Error opening %s: %s\n", name,
+			strerror(errno));
+		return 1;
+	}
+
+	/* everyone truncates to the same size, so racing to create it is
+	   harmless */
+	if (fstat(cache->fd, &st)
+		|| (st.st_size < (off_t) sizeof *cache->seg
+			&& ftruncate(cache->fd, sizeof *cache->seg)))
+	{
+		fprintf(stderr, "Error sizing %s: %s\n", name,
+			strerror(errno));
+		goto fail;
+	}
+
+	map = mmap(NULL, sizeof *cache->seg, PROT_READ | PROT_WRITE,
+		MAP_SHARED, cache->fd, 0);
+	if (MAP_FAILED == map)
+	{
+		fprintf(stderr, "Error mapping %s: %s\n", name,
+			strerror(errno));
+		goto fail;
+	}
+
+	cache->seg = map;
+	if (lock(cache->fd, F_WRLCK))
+	{
+		fprintf(stderr, "Error locking %s: %s\n", name,
+			strerror(errno));
+		goto fail;
+	}
+
+	if (0 == cache->seg->magic)
+	{
+		cache->seg->version = IMAGE_CACHE_VERSION;
+		cache->seg->num_mailboxes = NUM_MAILBOXES;
+		__atomic_store_n(&cache->seg->magic, IMAGE_CACHE_MAGIC,
+			__ATOMIC_RELEASE);
+	}
+
+	lock(cache->fd, F_UNLCK);
+
+	if (cache->seg->magic != IMAGE_CACHE_MAGIC
+		|| cache->seg->version != IMAGE_CACHE_VERSION
+		|| cache->seg->num_mailboxes != NUM_MAILBOXES)
+	{
+		fprintf(stderr, "%s belongs to a different build of lmc\n",
+			name);
+		goto fail;
+	}
+
+	return 0;
+
+fail:
+	image_cache_close(cache);
+	return 1;
+}
+
+void
+image_cache_close(struct lmc_image_cache *cache)
+{
+	if (cache->seg)
+		munmap(cache->seg, sizeof *cache->seg);
+
+	if (cache->fd >= 0)
+		close(cache->fd);
+
+	cache->seg = NULL;
+	cache->fd = -1;
+}
+
+/* copies a published image into lmc; returns the number of mailboxes or
+   -1 if it isn't there */
+static int
+lookup(struct image_segment *seg, struct lmc *lmc,
+	const struct image_key *key)
+{
+	int i;
+
+	for (i = 0; i < IMAGE_CACHE_SLOTS; ++i)
+	{
+		struct image_entry *e = &seg->entries[i];
+		uint32_t seq, count;
+
+		seq = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE);
+		if (0 == seq || (seq & 1) || e->key.ino != key->ino
+			|| memcmp(&e->key, key, sizeof *key) != 0)
+		{
+			continue;
+		}
+
+		count = e->count;
+		if (count > NUM_MAILBOXES)
+			continue;
+
+		memcpy(lmc->mailboxes, e->mailboxes,
+			count * sizeof *lmc->mailboxes);
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&e->seq, __ATOMIC_RELAXED) != seq)
+		{
+			memset(lmc->mailboxes, 0,
+				count * sizeof *lmc->mailboxes);
+			continue;
+		}
+
+		__atomic_store_n(&e->last_used,
+			__atomic_add_fetch(&seg->clock, 1, __ATOMIC_RELAXED),
+			__ATOMIC_RELAXED);
+		return (int) count;
+	}
+
+	return -1;
+}
+
+static void
+publish(struct lmc_image_cache *cache, const struct lmc *lmc, int count,
+	const struct image_key *key)
+{
+	struct image_segment *seg = cache->seg;
+	struct image_entry *e, *victim = NULL;
+	uint32_t seq;
+	int i;
+
+	if (lock(cache->fd, F_WRLCK))
+		return;
+
+	/* a free entry, then one a dead writer left behind, then the
+	   least recently used; nothing if another process got here first */
+	for (i = 0; i < IMAGE_CACHE_SLOTS; ++i)
+	{
+		e = &seg->entries[i];
+		if (e->seq && !(e->seq & 1)
+			&& memcmp(&e->key, key, sizeof *key) == 0)
+		{
+			goto end;
+		}
+
+		if (victim && (0 == victim->seq || (victim->seq & 1)))
+			continue;
+
+		if (!victim || 0 == e->seq || (e->seq & 1)
+			|| e->last_used < victim->last_used)
+		{
+			victim = e;
+		}
+	}
+
+	e = victim;
+	seq = e->seq | 1;
+	__atomic_store_n(&e->seq, seq, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	e->key = *key;
+	e->count = count;
+	memcpy(e->mailboxes, lmc->mailboxes, count * sizeof *e->mailboxes);
+	e->last_used = __atomic_add_fetch(&seg->clock, 1, __ATOMIC_RELAXED);
+
+	__atomic_store_n(&e->seq, seq + 1, __ATOMIC_RELEASE);
+
+end:
+	lock(cache->fd, F_UNLCK);
+}
+
+int
+image_cache_load(struct lmc_image_cache *cache, struct lmc *lmc,
+	const char *path)
+{
+	struct image_key before, after;
+	int count;
+
+	if (get_key(path, &before))
+		return lmc_load_image(lmc, path);
+
+	count = lookup(cache->seg, lmc, &before);
+	if (count >= 0)
+		return count;
+
+	count = lmc_load_image(lmc, path);
+
+	/* don't publish something that changed while it was loading */
+	if (count >= 0 && !get_key(path, &after)
+		&& memcmp(&before, &after, sizeof before) == 0)
+	{
+		publish(cache, lmc, count, &before);
+	}
+
+	return count;
+}
+
+#else
+
+int
+image_cache_open(struct lmc_image_cache *cache, const char *name)
+{
+	cache->name = name;
+	cache->fd = -1;
+	cache->seg = NULL;
+	fprintf(stderr, "This lmc was built without the image cache\n");
+	return 1;
+}
+
+void
+image_cache_close(struct lmc_image_cache *cache)
+{
+	UNUSED(cache);
+}
+
+int
+image_cache_load(struct lmc_image_cache *cache, struct lmc *lmc,
+	const char *path)
+{
+	UNUSED(cache);
+	return lmc_load_image(lmc, path);
+}
+
+#endif
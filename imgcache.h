@@ -0,0 +1,78 @@
+/*
+ * lmc - Little Man Computer
+ * Copyright (C) 2020 David McMackins II
+ *
+ * Redistributions, modified or unmodified, in whole or in part, must retain
+ * applicable copyright or other legal privilege notices, these conditions, and
+ * the following license terms and disclaimer.  Subject to these conditions,
+ * the holder(s) of copyright or other legal privileges, author(s) or
+ * assembler(s), and contributors of this work hereby grant to any person who
+ * obtains a copy of this work in any form:
+ *
+ * 1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ * use, and/or otherwise deal in the licensed material without restriction.
+ *
+ * 2. A perpetual, worldwide, non-exclusive, royalty-free, irrevocable patent
+ * license to reproduce, modify, distribute, publish, sell, use, and/or
+ * otherwise deal in the licensed material without restriction, for any and all
+ * patents:
+ *
+ *     a. Held by each such holder of copyright or other legal privilege,
+ *     author or assembler, or contributor, necessarily infringed by the
+ *     contributions alone or by combination with the work, of that privilege
+ *     holder, author or assembler, or contributor.
+ *
+ *     b. Necessarily infringed by the work at the time that holder of
+ *     copyright or other privilege, author or assembler, or contributor made
+ *     any contribution to the work.
+ *
+ * NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ * LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ * A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ * ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ * ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT, TORT,
+ * OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR THE USE
+ * OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#ifndef LMC_IMGCACHE_H
+#define LMC_IMGCACHE_H
+
+#include "lmc.h"
+
+/* the lock-free reads use the __atomic builtins of GCC and the compilers
+   that copy them (Clang, ICC); elsewhere the cache isn't built, and
+   image_cache_open() always fails */
+#ifdef __GNUC__
+# define IMAGE_CACHE_SUPPORTED 1
+#else
+# define IMAGE_CACHE_SUPPORTED 0
+#endif
+
+struct image_segment;
+
+/* checked images shared by every lmc process on a host, in a POSIX
+   shared memory segment */
+struct lmc_image_cache
+{
+	const char *name;
+	int fd;
+	struct image_segment *seg;
+};
+
+/* creates the segment if it doesn't exist */
+int
+image_cache_open(struct lmc_image_cache *cache, const char *name);
+
+void
+image_cache_close(struct lmc_image_cache *cache);
+
+/* lmc_load_image through the cache: copies the image from the segment if
+   this file was published unchanged, otherwise loads it and publishes
+   it */
+int
+image_cache_load(struct lmc_image_cache *cache, struct lmc *lmc,
+	const char *path);
+
+#endif
@@ -0,0 +1,920 @@
+/*
+ * jobio.c - background loading and writing of batch job files
+ * Copyright (C) 2020 David McMackins II
+ *
+ * Redistributions, modified or unmodified, in whole or in part, must retain
+ * applicable copyright or other legal privilege notices, these conditions, and
+ * the following license terms and disclaimer.  Subject to these conditions,
+ * the holder(s) of copyright or other legal privileges, author(s) or
+ * assembler(s), and contributors of this work hereby grant to any person who
+ * obtains a copy of this work in any form:
+ *
+ * 1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ * use, and/or otherwise deal in the licensed material without restriction.
+ *
+ * 2. A perpetual, worldwide, non-exclusive, royalty-free, irrevocable patent
+ * license to reproduce, modify, distribute, publish, sell, use, and/or
+ * otherwise deal in the licensed material without restriction, for any and all
+ * patents:
+ *
+ *     a. Held by each such holder of copyright or other legal privilege,
+ *     author or assembler, or contributor, necessarily infringed by the
+ *     contributions alone or by combination with the work, of that privilege
+ *     holder, author or assembler, or contributor.
+ *
+ *     b. Necessarily infringed by the work at the time that holder of
+ *     copyright or other privilege, author or assembler, or contributor made
+ *     any contribution to the work.
+ *
+ * NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ * LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ * A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ * ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ * ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT, TORT,
+ * OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR THE USE
+ * OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#define _DEFAULT_SOURCE /* syscall() */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+# include <linux/io_uring.h>
+# include <sys/eventfd.h>
+# include <sys/mman.h>
+# include <sys/syscall.h>
+#endif
+
+#include "jobio.h"
+#include "lmc.h"
+
+#define JOBIO_THREADS 4
+#define READ_CHUNK 4096
+
+struct uring;
+
+struct lmc_jobio
+{
+	struct lmc_job *jobs;
+	unsigned long count;
+
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	unsigned long next_load; /* next job to start loading */
+	unsigned long next_run; /* next job for jobio_next() */
+	unsigned long in_flight; /* loading, running or being written */
+	struct lmc_job *writes; /* done, waiting to be written */
+	struct lmc_job **writes_end;
+	unsigned long failed;
+	bool closing;
+
+	struct uring *ring; /* NULL if using threads */
+	pthread_t threads[JOBIO_THREADS];
+	int num_threads;
+};
+
+/* called with the lock held once a job's result has been written */
+static void
+retire(struct lmc_jobio *io, struct lmc_job *job)
+{
+	free(job->image.data);
+	free(job->input.data);
+	free(job->result.data);
+	job->image.data = job->input.data = job->result.data = NULL;
+
+	if (job->result.error)
+		++io->failed;
+
+	--io->in_flight;
+	pthread_cond_broadcast(&io->changed);
+}
+
+/* called with the lock held; the job to start loading next, if there's
+   room for it */
+static struct lmc_job *
+take_load(struct lmc_jobio *io)
+{
+	struct lmc_job *job;
+
+	if (io->closing || io->next_load == io->count
+		|| io->in_flight == JOBIO_WINDOW)
+	{
+		return NULL;
+	}
+
+	job = &io->jobs[io->next_load++];
+	job->pending = job->input.path ? 2 : 1;
+	++io->in_flight;
+	return job;
+}
+
+/* called with the lock held */
+static struct lmc_job *
+take_write(struct lmc_jobio *io)
+{
+	struct lmc_job *job = io->writes;
+
+	if (job)
+	{
+		io->writes = job->next;
+		if (!io->writes)
+			io->writes_end = &io->writes;
+	}
+
+	return job;
+}
+
+static void
+read_file(struct lmc_job_file *file)
+{
+	size_t cap = 0;
+	ssize_t n;
+	int fd;
+
+	fd = open(file->path, O_RDONLY);
+	if (fd < 0)
+	{
+		file->error = errno;
+		return;
+	}
+
+	do
+	{
+		if (file->len == cap)
+		{
+			char *data;
+
+			cap = cap ? cap * 2 : READ_CHUNK;
+			data = realloc(file->data, cap);
+			if (!data)
+			{
+				file->error = ENOMEM;
+				break;
+			}
+
+			file->data = data;
+		}
+
+		n = read(fd, file->data + file->len, cap - file->len);
+		if (n > 0)
+			file->len += n;
+		else if (n < 0 && errno != EINTR)
+			file->error = errno;
+	} while (n && !file->error);
+
+	close(fd);
+}
+
+static void
+write_file(struct lmc_job_file *file)
+{
+	size_t done = 0;
+	int fd;
+
+	fd = open(file->path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0)
+	{
+		file->error = errno;
+		return;
+	}
+
+	while (done < file->len)
+	{
+		ssize_t n = write(fd, file->data + done, file->len - done);
+
+		if (n >= 0)
+			done += n;
+		else if (errno != EINTR)
+		{
+			file->error = errno;
+			break;
+		}
+	}
+
+	if (close(fd) && !file->error)
+		file->error = errno;
+}
+
+/* each thread of the pool loads or writes one job at a time, writes
+   first so that finished jobs make room for new ones */
+static void *
+pool_worker(void *arg)
+{
+	struct lmc_jobio *io = arg;
+
+	pthread_mutex_lock(&io->lock);
+	for (;;)
+	{
+		struct lmc_job *job;
+
+		if ((job = take_write(io)))
+		{
+			pthread_mutex_unlock(&io->lock);
+			write_file(&job->result);
+			pthread_mutex_lock(&io->lock);
+			retire(io, job);
+		}
+		else if ((job = take_load(io)))
+		{
+			pthread_mutex_unlock(&io->lock);
+			read_file(&job->image);
+			if (job->input.path)
+				read_file(&job->input);
+
+			pthread_mutex_lock(&io->lock);
+			job->pending = 0;
+			pthread_cond_broadcast(&io->changed);
+		}
+		else if (io->closing)
+		{
+			break;
+		}
+		else
+		{
+			pthread_cond_wait(&io->changed, &io->lock);
+		}
+	}
+
+	pthread_mutex_unlock(&io->lock);
+	return NULL;
+}
+
+#ifdef __linux__
+/* a single thread keeps every file of the window in flight at once,
+   each going through open, read or write, and close on the ring */
+
+enum op_stage
+{
+	OP_OPEN,
+	OP_TRANSFER,
+	OP_CLOSE
+};
+
+struct file_op
+{
+	struct lmc_job *job;
+	struct lmc_job_file *file;
+	bool write;
+	enum op_stage stage;
+	int fd;
+	size_t cap; /* of file->data when reading */
+	size_t done; /* bytes written */
+	struct file_op *next_free;
+};
+
+/* a job has at most two files in flight, each with at most one request
+   on the ring, which has room for those and the wakeup */
+#define RING_OPS (JOBIO_WINDOW * 2)
+#define RING_ENTRIES 256
+
+struct uring
+{
+	int fd;
+	int wake_fd; /* jobio_done() and jobio_close() write here */
+	bool waiting; /* for the ring, with the lock released */
+	uint64_t wake_count;
+
+	void *sq_map, *cq_map;
+	size_t sq_size, cq_size;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+	unsigned sq_entries;
+	unsigned to_submit;
+
+	struct file_op ops[RING_OPS];
+	struct file_op *free_ops;
+	int busy; /* ops in use */
+};
+
+static const unsigned char RING_OPCODES[] =
+{
+	IORING_OP_OPENAT,
+	IORING_OP_READ,
+	IORING_OP_WRITE,
+	IORING_OP_CLOSE
+};
+
+/* kernels from before 5.6 can set up a ring but not open files on it */
+static bool
+ring_supported(int fd)
+{
+	struct io_uring_probe *probe;
+	size_t i, size;
+	bool supported = false;
+
+	size = sizeof *probe + 256 * sizeof (struct io_uring_probe_op);
+	probe = calloc(1, size);
+	if (!probe)
+		return false;
+
+	if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe,
+			256) < 0)
+	{
+		goto end;
+	}
+
+	for (i = 0; i < sizeof RING_OPCODES; ++i)
+	{
+		unsigned op = RING_OPCODES[i];
+
+		if (op > probe->last_op
+			|| !(probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+		{
+			goto end;
+		}
+	}
+
+	supported = true;
+
+end:
+	free(probe);
+	return supported;
+}
+
+static void
+ring_close(struct uring *ring)
+{
+	if (ring->sqes)
+		munmap(ring->sqes, ring->sqes_size);
+
+	if (ring->cq_map && ring->cq_map != ring->sq_map)
+		munmap(ring->cq_map, ring->cq_size);
+
+	if (ring->sq_map)
+		munmap(ring->sq_map, ring->sq_size);
+
+	if (ring->wake_fd >= 0)
+		close(ring->wake_fd);
+
+	if (ring->fd >= 0)
+		close(ring->fd);
+
+	free(ring);
+}
+
+static void *
+ring_mmap(int fd, size_t size, off_t offset)
+{
+	void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+		offset);
+
+	return MAP_FAILED == p ? NULL : p;
+}
+
+/* NULL if the kernel has no usable io_uring */
+static struct uring *
+ring_open(void)
+{
+	struct io_uring_params params;
+	struct uring *ring;
+	char *sq, *cq;
+	int i;
+
+	ring = calloc(1, sizeof *ring);
+	if (!ring)
+		return NULL;
+
+	ring->wake_fd = -1;
+	memset(&params, 0, sizeof params);
+	ring->fd = syscall(__NR_io_uring_setup, RING_ENTRIES, &params);
+	if (ring->fd < 0 || !ring_supported(ring->fd))
+		goto fail;
+
+	ring->wake_fd = eventfd(0, 0);
+	if (ring->wake_fd < 0)
+		goto fail;
+
+	ring->sq_size = params.sq_off.array
+		+ params.sq_entries * sizeof (unsigned);
+	ring->cq_size = params.cq_off.cqes
+		+ params.cq_entries * sizeof (struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if (ring->cq_size > ring->sq_size)
+			ring->sq_size = ring->cq_size;
+
+		ring->cq_size = ring->sq_size;
+	}
+
+	ring->sq_map = ring_mmap(ring->fd, ring->sq_size,
+		__extension__ IORING_OFF_SQ_RING);
+	if (!ring->sq_map)
+		goto fail;
+
+	ring->cq_map = ring->sq_map;
+	if (!(params.features & IORING_FEAT_SINGLE_MMAP))
+	{
+		ring->cq_map = ring_mmap(ring->fd, ring->cq_size,
+			__extension__ IORING_OFF_CQ_RING);
+		if (!ring->cq_map)
+			goto fail;
+	}
+
+	ring->sqes_size = params.sq_entries * sizeof (struct io_uring_sqe);
+	ring->sqes = ring_mmap(ring->fd, ring->sqes_size,
+		__extension__ IORING_OFF_SQES);
+	if (!ring->sqes)
+		goto fail;
+
+	sq = ring->sq_map;
+	ring->sq_head = (unsigned *) (sq + params.sq_off.head);
+	ring->sq_tail = (unsigned *) (sq + params.sq_off.tail);
+	ring->sq_mask = (unsigned *) (sq + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned *) (sq + params.sq_off.array);
+	ring->sq_entries = params.sq_entries;
+
+	cq = ring->cq_map;
+	ring->cq_head = (unsigned *) (cq + params.cq_off.head);
+	ring->cq_tail = (unsigned *) (cq + params.cq_off.tail);
+	ring->cq_mask = (unsigned *) (cq + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+	for (i = 0; i < RING_OPS; ++i)
+	{
+		ring->ops[i].next_free = ring->free_ops;
+		ring->free_ops = &ring->ops[i];
+	}
+
+	return ring;
+
+fail:
+	ring_close(ring);
+	return NULL;
+}
+
+/* starts a request to be filled in and passed to ring_push() */
+static void
+ring_prep(struct io_uring_sqe *sqe, unsigned char opcode, int fd,
+	uint64_t data)
+{
+	memset(sqe, 0, sizeof *sqe);
+	sqe->opcode = opcode;
+	sqe->fd = fd;
+	sqe->user_data = data;
+}
+
+/* copies a filled-in request to the ring and only then moves the tail
+   past it. There's always room: every op and the wakeup have at most one
+   request in flight, and there are fewer of those than entries. */
+static void
+ring_push(struct uring *ring, const struct io_uring_sqe *sqe)
+{
+	unsigned tail = *ring->sq_tail, index = tail & *ring->sq_mask;
+
+	ring->sqes[index] = *sqe;
+	ring->sq_array[index] = index;
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	++ring->to_submit;
+}
+
+static void
+op_transfer(struct uring *ring, struct file_op *op)
+{
+	struct lmc_job_file *file = op->file;
+	struct io_uring_sqe sqe;
+
+	if (op->write)
+	{
+		ring_prep(&sqe, IORING_OP_WRITE, op->fd, (uintptr_t) op);
+		sqe.addr = (uintptr_t) (file->data + op->done);
+		sqe.len = file->len - op->done;
+		sqe.off = op->done;
+	}
+	else
+	{
+		ring_prep(&sqe, IORING_OP_READ, op->fd, (uintptr_t) op);
+		sqe.addr = (uintptr_t) (file->data + file->len);
+		sqe.len = op->cap - file->len;
+		sqe.off = file->len;
+	}
+
+	ring_push(ring, &sqe);
+	op->stage = OP_TRANSFER;
+}
+
+static void
+op_close(struct uring *ring, struct file_op *op)
+{
+	struct io_uring_sqe sqe;
+
+	ring_prep(&sqe, IORING_OP_CLOSE, op->fd, (uintptr_t) op);
+	ring_push(ring, &sqe);
+	op->stage = OP_CLOSE;
+}
+
+static void
+op_start(struct uring *ring, struct lmc_job *job,
+	struct lmc_job_file *file, bool write)
+{
+	struct file_op *op = ring->free_ops;
+	struct io_uring_sqe sqe;
+
+	ring->free_ops = op->next_free;
+	++ring->busy;
+
+	op->job = job;
+	op->file = file;
+	op->write = write;
+	op->stage = OP_OPEN;
+	op->fd = -1;
+	op->cap = 0;
+	op->done = 0;
+
+	ring_prep(&sqe, IORING_OP_OPENAT, AT_FDCWD, (uintptr_t) op);
+	sqe.addr = (uintptr_t) file->path;
+	if (write)
+	{
+		sqe.open_flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+		sqe.len = 0666;
+	}
+	else
+	{
+		sqe.open_flags = O_RDONLY | O_CLOEXEC;
+	}
+
+	ring_push(ring, &sqe);
+}
+
+/* called with the lock held */
+static void
+op_finish(struct lmc_jobio *io, struct uring *ring, struct file_op *op)
+{
+	struct lmc_job *job = op->job;
+
+	op->next_free = ring->free_ops;
+	ring->free_ops = op;
+	--ring->busy;
+
+	if (op->write)
+	{
+		retire(io, job);
+	}
+	else if (!--job->pending)
+	{
+		pthread_cond_broadcast(&io->changed);
+	}
+}
+
+/* moves an op on to its next request given how its last one went */
+static void
+op_complete(struct lmc_jobio *io, struct uring *ring, struct file_op *op,
+	int res)
+{
+	struct lmc_job_file *file = op->file;
+
+	switch (op->stage)
+	{
+	case OP_OPEN:
+		if (res < 0)
+		{
+			file->error = -res;
+			op_finish(io, ring, op);
+			break;
+		}
+
+		op->fd = res;
+		if (op->write && !file->len)
+		{
+			op_close(ring, op);
+			break;
+		}
+
+		if (!op->write)
+		{
+			file->data = malloc(READ_CHUNK);
+			if (!file->data)
+			{
+				file->error = ENOMEM;
+				op_close(ring, op);
+				break;
+			}
+
+			op->cap = READ_CHUNK;
+		}
+
+		op_transfer(ring, op);
+		break;
+
+	case OP_TRANSFER:
+		if (-EINTR == res || -EAGAIN == res)
+		{
+			op_transfer(ring, op);
+			break;
+		}
+
+		if (res < 0)
+		{
+			file->error = -res;
+			op_close(ring, op);
+			break;
+		}
+
+		if (op->write)
+		{
+			op->done += res;
+			if (op->done < file->len)
+				op_transfer(ring, op);
+			else
+				op_close(ring, op);
+
+			break;
+		}
+
+		file->len += res;
+		if (!res)
+		{
+			op_close(ring, op);
+			break;
+		}
+
+		if (file->len == op->cap)
+		{
+			char *data = realloc(file->data, op->cap * 2);
+
+			if (!data)
+			{
+				file->error = ENOMEM;
+				op_close(ring, op);
+				break;
+			}
+
+			file->data = data;
+			op->cap *= 2;
+		}
+
+		op_transfer(ring, op);
+		break;
+
+	case OP_CLOSE:
+		if (res < 0 && op->write && !file->error)
+			file->error = -res;
+
+		op_finish(io, ring, op);
+		break;
+	}
+}
+
+static void *
+ring_worker(void *arg)
+{
+	struct lmc_jobio *io = arg;
+	struct uring *ring = io->ring;
+	bool wake_armed = false;
+
+	pthread_mutex_lock(&io->lock);
+	for (;;)
+	{
+		struct lmc_job *job;
+		unsigned head, tail;
+		long rc;
+
+		while ((job = take_write(io)))
+			op_start(ring, job, &job->result, true);
+
+		while ((job = take_load(io)))
+		{
+			op_start(ring, job, &job->image, false);
+			if (job->input.path)
+				op_start(ring, job, &job->input, false);
+		}
+
+		if (io->closing && !ring->busy)
+		{
+			uint64_t one = 1;
+
+			if (!wake_armed)
+				break;
+
+			/* the ring is closed with nothing in flight, so the
+			   wakeup's read is finished and reaped first */
+			if (write(ring->wake_fd, &one, sizeof one) < 0)
+			{
+				perror("Error waking the io_uring thread");
+				break;
+			}
+		}
+		else if (!wake_armed)
+		{
+			struct io_uring_sqe sqe;
+
+			ring_prep(&sqe, IORING_OP_READ, ring->wake_fd, 0);
+			sqe.addr = (uintptr_t) &ring->wake_count;
+			sqe.len = sizeof ring->wake_count;
+			ring_push(ring, &sqe);
+			wake_armed = true;
+		}
+
+		ring->waiting = true;
+		pthread_mutex_unlock(&io->lock);
+
+		rc = syscall(__NR_io_uring_enter, ring->fd, ring->to_submit, 1,
+			IORING_ENTER_GETEVENTS, NULL, 0);
+		if (rc >= 0)
+		{
+			ring->to_submit -= rc;
+		}
+		else if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+		{
+			fprintf(stderr, "Error waiting for io_uring: %s\n",
+				strerror(errno));
+			abort();
+		}
+
+		pthread_mutex_lock(&io->lock);
+		ring->waiting = false;
+
+		head = *ring->cq_head;
+		tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+		for (; head != tail; ++head)
+		{
+			struct io_uring_cqe *cqe;
+
+			cqe = &ring->cqes[head & *ring->cq_mask];
+			if (cqe->user_data)
+			{
+				op_complete(io, ring,
+					(struct file_op *) (uintptr_t) cqe->user_data,
+					cqe->res);
+			}
+			else
+			{
+				wake_armed = false;
+			}
+		}
+
+		__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+	}
+
+	pthread_mutex_unlock(&io->lock);
+	return NULL;
+}
+
+/* called with the lock held */
+static void
+ring_wake(struct uring *ring)
+{
+	uint64_t one = 1;
+
+	if (!ring->waiting)
+		return;
+
+	ring->waiting = false;
+	if (write(ring->wake_fd, &one, sizeof one) < 0)
+		perror("Error waking the io_uring thread");
+}
+#endif
+
+struct lmc_jobio *
+jobio_open(struct lmc_job *jobs, unsigned long count, bool threads)
+{
+	struct lmc_jobio *io;
+	int i;
+
+	io = calloc(1, sizeof *io);
+	if (!io)
+	{
+		fprintf(stderr, "Out of memory\n");
+		return NULL;
+	}
+
+	io->jobs = jobs;
+	io->count = count;
+	io->writes_end = &io->writes;
+	pthread_mutex_init(&io->lock, NULL);
+	pthread_cond_init(&io->changed, NULL);
+
+#ifdef __linux__
+	if (!threads)
+		io->ring = ring_open();
+
+	if (io->ring)
+	{
+		i = pthread_create(&io->threads[0], NULL, ring_worker, io);
+		if (!i)
+		{
+			io->num_threads = 1;
+			return io;
+		}
+
+		ring_close(io->ring);
+		io->ring = NULL;
+	}
+#else
+	UNUSED(threads);
+#endif
+
+	for (i = 0; i < JOBIO_THREADS; ++i)
+	{
+		if (pthread_create(&io->threads[i], NULL, pool_worker, io))
+			break;
+	}
+
+	io->num_threads = i;
+	if (!i)
+	{
+		fprintf(stderr, "Error starting I/O threads\n");
+		pthread_cond_destroy(&io->changed);
+		pthread_mutex_destroy(&io->lock);
+		free(io);
+		return NULL;
+	}
+
+	return io;
+}
+
+const char *
+jobio_backend(const struct lmc_jobio *io)
+{
+	return io->ring ? "io_uring" : "threads";
+}
+
+struct lmc_job *
+jobio_next(struct lmc_jobio *io)
+{
+	struct lmc_job *job = NULL;
+
+	pthread_mutex_lock(&io->lock);
+	if (io->next_run < io->count)
+	{
+		job = &io->jobs[io->next_run];
+		while (io->next_run >= io->next_load || job->pending)
+			pthread_cond_wait(&io->changed, &io->lock);
+
+		++io->next_run;
+	}
+
+	pthread_mutex_unlock(&io->lock);
+	return job;
+}
+
+void
+jobio_done(struct lmc_jobio *io, struct lmc_job *job)
+{
+	pthread_mutex_lock(&io->lock);
+	job->next = NULL;
+	*io->writes_end = job;
+	io->writes_end = &job->next;
+
+#ifdef __linux__
+	if (io->ring)
+		ring_wake(io->ring);
+#endif
+
+	pthread_cond_broadcast(&io->changed);
+	pthread_mutex_unlock(&io->lock);
+}
+
+unsigned long
+jobio_close(struct lmc_jobio *io)
+{
+	unsigned long i, failed;
+
+	/* stop loading, but write whatever's done */
+	pthread_mutex_lock(&io->lock);
+	io->closing = true;
+
+#ifdef __linux__
+	if (io->ring)
+		ring_wake(io->ring);
+#endif
+
+	pthread_cond_broadcast(&io->changed);
+	pthread_mutex_unlock(&io->lock);
+
+	for (i = 0; i < (unsigned long) io->num_threads; ++i)
+		pthread_join(io->threads[i], NULL);
+
+#ifdef __linux__
+	if (io->ring)
+		ring_close(io->ring);
+#endif
+
+	/* jobs that were loaded but never run */
+	for (i = 0; i < io->count; ++i)
+	{
+		free(io->jobs[i].image.data);
+		free(io->jobs[i].input.data);
+		free(io->jobs[i].result.data);
+		io->jobs[i].image.data = NULL;
+		io->jobs[i].input.data = NULL;
+		io->jobs[i].result.data = NULL;
+	}
+
+	failed = io->failed;
+	pthread_cond_destroy(&io->changed);
+	pthread_mutex_destroy(&io->lock);
+	free(io);
+	return failed;
+}
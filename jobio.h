@@ -0,0 +1,95 @@
+/*
+ * jobio.h - background loading and writing of batch job files
+ * Copyright (C) 2020 David McMackins II
+ *
+ * Redistributions, modified or unmodified, in whole or in part, must retain
+ * applicable copyright or other legal privilege notices, these conditions, and
+ * the following license terms and disclaimer.  Subject to these conditions,
+ * the holder(s) of copyright or other legal privileges, author(s) or
+ * assembler(s), and contributors of this work hereby grant to any person who
+ * obtains a copy of this work in any form:
+ *
+ * 1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ * use, and/or otherwise deal in the licensed material without restriction.
+ *
+ * 2. A perpetual, worldwide, non-exclusive, royalty-free, irrevocable patent
+ * license to reproduce, modify, distribute, publish, sell, use, and/or
+ * otherwise deal in the licensed material without restriction, for any and all
+ * patents:
+ *
+ *     a. Held by each such holder of copyright or other legal privilege,
+ *     author or assembler, or contributor, necessarily infringed by the
+ *     contributions alone or by combination with the work, of that privilege
+ *     holder, author or assembler, or contributor.
+ *
+ *     b. Necessarily infringed by the work at the time that holder of
+ *     copyright or other privilege, author or assembler, or contributor made
+ *     any contribution to the work.
+ *
+ * NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ * LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ * A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ * ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ * ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT, TORT,
+ * OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR THE USE
+ * OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#ifndef LMC_JOBIO_H
+#define LMC_JOBIO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* how many jobs may be between starting to load and having their result
+   written; bounds the memory held for files */
+#define JOBIO_WINDOW 64
+
+struct lmc_job_file
+{
+	const char *path; /* NULL if there's none */
+	char *data;
+	size_t len;
+	int error; /* errno if it couldn't be read or written */
+};
+
+struct lmc_job
+{
+	struct lmc_job_file image;
+	struct lmc_job_file input;
+	struct lmc_job_file result; /* data set by whoever runs the job */
+
+	/* private to jobio */
+	int pending;
+	struct lmc_job *next;
+};
+
+struct lmc_jobio;
+
+/* starts loading the first jobs' files in the background, through
+   io_uring where the kernel has it and a pool of threads otherwise or if
+   threads is set */
+struct lmc_jobio *
+jobio_open(struct lmc_job *jobs, unsigned long count, bool threads);
+
+/* "io_uring" or "threads" */
+const char *
+jobio_backend(const struct lmc_jobio *io);
+
+/* the next job in order, once its image and input are loaded or have
+   failed to; NULL after the last */
+struct lmc_job *
+jobio_next(struct lmc_jobio *io);
+
+/* hands a job's result to be written in the background; its image, input
+   and result are freed once it has been */
+void
+jobio_done(struct lmc_jobio *io, struct lmc_job *job);
+
+/* waits for every result to be written; returns how many couldn't be,
+   leaving their errors in result.error */
+unsigned long
+jobio_close(struct lmc_jobio *io);
+
+#endif
@@ -0,0 +1,307 @@
+/*
+ * lmar - bundles images and their tests into one archive
+ * Copyright (C) 2020 David McMackins II
+ *
+ * Redistributions, modified or unmodified, in whole or in part, must retain
+ * applicable copyright or other legal privilege notices, these conditions, and
+ * the following license terms and disclaimer.  Subject to these conditions,
+ * the holder(s) of copyright or other legal privileges, author(s) or
+ * assembler(s), and contributors of this work hereby grant to any person who
+ * obtains a copy of this work in any form:
+ *
+ * 1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ * use, and/or otherwise deal in the licensed material without restriction.
+ *
+ * 2. A perpetual, worldwide, non-exclusive, royalty-free, irrevocable patent
+ * license to reproduce, modify, distribute, publish, sell, use, and/or
+ * otherwise deal in the licensed material without restriction, for any and all
+ * patents:
+ *
+ *     a. Held by each such holder of copyright or other legal privilege,
+ *     author or assembler, or contributor, necessarily infringed by the
+ *     contributions alone or by combination with the work, of that privilege
+ *     holder, author or assembler, or contributor.
+ *
+ *     b. Necessarily infringed by the work at the time that holder of
+ *     copyright or other privilege, author or assembler, or contributor made
+ *     any contribution to the work.
+ *
+ * NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ * LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ * A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ * ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ * ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT, TORT,
+ * OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR THE USE
+ * OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "archive.h"
+#include "grade.h"
+#include "lmc.h"
+
+/* reads a whole file into a buffer to free */
+static char *
+read_file(const char *path, size_t *len)
+{
+	FILE *f;
+	char *buf = NULL;
+	size_t size = 0;
+
+	f = fopen(path, "rb");
+	if (!f)
+	{
+		fprintf(stderr, "Error opening %s: %s\n", path,
+			strerror(errno));
+		return NULL;
+	}
+
+	*len = 0;
+	do
+	{
+		char *new_buf;
+
+		size = size * 2 + BUFSIZ;
+		new_buf = realloc(buf, size);
+		if (!new_buf)
+		{
+			fprintf(stderr, "Out of memory\n");
+			goto fail;
+		}
+
+		buf = new_buf;
+		*len += fread(buf + *len, 1, size - *len, f);
+	} while (*len == size);
+
+	if (ferror(f))
+	{
+		fprintf(stderr, "Error reading %s: %s\n", path,
+			strerror(errno));
+		goto fail;
+	}
+
+	fclose(f);
+	return buf;
+
+fail:
+	fclose(f);
+	free(buf);
+	return NULL;
+}
+
+/* adds one manifest line's worth; fields[2] and fields[3] may be NULL or
+   "-" for none */
+static int
+add_entry(struct lmc_archive_writer *w, const char *manifest,
+	char *const fields[4])
+{
+	struct lmc_archive_entry entry;
+	struct lmc scratch;
+	char *paths[3] = { NULL, NULL, NULL };
+	unsigned char *image = NULL;
+	char *input = NULL;
+	int32_t *expected = NULL;
+	unsigned long num_expected;
+	int i, rc = 1;
+
+	for (i = 0; i < 3; ++i)
+	{
+		if (!fields[i + 1] || strcmp(fields[i + 1], "-") == 0)
+			continue;
+
+		paths[i] = grade_resolve(manifest, fields[i + 1]);
+		if (!paths[i])
+		{
+			fprintf(stderr, "Out of memory\n");
+			goto end;
+		}
+	}
+
+	memset(&entry, 0, sizeof entry);
+	entry.name = fields[0];
+
+	/* a bad image is caught now rather than in every batch */
+	image = lmc_read_image(paths[0], &entry.image_len);
+	if (!image)
+		goto end;
+
+	memset(&scratch, 0, sizeof scratch);
+	if (lmc_decode_image(&scratch, image, entry.image_len, paths[0]) < 0)
+		goto end;
+
+	entry.image = image;
+	if (paths[1])
+	{
+		input = read_file(paths[1], &entry.input_len);
+		if (!input)
+			goto end;
+
+		entry.input = input;
+	}
+
+	if (paths[2])
+	{
+		expected = grade_read_numbers(paths[2], false, &num_expected);
+		if (!expected)
+			goto end;
+
+		entry.expected = expected;
+		entry.num_expected = num_expected;
+	}
+
+	rc = archive_add(w, &entry);
+
+end:
+	for (i = 0; i < 3; ++i)
+		free(paths[i]);
+
+	free(image);
+	free(input);
+	free(expected);
+	return rc;
+}
+
+static int
+create(const char *path, const char *manifest)
+{
+	struct lmc_archive_writer w;
+	FILE *f;
+	char *line = NULL;
+	size_t line_size = 0;
+	int line_num = 0, rc = 1;
+
+	f = fopen(manifest, "r");
+	if (!f)
+	{
+		fprintf(stderr, "Error opening %s: %s\n", manifest,
+			strerror(errno));
+		return 1;
+	}
+
+	if (archive_create(&w, path))
+	{
+		fclose(f);
+		return 1;
+	}
+
+	while (getline(&line, &line_size, f) != -1)
+	{
+		char *fields[4];
+		int i;
+
+		++line_num;
+		fields[0] = strtok(line, " \t\r\n");
+		if (!fields[0] || '#' == fields[0][0])
+			continue;
+
+		for (i = 1; i < 4; ++i)
+			fields[i] = fields[i - 1] ? strtok(NULL, " \t\r\n")
+				: NULL;
+
+		if (!fields[1] || (fields[3] && strtok(NULL, " \t\r\n")))
+		{
+			fprintf(stderr, "%s:%d: expected <name> <image> "
+				"[<input> [<expected output>]]\n", manifest,
+				line_num);
+			goto fail;
+		}
+
+		if (add_entry(&w, manifest, fields))
+		{
+			fprintf(stderr, "%s:%d: couldn't add %s\n", manifest,
+				line_num, fields[0]);
+			goto fail;
+		}
+	}
+
+	if (ferror(f))
+	{
+		fprintf(stderr, "Error reading %s: %s\n", manifest,
+			strerror(errno));
+		goto fail;
+	}
+
+	rc = archive_finish(&w);
+	goto end;
+
+fail:
+	archive_abandon(&w);
+
+end:
+	free(line);
+	fclose(f);
+	return rc;
+}
+
+static int
+list(const char *path)
+{
+	struct lmc_archive archive;
+	unsigned long i;
+
+	if (archive_open(&archive, path))
+		return 1;
+
+	for (i = 0; i < archive_count(&archive); ++i)
+	{
+		struct lmc_archive_entry entry;
+
+		archive_get(&archive, i, &entry);
+		printf("%-24s %4lu mailboxes", entry.name,
+			(unsigned long) (entry.image_len / NUM_DIGITS));
+
+		if (entry.input)
+			printf(", %lu bytes of input",
+				(unsigned long) entry.input_len);
+
+		if (entry.expected)
+			printf(", %lu outputs",
+				(unsigned long) entry.num_expected);
+
+		putchar('\n');
+	}
+
+	archive_close(&archive);
+	return 0;
+}
+
+static const char *const USAGE[] =
+{
+	"Usage: lmar -c <archive> <manifest>",
+	"       lmar -t <archive>",
+	"  -c  build an archive from a manifest",
+	"  -t  list what's in an archive",
+	"Each manifest line is <name> <image> [<input> [<expected output>]],",
+	"with paths relative to the manifest and - for a missing input;",
+	"lines starting with # are skipped.",
+	NULL
+};
+
+static void
+usage(void)
+{
+	int i;
+
+	for (i = 0; USAGE[i]; ++i)
+		fprintf(stderr, "%s\n", USAGE[i]);
+}
+
+int
+main(int argc, char *argv[])
+{
+	if (4 == argc && strcmp(argv[1], "-c") == 0)
+		return create(argv[2], argv[3]);
+
+	if (3 == argc && strcmp(argv[1], "-t") == 0)
+		return list(argv[2]);
+
+	usage();
+	return 1;
+}
@@ -0,0 +1,624 @@
+/*
+ * lmasmbench - times the assembler on generated sources
+ * Copyright (C) 2020 David McMackins II
+ *
+ * Redistributions, modified or unmodified, in whole or in part, must retain
+ * applicable copyright or other legal privilege notices, these conditions, and
+ * the following license terms and disclaimer.  Subject to these conditions,
+ * the holder(s) of copyright or other legal privileges, author(s) or
+ * assembler(s), and contributors of this work hereby grant to any person who
+ * obtains a copy of this work in any form:
+ *
+ * 1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ * use, and/or otherwise deal in the licensed material without restriction.
+ *
+ * 2. A perpetual, worldwide, non-exclusive, royalty-free, irrevocable patent
+ * license to reproduce, modify, distribute, publish, sell, use, and/or
+ * otherwise deal in the licensed material without restriction, for any and all
+ * patents:
+ *
+ *     a. Held by each such holder of copyright or other legal privilege,
+ *     author or assembler, or contributor, necessarily infringed by the
+ *     contributions alone or by combination with the work, of that privilege
+ *     holder, author or assembler, or contributor.
+ *
+ *     b. Necessarily infringed by the work at the time that holder of
+ *     copyright or other privilege, author or assembler, or contributor made
+ *     any contribution to the work.
+ *
+ * NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ * LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ * A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ * ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ * ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT, TORT,
+ * OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR THE USE
+ * OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "asm.h"
+#include "lmc.h"
+
+#define OP(CODE, ADDR) ((long) (CODE) * NUM_MAILBOXES + (ADDR))
+
+#define MAX_SIZES 16
+#define DEFAULT_SIZES "1000,10000,100000,1000000"
+#define DEFAULT_DIR "bench/out/asm"
+
+struct bench_conf
+{
+	int label_pct; /* lines that define a label */
+	int forward_pct; /* label references to a later line */
+	int comment_pct; /* lines that are only a comment */
+	int reps;
+	double max_slowdown;
+	uint64_t seed;
+	const char *dir;
+};
+
+/* one assembly, as measured by the process that did it */
+struct measurement
+{
+	double seconds;
+	long peak_kib; /* memory the assembler added */
+	int rc;
+};
+
+struct result
+{
+	unsigned long lines;
+	long mailboxes;
+	long labels;
+	struct measurement best;
+	bool correct;
+};
+
+static const char *const ADDR_OPS[] =
+{
+	"ADD", "SUB", "STA", "LDA", "BRA", "BRZ", "BRP"
+};
+
+static const int ADDR_CODES[] = { 1, 2, 3, 5, 6, 7, 8 };
+
+/* splitmix64, as in lmgen */
+static uint64_t
+next_rand(uint64_t *state)
+{
+	uint64_t z;
+
+	*state += UINT64_C(0x9e3779b97f4a7c15);
+	z = *state;
+	z = (z ^ (z >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+	z = (z ^ (z >> 27)) * UINT64_C(0x94d049bb133111eb);
+	return z ^ (z >> 31);
+}
+
+static void
+put_mailbox(unsigned char *image, long addr, long value)
+{
+	int i;
+
+	for (i = NUM_DIGITS - 1; i >= 0; --i)
+	{
+		image[addr * NUM_DIGITS + i] = value % 10;
+		value /= 10;
+	}
+}
+
+/*
+ * Instructions are spread evenly over the lines that aren't comments, up
+ * to the number of mailboxes there are; every other line is a comment, is
+ * blank or defines a label on its own. The layout is drawn from its own generator
+ * so that a first pass can find where every label lands before the second
+ * writes references to them.
+ */
+struct layout
+{
+	uint64_t state;
+	unsigned long lines;
+	long instructions;
+	unsigned long line;
+	long addr; /* of the next instruction */
+	int label_pct;
+};
+
+static void
+layout_start(struct layout *l, const struct bench_conf *conf,
+	unsigned long lines)
+{
+	uint64_t code_lines = (uint64_t) lines * (100 - conf->comment_pct) / 100;
+
+	l->state = conf->seed;
+	l->lines = lines;
+	l->instructions = code_lines < NUM_MAILBOXES ? (long) code_lines
+		: NUM_MAILBOXES;
+	l->line = 0;
+	l->addr = 0;
+	l->label_pct = conf->label_pct;
+}
+
+/* returns whether the next line is an instruction and sets *label if it
+   defines one */
+static bool
+layout_next(struct layout *l, bool *label)
+{
+	uint64_t i = l->line++;
+	bool instruction;
+
+	instruction = (i + 1) * l->instructions / l->lines
+		> i * l->instructions / l->lines;
+
+	/* a label past the last instruction would point past memory */
+	*label = (long) (next_rand(&l->state) % 100) < l->label_pct
+		&& l->addr < l->instructions;
+
+	return instruction;
+}
+
+/* writes a source of the given number of lines and the image it should
+   assemble to; returns nonzero on error */
+static int
+generate(const struct bench_conf *conf, struct result *result,
+	const char *path, unsigned char *expected)
+{
+	struct layout l;
+	FILE *out;
+	long *label_addrs, defined = 0;
+	uint64_t state = conf->seed ^ UINT64_C(0x5eed);
+	unsigned long i;
+	bool label;
+	int rc = 1;
+
+	/* where each label lands */
+	label_addrs = malloc((result->lines + 1) * sizeof *label_addrs);
+	if (!label_addrs)
+	{
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+
+	result->labels = 0;
+	layout_start(&l, conf, result->lines);
+	for (i = 0; i < result->lines; ++i)
+	{
+		bool instruction = layout_next(&l, &label);
+
+		if (label)
+			label_addrs[result->labels++] = l.addr;
+
+		if (instruction)
+			++l.addr;
+	}
+
+	result->mailboxes = l.addr;
+
+	out = fopen(path, "w");
+	if (!out)
+	{
+		fprintf(stderr, "Error opening %s: %s\n", path,
+			strerror(errno));
+		goto end;
+	}
+
+	memset(expected, 0, (size_t) NUM_MAILBOXES * NUM_DIGITS);
+	layout_start(&l, conf, result->lines);
+	for (i = 0; i < result->lines; ++i)
+	{
+		bool instruction = layout_next(&l, &label);
+		uint64_t r = next_rand(&state);
+		long target;
+		int op;
+
+		if (label)
+		{
+			fprintf(out, "L%ld", defined++);
+			if (!instruction)
+				fputc('\n', out);
+		}
+
+		if (!instruction)
+		{
+			if (!label)
+				fputs(r % 4 ? "// nothing but a comment here\n"
+					: "\n", out);
+
+			continue;
+		}
+
+		switch (r % 20)
+		{
+		case 0:
+			target = (long) (r / 20 % (MAX_VALUE + 1));
+			fprintf(out, "\tDAT %ld", target);
+			put_mailbox(expected, l.addr, target);
+			break;
+
+		case 1:
+			fputs("\tINP", out);
+			put_mailbox(expected, l.addr, OP(9, 1));
+			break;
+
+		case 2:
+			fputs("\tOUT", out);
+			put_mailbox(expected, l.addr, OP(9, 2));
+			break;
+
+		case 3:
+			fputs("\tHLT", out);
+			break;
+
+		default:
+			op = (int) (r / 20 % 7);
+			r = next_rand(&state);
+			if (defined < result->labels && ((long) (r % 100)
+					< conf->forward_pct || !defined))
+			{
+				target = defined + (long) (r / 100
+					% (result->labels - defined));
+			}
+			else if (defined)
+			{
+				target = (long) (r / 100 % defined);
+			}
+			else
+			{
+				target = (long) (r / 100 % NUM_MAILBOXES);
+				fprintf(out, "\t%s %ld", ADDR_OPS[op], target);
+				put_mailbox(expected, l.addr,
+					OP(ADDR_CODES[op], target));
+				break;
+			}
+
+			fprintf(out, "\t%s L%ld", ADDR_OPS[op], target);
+			put_mailbox(expected, l.addr,
+				OP(ADDR_CODES[op], label_addrs[target]));
+			break;
+		}
+
+		if ((long) (next_rand(&state) % 100) < conf->comment_pct)
+			fputs("  // and a trailing comment", out);
+
+		fputc('\n', out);
+		++l.addr;
+	}
+
+	if (fclose(out))
+	{
+		fprintf(stderr, "Error writing %s: %s\n", path,
+			strerror(errno));
+		goto end;
+	}
+
+	rc = 0;
+
+end:
+	free(label_addrs);
+	return rc;
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* assembles in a child, so that its peak memory is the assembler's
+   alone */
+static int
+measure(const char *source, const char *image, struct measurement *m)
+{
+	struct rusage before, after;
+	int fds[2], status;
+	pid_t pid;
+	double start;
+
+	if (pipe(fds))
+	{
+		fprintf(stderr, "Error making a pipe: %s\n", strerror(errno));
+		return 1;
+	}
+
+	fflush(stdout);
+	pid = fork();
+	if (pid < 0)
+	{
+		fprintf(stderr, "Error forking: %s\n", strerror(errno));
+		close(fds[0]);
+		close(fds[1]);
+		return 1;
+	}
+
+	if (0 == pid)
+	{
+		struct measurement result;
+
+		close(fds[0]);
+		getrusage(RUSAGE_SELF, &before);
+		start = now();
+		result.rc = lmasm_assemble(source, image, NULL, false);
+		result.seconds = now() - start;
+		getrusage(RUSAGE_SELF, &after);
+		result.peak_kib = after.ru_maxrss - before.ru_maxrss;
+
+		if (write(fds[1], &result, sizeof result) != sizeof result)
+			_exit(1);
+
+		_exit(0);
+	}
+
+	close(fds[1]);
+	status = read(fds[0], m, sizeof *m) != sizeof *m;
+	close(fds[0]);
+
+	if (waitpid(pid, NULL, 0) < 0 || status)
+	{
+		fprintf(stderr, "Assembling %s crashed\n", source);
+		return 1;
+	}
+
+	return 0;
+}
+
+static bool
+check_image(const char *path, const unsigned char *expected, long mailboxes)
+{
+	unsigned char *image;
+	size_t len = (size_t) mailboxes * NUM_DIGITS;
+	FILE *f;
+	bool same;
+
+	image = malloc(len + 1);
+	f = fopen(path, "rb");
+	same = image && f && fread(image, 1, len + 1, f) == len
+		&& memcmp(image, expected, len) == 0;
+
+	if (f)
+		fclose(f);
+
+	free(image);
+	return same;
+}
+
+static int
+bench(const struct bench_conf *conf, struct result *result,
+	unsigned char *expected)
+{
+	char source[4096], image[4096];
+	int i;
+
+	sprintf(source, "%.4000s/asm%lu.lma", conf->dir, result->lines);
+	sprintf(image, "%.4000s/asm%lu.lexe", conf->dir, result->lines);
+
+	if (generate(conf, result, source, expected))
+		return 1;
+
+	for (i = 0; i < conf->reps; ++i)
+	{
+		struct measurement m;
+
+		if (measure(source, image, &m))
+			return 1;
+
+		if (0 == i || m.seconds < result->best.seconds)
+			result->best.seconds = m.seconds;
+
+		if (0 == i || m.peak_kib > result->best.peak_kib)
+			result->best.peak_kib = m.peak_kib;
+
+		result->best.rc = m.rc;
+		if (m.rc)
+			break;
+	}
+
+	result->correct = !result->best.rc
+		&& check_image(image, expected, result->mailboxes);
+
+	return 0;
+}
+
+static int
+parse_sizes(const char *s, unsigned long *sizes)
+{
+	int n = 0;
+
+	while (*s)
+	{
+		char *end;
+
+		if (MAX_SIZES == n)
+			return -1;
+
+		errno = 0;
+		sizes[n] = strtoul(s, &end, 10);
+		if (errno || end == s || !sizes[n] || (*end && *end != ','))
+			return -1;
+
+		++n;
+		s = *end ? end + 1 : end;
+	}
+
+	return n;
+}
+
+static const char *const USAGE[] =
+{
+	"Usage: lmasmbench [options]",
+	"  --lines <n>,...       source sizes to assemble",
+	"                        (default " DEFAULT_SIZES ")",
+	"  --labels <percent>    lines that define a label (default 20)",
+	"  --forward <percent>   references to a later label (default 50)",
+	"  --comments <percent>  comment lines, and instructions with a",
+	"                        trailing comment (default 20)",
+	"  --reps <n>            assemblies per size (default 3)",
+	"  --max-slowdown <x>    fail if any size takes this many times longer",
+	"                        per line than the fastest (default 4)",
+	"  --seed <n>            seed for the sources (default 1)",
+	"  --dir <dir>           where to write them (default " DEFAULT_DIR ")",
+	"  -o <csv>              write the results here (default stdout)",
+	NULL
+};
+
+static void
+usage(void)
+{
+	int i;
+
+	for (i = 0; USAGE[i]; ++i)
+		fprintf(stderr, "%s\n", USAGE[i]);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct bench_conf conf;
+	struct result results[MAX_SIZES];
+	unsigned long sizes[MAX_SIZES];
+	unsigned char *expected;
+	FILE *out = stdout;
+	double fastest = 0;
+	int i, num_sizes, rc = 0;
+
+	conf.label_pct = 20;
+	conf.forward_pct = 50;
+	conf.comment_pct = 20;
+	conf.reps = 3;
+	conf.max_slowdown = 4;
+	conf.seed = 1;
+	conf.dir = DEFAULT_DIR;
+	num_sizes = parse_sizes(DEFAULT_SIZES, sizes);
+
+	for (i = 1; i < argc; ++i)
+	{
+		const char *arg = i + 1 < argc ? argv[i + 1] : NULL;
+		int *pct = NULL;
+
+		if (!arg)
+		{
+			usage();
+			return 1;
+		}
+
+		if (strcmp(argv[i], "--lines") == 0)
+			num_sizes = parse_sizes(arg, sizes);
+		else if (strcmp(argv[i], "--labels") == 0)
+			pct = &conf.label_pct;
+		else if (strcmp(argv[i], "--forward") == 0)
+			pct = &conf.forward_pct;
+		else if (strcmp(argv[i], "--comments") == 0)
+			pct = &conf.comment_pct;
+		else if (strcmp(argv[i], "--reps") == 0)
+			conf.reps = atoi(arg);
+		else if (strcmp(argv[i], "--max-slowdown") == 0)
+			conf.max_slowdown = atof(arg);
+		else if (strcmp(argv[i], "--seed") == 0)
+			conf.seed = strtoul(arg, NULL, 10);
+		else if (strcmp(argv[i], "--dir") == 0)
+			conf.dir = arg;
+		else if (strcmp(argv[i], "-o") == 0)
+		{
+			out = fopen(arg, "w");
+			if (!out)
+			{
+				fprintf(stderr, "Error opening %s: %s\n", arg,
+					strerror(errno));
+				return 1;
+			}
+		}
+		else
+		{
+			usage();
+			return 1;
+		}
+
+		if (pct)
+		{
+			*pct = atoi(arg);
+			if (*pct < 0 || *pct > 100)
+			{
+				usage();
+				return 1;
+			}
+		}
+
+		++i;
+	}
+
+	if (num_sizes <= 0 || conf.reps <= 0 || conf.max_slowdown <= 0)
+	{
+		usage();
+		return 1;
+	}
+
+	expected = malloc((size_t) NUM_MAILBOXES * NUM_DIGITS);
+	if (!expected)
+	{
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+
+	for (i = 0; i < num_sizes; ++i)
+	{
+		double per_line;
+
+		memset(&results[i], 0, sizeof results[i]);
+		results[i].lines = sizes[i];
+		if (bench(&conf, &results[i], expected))
+		{
+			rc = 1;
+			goto end;
+		}
+
+		per_line = results[i].best.seconds / results[i].lines;
+		if (0 == i || per_line < fastest)
+			fastest = per_line;
+	}
+
+	fprintf(out, "digits,lines,mailboxes,labels,seconds,lines_per_second,"
+		"peak_kib,result\n");
+
+	for (i = 0; i < num_sizes; ++i)
+	{
+		const struct result *r = &results[i];
+		const char *verdict = "ok";
+
+		/* a front end that stops being linear shows up as the big
+		   sources falling behind the small ones */
+		if (!r->correct)
+			verdict = "WRONG";
+		else if (r->best.seconds / r->lines > fastest * conf.max_slowdown)
+			verdict = "SLOW";
+
+		if (strcmp(verdict, "ok") != 0)
+			rc = 1;
+
+		fprintf(out, "%d,%lu,%ld,%ld,%.6f,%.0f,%ld,%s\n", NUM_DIGITS,
+			r->lines, r->mailboxes, r->labels, r->best.seconds,
+			r->lines / r->best.seconds, r->best.peak_kib, verdict);
+	}
+
+end:
+	if (out != stdout && fclose(out))
+	{
+		fprintf(stderr, "Error writing CSV: %s\n", strerror(errno));
+		rc = 1;
+	}
+
+	free(expected);
+	return rc;
+}
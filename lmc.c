@@ -36,234 +36,1388 @@
  * OF OR OTHER DEALINGS IN THE WORK.
  */
 
+#define _POSIX_C_SOURCE 200809L /* fmemopen(), open_memstream(), getline() */
+
 #include <errno.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
-#ifndef NUM_MAILBOXES
-# define NUM_MAILBOXES 100
-#endif
-
-#ifndef NUM_DIGITS
-# define NUM_DIGITS 3
-#endif
+#include "archive.h"
+#include "cache.h"
+#include "canon.h"
+#include "debug.h"
+#include "grade.h"
+#include "history.h"
+#include "imgcache.h"
+#include "jobio.h"
+#include "lmc.h"
+#include "predecode.h"
+#include "profile.h"
+#include "sample.h"
+#include "srcmap.h"
+#include "stats.h"
+#include "trace.h"
 
-#ifndef MAX_VALUE
-# define MAX_VALUE 999
-#endif
+struct profile_output
+{
+	const char *option;
+	const char *mode;
+	profile_writer write;
+	const char *path;
+};
 
-struct lmc_cpu
+static struct profile_output PROFILE_OUTPUTS[] =
 {
-	int a;
-	int pc;
-	int instruction;
-	int opcode;
-	int addr;
-	bool neg;
-	bool halted;
-
-	bool error; /* controls program exit code */
+	{ "--profile-json", "w", profile_write_json, NULL },
+	{ "--profile-folded", "w", profile_write_folded, NULL },
+	{ "--profile-pprof", "wb", profile_write_pprof, NULL }
 };
 
-struct lmc
+#define DEFAULT_MAX_STEPS UINT64_C(100000000)
+
+#define NUM_PROFILE_OUTPUTS \
+	((int)(sizeof PROFILE_OUTPUTS / sizeof (struct profile_output)))
+
+static const char *const USAGE[] =
 {
-	int mailboxes[NUM_MAILBOXES];
-	struct lmc_cpu cpu;
+	"Usage: lmc [options] <input>",
+	"  -q, --quiet               no banner or input prompts",
+	"  --engine <name>           execution engine (default loop)",
+	"  --debug                   run under the debugger",
+	"  --debug-script <file>     read debugger commands from a file",
+	"  --debug-history <MiB>     memory for going back in time",
+	"                            (default 16, 0 to turn it off)",
+	"  --cache <file>            reuse results of identical runs; reads",
+	"                            all input before running",
+	"  --image-cache <name>      share loaded images with other lmc",
+	"                            processes through shared memory",
+	"  --batch                   <input> is an archive from lmar; run",
+	"                            and check every entry in it",
+	"  --jobs                    <input> lists \"<image> <input> <output>\"",
+	"                            jobs, - for no input; run each, writing",
+	"                            its output to <output>",
+	"  --job-threads             read and write job files with threads",
+	"                            rather than io_uring",
+	"  --no-dedupe               run every batch entry or job rather than",
+	"                            reusing the result of an equivalent one",
+	"  --max-steps <n>           stop batch entries or jobs after this",
+	"                            many instructions (default 100000000)",
+	"  --fork-server             run once per \"<input> <output>\" line",
+	"                            on stdin, printing each exit status",
+	"  --list-engines            list the available engines",
+	"  --profile                 print a profile report at halt",
+	"  --profile-json <file>     write the profile as JSON",
+	"  --profile-folded <file>   write folded stacks for flamegraphs",
+	"  --profile-pprof <file>    write a pprof profile",
+	"  --source-map <file>       attribute the profile to source lines",
+	"  --trace <file>            record every step to a trace file",
+	"  --trace-compress          gzip the trace (needs WITH_ZLIB)",
+	"  --sample                  sample the running mailbox on a timer",
+	"  --sample-hz <rate>        sampling rate (default 1000)",
+	"  --stats[=hw]              print run statistics at halt; hw adds",
+	"                            host performance counters; works with",
+	"                            --engine",
+	"  --stats-json <file>       write run statistics as JSON",
+	NULL
 };
 
 static void
-bad_instruction(struct lmc *lmc)
+usage(void)
 {
-	struct lmc_cpu *cpu = &lmc->cpu;
-
-	fprintf(stderr, "Bad instruction! (%d)\n", cpu->instruction);
-	fprintf(stderr, "a  = %d\n", cpu->a);
-	fprintf(stderr, "pc = %d\n", cpu->pc);
-	fprintf(stderr, "opcode = %d\n", cpu->opcode);
-	fprintf(stderr, "addr   = %d\n", cpu->addr);
-	fprintf(stderr, "neg    = %d\n", !!cpu->neg);
-	fprintf(stderr, "halt   = %d\n", !!cpu->halted);
-
-	cpu->halted = true;
-	cpu->error = true;
+	int i;
+
+	for (i = 0; USAGE[i]; ++i)
+		fprintf(stderr, "%s\n", USAGE[i]);
 }
 
-typedef void (*lmc_op)(struct lmc *lmc);
+static int
+write_profile(const struct profile_output *output, const struct lmc *lmc,
+	const struct lmc_profile *prof, const struct lmc_srcmap *map)
+{
+	FILE *out;
+	int rc = 0;
 
-static void
-lmc_halt(struct lmc *lmc)
+	out = fopen(output->path, output->mode);
+	if (!out)
+	{
+		fprintf(stderr, "Error opening %s: %s\n", output->path,
+			strerror(errno));
+		return 1;
+	}
+
+	if (output->write(out, lmc, prof, map))
+		rc = 1;
+
+	if (fclose(out) || rc)
+	{
+		fprintf(stderr, "Error writing %s: %s\n", output->path,
+			strerror(errno));
+		rc = 1;
+	}
+
+	return rc;
+}
+
+static int
+write_stats(const char *path, const struct lmc_stats *stats)
 {
-	lmc->cpu.halted = true;
+	FILE *out;
+	int rc;
+
+	out = fopen(path, "w");
+	if (!out)
+	{
+		fprintf(stderr, "Error opening %s: %s\n", path,
+			strerror(errno));
+		return 1;
+	}
+
+	rc = stats_write_json(out, stats);
+	if (fclose(out) || rc)
+	{
+		fprintf(stderr, "Error writing %s: %s\n", path,
+			strerror(errno));
+		return 1;
+	}
+
+	return 0;
 }
 
-static void
-lmc_add(struct lmc *lmc)
+/* reads all of in into a new buffer after prefix bytes left free */
+static char *
+read_all(FILE *in, size_t prefix, size_t *len)
 {
-	lmc->cpu.a += lmc->mailboxes[lmc->cpu.addr];
-	lmc->cpu.neg = lmc->cpu.a > MAX_VALUE;
-	if (lmc->cpu.neg)
-		lmc->cpu.a -= MAX_VALUE + 1;
+	char *buf = NULL;
+	size_t size = prefix;
+
+	*len = prefix;
+	do
+	{
+		char *new_buf;
+
+		size = size * 2 + BUFSIZ;
+		new_buf = realloc(buf, size);
+		if (!new_buf)
+		{
+			fprintf(stderr, "Out of memory\n");
+			free(buf);
+			return NULL;
+		}
+
+		buf = new_buf;
+		*len += fread(buf + *len, 1, size - *len, in);
+	} while (*len == size);
+
+	if (ferror(in))
+	{
+		fprintf(stderr, "Error reading input: %s\n", strerror(errno));
+		free(buf);
+		return NULL;
+	}
+
+	return buf;
+}
+
+/* replays a stored run if there is one; otherwise runs with the output
+   captured and stores it, unless the run failed */
+static int
+run_cached(struct lmc *lmc, const struct lmc_engine *engine, const char *path)
+{
+	struct lmc_cache cache;
+	char *key, *output = NULL;
+	size_t prefix = sizeof lmc->mailboxes + 1, key_len, output_len = 0;
+	FILE *in = NULL, *out = NULL;
+	int rc = 1;
+
+	if (cache_open(&cache, path))
+		return 1;
+
+	/* the run depends only on the image, whether it prompts and its
+	   input */
+	key = read_all(stdin, prefix, &key_len);
+	if (!key)
+		goto end;
+
+	memcpy(key, lmc->mailboxes, sizeof lmc->mailboxes);
+	key[prefix - 1] = lmc->quiet;
+
+	switch (cache_lookup(&cache, key, key_len, stdout))
+	{
+	case 1:
+		rc = 0;
+		goto end;
+
+	case 0:
+		break;
+
+	default:
+		goto end;
+	}
+
+	in = fmemopen(key + prefix, key_len - prefix, "r");
+	out = open_memstream(&output, &output_len);
+	if (!in || !out)
+	{
+		fprintf(stderr, "Error buffering the run: %s\n",
+			strerror(errno));
+		goto end;
+	}
+
+	lmc->in = in;
+	lmc->out = out;
+	engine->run(lmc);
+	lmc->in = stdin;
+	lmc->out = stdout;
+
+	if (fclose(out))
+	{
+		out = NULL;
+		fprintf(stderr, "Error buffering the run: %s\n",
+			strerror(errno));
+		goto end;
+	}
+
+	out = NULL;
+	fwrite(output, 1, output_len, stdout);
+
+	rc = 0;
+	if (!lmc->cpu.error
+		&& cache_store(&cache, key, key_len, output, output_len))
+	{
+		rc = 1;
+	}
+
+end:
+	if (in)
+		fclose(in);
+
+	if (out)
+		fclose(out);
+
+	cache_close(&cache);
+	free(output);
+	free(key);
+	return rc;
 }
 
+/* one run of a fork server: the child starts from the loaded image, or
+   from p when the image was predecoded, and reports through its exit
+   status */
 static void
-lmc_sub(struct lmc *lmc)
+serve_run(struct lmc *lmc, const struct lmc_engine *engine,
+	struct lmc_predecoded *p, const char *input_path,
+	const char *output_path)
 {
-	lmc->cpu.a -= lmc->mailboxes[lmc->cpu.addr];
-	lmc->cpu.neg = lmc->cpu.a < 0;
-	if (lmc->cpu.neg)
-		lmc->cpu.a += MAX_VALUE + 1;
+	FILE *in, *out;
+	int rc;
+
+	in = fopen(input_path, "r");
+	if (!in)
+	{
+		fprintf(stderr, "Error opening %s: %s\n", input_path,
+			strerror(errno));
+		_exit(1);
+	}
+
+	out = fopen(output_path, "w");
+	if (!out)
+	{
+		fprintf(stderr, "Error opening %s: %s\n", output_path,
+			strerror(errno));
+		_exit(1);
+	}
+
+	lmc->in = in;
+	lmc->out = out;
+	if (p)
+		predecode_run(p, 0);
+	else
+		engine->run(lmc);
+
+	rc = lmc->cpu.error;
+	if (fclose(out))
+	{
+		fprintf(stderr, "Error writing %s: %s\n", output_path,
+			strerror(errno));
+		rc = 1;
+	}
+
+	/* not exit(), which would flush or reposition the server's control
+	   stream */
+	_exit(rc);
+}
+
+/* reads "<input> <output>" requests from the control stream and answers
+   each with the exit status of a child forked to run it */
+static int
+fork_server(struct lmc *lmc, const struct lmc_engine *engine)
+{
+	struct lmc_predecoded *p = NULL;
+	char *line = NULL;
+	size_t size = 0;
+	int rc = 1;
+
+	/* nothing a run does can change the decoded image the next run
+	   starts from, since each one gets its own copy */
+	if (engine->run == lmc_run_predecoded)
+	{
+		p = malloc(sizeof *p);
+		if (!p)
+		{
+			fprintf(stderr, "Out of memory\n");
+			return 1;
+		}
+
+		predecode_init(p, lmc);
+	}
+
+	while (getline(&line, &size, stdin) != -1)
+	{
+		char *input_path, *output_path;
+		pid_t pid;
+		int status;
+
+		input_path = strtok(line, " \t\r\n");
+		output_path = strtok(NULL, " \t\r\n");
+		if (!input_path)
+			continue;
+
+		if (!output_path || strtok(NULL, " \t\r\n"))
+		{
+			fprintf(stderr, "Bad request: expected <input> <output>\n");
+			goto end;
+		}
+
+		fflush(stdout);
+		pid = fork();
+		if (pid < 0)
+		{
+			fprintf(stderr, "Error forking: %s\n", strerror(errno));
+			goto end;
+		}
+
+		if (0 == pid)
+			serve_run(lmc, engine, p, input_path, output_path);
+
+		while (waitpid(pid, &status, 0) < 0)
+		{
+			if (errno != EINTR)
+			{
+				fprintf(stderr, "Error waiting for run: %s\n",
+					strerror(errno));
+				goto end;
+			}
+		}
+
+		if (WIFSIGNALED(status))
+			printf("signal %d\n", WTERMSIG(status));
+		else
+			printf("%d\n", WEXITSTATUS(status));
+
+		if (fflush(stdout))
+		{
+			fprintf(stderr, "Error writing reply: %s\n",
+				strerror(errno));
+			goto end;
+		}
+	}
+
+	if (ferror(stdin))
+	{
+		fprintf(stderr, "Error reading requests: %s\n",
+			strerror(errno));
+		goto end;
+	}
+
+	rc = 0;
+
+end:
+	free(line);
+	free(p);
+	return rc;
+}
+
+/* what every entry or job of a batch runs with */
+struct batch
+{
+	const struct lmc_engine *engine;
+	uint64_t max_steps;
+	FILE *no_input;
+	bool dedupe;
+	struct canon_memo memo; /* results by canonical program */
+	unsigned long reused;
+	struct lmc_stats *stats; /* every run counted into, or NULL */
+};
+
+/* how an entry or job went */
+struct batch_result
+{
+	bool passed;
+	char why[GRADE_WHY_LEN]; /* follows the name in its line */
+	char *output; /* if kept; to free */
+	size_t output_len;
+	bool counted; /* ran with the batch's stats, as follows */
+	uint64_t instructions;
+	uint64_t cpu_ns;
+};
+
+static int
+batch_init(struct batch *batch, const struct lmc_engine *engine,
+	uint64_t max_steps, bool dedupe, struct lmc_stats *stats)
+{
+	memset(batch, 0, sizeof *batch);
+	batch->engine = engine;
+	batch->max_steps = max_steps;
+	batch->dedupe = dedupe;
+	batch->stats = stats;
+
+	batch->no_input = fopen("/dev/null", "r");
+	if (!batch->no_input)
+	{
+		fprintf(stderr, "Error opening /dev/null: %s\n",
+			strerror(errno));
+		return -1;
+	}
+
+	if (dedupe && canon_memo_init(&batch->memo))
+	{
+		fprintf(stderr, "Out of memory\n");
+		fclose(batch->no_input);
+		return -1;
+	}
+
+	return 0;
 }
 
 static void
-lmc_store(struct lmc *lmc)
+batch_free(struct batch *batch)
 {
-	lmc->mailboxes[lmc->cpu.addr] = lmc->cpu.a;
+	if (batch->dedupe)
+		canon_memo_free(&batch->memo);
+
+	fclose(batch->no_input);
 }
 
 static void
-lmc_load(struct lmc *lmc)
+batch_report(const char *name, const struct batch_result *result)
 {
-	lmc->cpu.a = lmc->mailboxes[lmc->cpu.addr];
+	printf("%s %s: %s", result->passed ? "ok  " : "FAIL", name,
+		result->why);
+	if (result->counted)
+	{
+		printf(" (%" PRIu64 " instructions, %.2f MIPS)",
+			result->instructions,
+			stats_mips(result->instructions, result->cpu_ns));
+	}
+
+	putchar('\n');
 }
 
+/* a run is decided by its canonical program, its input and what it's
+   checked against */
+static unsigned char *
+entry_key(const struct lmc *lmc, int used,
+	const struct lmc_archive_entry *entry, size_t *len)
+{
+	size_t lens[4];
+	unsigned char *key, *p;
+
+	lens[0] = used;
+	lens[1] = entry->input_len;
+	lens[2] = !!entry->expected;
+	lens[3] = entry->num_expected;
+
+	*len = sizeof lens + lens[0] * sizeof (int) + lens[1]
+		+ lens[3] * sizeof (int32_t);
+	key = malloc(*len);
+	if (!key)
+		return NULL;
+
+	p = key;
+	memcpy(p, lens, sizeof lens);
+	p += sizeof lens;
+	memcpy(p, lmc->mailboxes, lens[0] * sizeof (int));
+	p += lens[0] * sizeof (int);
+
+	if (lens[1])
+		memcpy(p, entry->input, lens[1]);
+
+	p += lens[1];
+	if (lens[3])
+		memcpy(p, entry->expected, lens[3] * sizeof (int32_t));
+
+	return key;
+}
+
+/* stores a result as its passed flag, its why and what it output */
 static void
-lmc_branch(struct lmc *lmc)
+remember_result(struct batch *batch, const unsigned char *key,
+	size_t key_len, const struct batch_result *result)
 {
-	lmc->cpu.pc = lmc->cpu.addr;
+	size_t why_len = strlen(result->why) + 1;
+	unsigned char *value;
+
+	value = malloc(1 + why_len + result->output_len);
+	if (!value)
+		return;
+
+	value[0] = result->passed;
+	memcpy(value + 1, result->why, why_len);
+	if (result->output_len)
+		memcpy(value + 1 + why_len, result->output, result->output_len);
+
+	/* not remembering only costs a run */
+	canon_memo_store(&batch->memo, key, key_len, value,
+		1 + why_len + result->output_len);
+	free(value);
 }
 
 static void
-lmc_branch_zero(struct lmc *lmc)
+reuse_result(struct batch_result *result, const unsigned char *value,
+	size_t len, bool keep_output)
 {
-	if (0 == lmc->cpu.a)
-		lmc->cpu.pc = lmc->cpu.addr;
+	size_t why_len = strlen((const char *) value + 1) + 1;
+
+	result->passed = value[0];
+	memcpy(result->why, value + 1, why_len);
+	if (!keep_output)
+		return;
+
+	result->output_len = len - 1 - why_len;
+	result->output = malloc(result->output_len + 1);
+	if (!result->output)
+	{
+		result->passed = false;
+		result->output_len = 0;
+		strcpy(result->why, "can't keep output: Out of memory");
+		return;
+	}
+
+	memcpy(result->output, value + 1 + why_len, result->output_len);
 }
 
+/* runs one entry with its input read straight from memory, keeping its
+   outputs if asked to; an entry whose canonical program has already run
+   with the same input and expected output gets that run's result */
 static void
-lmc_branch_positive(struct lmc *lmc)
+run_entry(struct batch *batch, const struct lmc_archive_entry *entry,
+	bool keep_output, struct batch_result *result)
+{
+	struct grade_check check;
+	struct lmc lmc;
+	unsigned char *key = NULL;
+	size_t key_len = 0;
+	FILE *out = NULL;
+
+	memset(result, 0, sizeof *result);
+
+	memset(&lmc, 0, sizeof lmc);
+	lmc.quiet = true;
+	lmc.out = stdout;
+
+	if (lmc_decode_image(&lmc, entry->image, entry->image_len,
+			entry->name) < 0)
+	{
+		strcpy(result->why, "bad image");
+		return;
+	}
+
+	if (batch->dedupe)
+	{
+		const void *value;
+		size_t value_len;
+
+		key = entry_key(&lmc, canon_image(&lmc), entry, &key_len);
+		value = key ? canon_memo_find(&batch->memo, key, key_len,
+			&value_len) : NULL;
+		if (value)
+		{
+			reuse_result(result, value, value_len, keep_output);
+			++batch->reused;
+			goto end;
+		}
+	}
+
+	if (keep_output)
+	{
+		out = open_memstream(&result->output, &result->output_len);
+		if (!out)
+		{
+			sprintf(result->why, "can't keep output: %.64s",
+				strerror(errno));
+			goto end;
+		}
+	}
+
+	grade_start(&check, &lmc, entry->expected, entry->num_expected, out);
+
+	/* fmemopen() needn't take an empty buffer */
+	lmc.in = batch->no_input;
+	if (entry->input_len)
+	{
+		lmc.in = fmemopen((void *) entry->input, entry->input_len,
+			"r");
+		if (!lmc.in)
+		{
+			sprintf(result->why, "can't read input: %.64s",
+				strerror(errno));
+			goto end;
+		}
+	}
+	else
+	{
+		rewind(batch->no_input);
+	}
+
+	if (batch->stats)
+	{
+		result->instructions = batch->stats->instructions;
+		result->cpu_ns = batch->stats->cpu_ns;
+		lmc_run_engine_counted(&lmc, batch->engine, batch->max_steps,
+			batch->stats);
+		result->instructions = batch->stats->instructions
+			- result->instructions;
+		result->cpu_ns = batch->stats->cpu_ns - result->cpu_ns;
+		result->counted = true;
+	}
+	else
+	{
+		batch->engine->run_for(&lmc, batch->max_steps);
+	}
+
+	result->passed = grade_verdict(&lmc, &check, batch->max_steps,
+		result->why);
+
+	if (lmc.in != batch->no_input)
+		fclose(lmc.in);
+
+	/* closing it is what leaves the output in result */
+	if (out && fclose(out))
+	{
+		out = NULL;
+		sprintf(result->why, "can't keep output: %.64s", strerror(errno));
+		result->passed = false;
+		goto end;
+	}
+
+	out = NULL;
+
+	if (key)
+		remember_result(batch, key, key_len, result);
+
+end:
+	if (out)
+		fclose(out);
+
+	free(key);
+}
+
+/* the machine's own complaints would only repeat what a batch reports;
+   returns the descriptor to give back to restore_stderr() */
+static int
+silence_stderr(FILE *null)
 {
-	if (!lmc->cpu.neg)
-		lmc->cpu.pc = lmc->cpu.addr;
+	int saved;
+
+	fflush(stderr);
+	saved = dup(STDERR_FILENO);
+	if (saved >= 0)
+		dup2(fileno(null), STDERR_FILENO);
+
+	return saved;
 }
 
 static void
-lmc_io(struct lmc *lmc)
+restore_stderr(int saved)
 {
-	int rc;
+	if (saved < 0)
+		return;
 
-	switch (lmc->cpu.addr)
+	fflush(stderr);
+	dup2(saved, STDERR_FILENO);
+	close(saved);
+}
+
+/* runs every entry of an archive, checking each against its expected
+   output if it has one, or only that it halts cleanly if not */
+static int
+run_batch(const char *path, const struct lmc_engine *engine,
+	uint64_t max_steps, bool dedupe, struct lmc_stats *stats)
+{
+	struct lmc_archive archive;
+	struct batch batch;
+	unsigned long i, count, passed = 0;
+	int saved_stderr;
+
+	if (archive_open(&archive, path))
+		return 1;
+
+	if (batch_init(&batch, engine, max_steps, dedupe, stats))
 	{
-	case 1:
-		rc = 0;
-		while (rc != 1 || lmc->cpu.a < 0 || lmc->cpu.a > MAX_VALUE)
+		archive_close(&archive);
+		return 1;
+	}
+
+	saved_stderr = silence_stderr(batch.no_input);
+	count = archive_count(&archive);
+	for (i = 0; i < count; ++i)
+	{
+		struct lmc_archive_entry entry;
+		struct batch_result result;
+
+		archive_get(&archive, i, &entry);
+		run_entry(&batch, &entry, false, &result);
+		batch_report(entry.name, &result);
+		if (result.passed)
+			++passed;
+	}
+
+	restore_stderr(saved_stderr);
+
+	if (batch.reused)
+		printf("%lu runs reused for equivalent entries\n", batch.reused);
+
+	printf("%lu of %lu entries passed\n", passed, count);
+
+	batch_free(&batch);
+	archive_close(&archive);
+	return passed != count;
+}
+
+/* reads a job list; the jobs' paths point into lines, one per job */
+static struct lmc_job *
+read_jobs(const char *path, char ***lines, unsigned long *count)
+{
+	FILE *f;
+	struct lmc_job *jobs = NULL;
+	char *line = NULL;
+	size_t line_size = 0;
+	unsigned long cap = 0, line_num = 0;
+	bool ok = false;
+
+	*lines = NULL;
+	*count = 0;
+
+	f = fopen(path, "r");
+	if (!f)
+	{
+		fprintf(stderr, "Error opening %s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+
+	while (getline(&line, &line_size, f) != -1)
+	{
+		struct lmc_job *job;
+		char *image, *input, *output;
+
+		++line_num;
+		image = strtok(line, " \t\r\n");
+		if (!image || '#' == image[0])
+			continue;
+
+		input = strtok(NULL, " \t\r\n");
+		output = input ? strtok(NULL, " \t\r\n") : NULL;
+		if (!output || strtok(NULL, " \t\r\n"))
 		{
-			printf("Input number (0-%d): ", MAX_VALUE);
-			rc = scanf("%d", &lmc->cpu.a);
+			fprintf(stderr, "%s:%lu: expected <image> <input> "
+				"<output>\n", path, line_num);
+			goto end;
 		}
-		break;
 
-	case 2:
-		printf("%d\n", lmc->cpu.a);
-		break;
+		if (*count == cap)
+		{
+			struct lmc_job *new_jobs;
+			char **new_lines;
 
-	default:
-		bad_instruction(lmc);
-		break;
+			cap = cap ? cap * 2 : 64;
+			new_jobs = realloc(jobs, cap * sizeof *jobs);
+			if (new_jobs)
+				jobs = new_jobs;
+
+			new_lines = realloc(*lines, cap * sizeof **lines);
+			if (new_lines)
+				*lines = new_lines;
+
+			if (!new_jobs || !new_lines)
+			{
+				fprintf(stderr, "Out of memory\n");
+				goto end;
+			}
+		}
+
+		job = &jobs[*count];
+		memset(job, 0, sizeof *job);
+		job->image.path = image;
+		job->input.path = strcmp(input, "-") ? input : NULL;
+		job->result.path = output;
+
+		/* the job keeps this line */
+		(*lines)[(*count)++] = line;
+		line = NULL;
+		line_size = 0;
+	}
+
+	if (ferror(f))
+	{
+		fprintf(stderr, "Error reading %s: %s\n", path, strerror(errno));
+		goto end;
 	}
+
+	ok = true;
+
+end:
+	free(line);
+	fclose(f);
+
+	if (!ok)
+	{
+		while (*count)
+			free((*lines)[--*count]);
+
+		free(*lines);
+		free(jobs);
+		*lines = NULL;
+		return NULL;
+	}
+
+	/* an empty list still has jobs, none of them */
+	if (!jobs)
+		jobs = malloc(sizeof *jobs);
+
+	if (!jobs)
+		fprintf(stderr, "Out of memory\n");
+
+	return jobs;
 }
 
-const lmc_op OPS[] =
+/* runs a job with whatever jobio loaded for it, leaving its output for
+   jobio to write */
+static bool
+run_job(struct batch *batch, struct lmc_job *job)
 {
-	lmc_halt,
-	lmc_add,
-	lmc_sub,
-	lmc_store,
-	NULL, /* no 4xx instruction in ISA */
-	lmc_load,
-	lmc_branch,
-	lmc_branch_zero,
-	lmc_branch_positive,
-	lmc_io
-};
+	struct lmc_archive_entry entry;
+	struct batch_result result;
+	const char *name = job->image.path;
+
+	if (job->image.error)
+	{
+		printf("FAIL %s: can't read image: %s\n", name,
+			strerror(job->image.error));
+		return false;
+	}
+
+	if (job->input.error)
+	{
+		printf("FAIL %s: can't read %s: %s\n", name, job->input.path,
+			strerror(job->input.error));
+		return false;
+	}
+
+	memset(&entry, 0, sizeof entry);
+	entry.name = name;
+	entry.image = (const unsigned char *) job->image.data;
+	entry.image_len = job->image.len;
+	entry.input = job->input.data;
+	entry.input_len = job->input.len;
+
+	run_entry(batch, &entry, true, &result);
+	job->result.data = result.output;
+	job->result.len = result.output_len;
+
+	batch_report(name, &result);
+	return result.passed;
+}
+
+/* runs every job of a list in order while the files of the jobs after it
+   are read and the outputs of the ones before it are written */
+static int
+run_jobs(const char *path, const struct lmc_engine *engine,
+	uint64_t max_steps, bool dedupe, bool threads, struct lmc_stats *stats)
+{
+	struct lmc_jobio *io;
+	struct lmc_job *jobs, *job;
+	struct batch batch;
+	char **lines;
+	unsigned long i, count, passed = 0, failed = 1;
+	int saved_stderr;
+
+	jobs = read_jobs(path, &lines, &count);
+	if (!jobs)
+		return 1;
+
+	if (batch_init(&batch, engine, max_steps, dedupe, stats))
+		goto end;
+
+	io = jobio_open(jobs, count, threads);
+	if (!io)
+	{
+		batch_free(&batch);
+		goto end;
+	}
+
+	saved_stderr = silence_stderr(batch.no_input);
+	while ((job = jobio_next(io)))
+	{
+		if (run_job(&batch, job))
+			++passed;
+
+		jobio_done(io, job);
+	}
+
+	failed = jobio_close(io);
+	restore_stderr(saved_stderr);
+
+	for (i = 0; i < count; ++i)
+	{
+		if (jobs[i].result.error)
+		{
+			fprintf(stderr, "Error writing %s: %s\n",
+				jobs[i].result.path, strerror(jobs[i].result.error));
+		}
+	}
+
+	if (batch.reused)
+		printf("%lu runs reused for equivalent jobs\n", batch.reused);
+
+	printf("%lu of %lu jobs passed\n", passed, count);
+	batch_free(&batch);
+
+end:
+	for (i = 0; i < count; ++i)
+		free(lines[i]);
+
+	free(lines);
+	free(jobs);
+	return passed != count || failed;
+}
 
 int
 main(int argc, char *argv[])
 {
 	struct lmc lmc;
-	FILE *input_file;
-	int c, i;
+	struct lmc_profile *prof = NULL;
+	struct lmc_srcmap *map = NULL;
+	struct lmc_trace *trace = NULL;
+	struct lmc_stats stats;
+	FILE *script = NULL;
+	const struct lmc_engine *engine = NULL;
+	const char *input_path = NULL, *map_path = NULL, *trace_path = NULL;
+	const char *stats_path = NULL, *script_path = NULL, *cache_path = NULL;
+	const char *image_cache_name = NULL;
+	bool debug = false, profile = false, profile_outputs = false, compress = false;
+	bool print_stats = false, hw_stats = false, quiet = false;
+	bool serve = false, batch = false, jobs = false, job_threads = false;
+	bool dedupe = true, chose_engine;
+	uint64_t max_steps = 0; /* not given */
+	int i, j, rc = 1, sample_hz = 0;
+	long history_mib = HISTORY_DEFAULT_BUDGET >> 20;
 
-	if (argc != 2)
+	for (i = 1; i < argc; ++i)
 	{
-		fprintf(stderr, "Usage: lmc <input>\n");
+		const char *opt = argv[i], *arg = i + 1 < argc ? argv[i + 1] : NULL;
+
+		for (j = 0; j < NUM_PROFILE_OUTPUTS; ++j)
+		{
+			if (strcmp(opt, PROFILE_OUTPUTS[j].option) == 0)
+				break;
+		}
+
+		if (j < NUM_PROFILE_OUTPUTS && arg)
+		{
+			PROFILE_OUTPUTS[j].path = argv[++i];
+			profile_outputs = true;
+		}
+		else if (strcmp(opt, "--source-map") == 0 && arg)
+		{
+			map_path = argv[++i];
+		}
+		else if (strcmp(opt, "--trace") == 0 && arg)
+		{
+			trace_path = argv[++i];
+		}
+		else if (strcmp(opt, "--stats-json") == 0 && arg)
+		{
+			stats_path = argv[++i];
+		}
+		else if (strcmp(opt, "--cache") == 0 && arg)
+		{
+			cache_path = argv[++i];
+		}
+		else if (strcmp(opt, "--image-cache") == 0 && arg)
+		{
+#if !IMAGE_CACHE_SUPPORTED
+			fprintf(stderr, "--image-cache needs a compiler with "
+				"GCC's __atomic builtins\n");
+			return 1;
+#endif
+			image_cache_name = argv[++i];
+		}
+		else if (strcmp(opt, "--engine") == 0 && arg)
+		{
+			engine = lmc_find_engine(argv[++i]);
+			if (!engine)
+			{
+				fprintf(stderr, "No such engine: %s\n", argv[i]);
+				return 1;
+			}
+		}
+		else if (strcmp(opt, "--debug-script") == 0 && arg)
+		{
+			script_path = argv[++i];
+			debug = true;
+		}
+		else if (strcmp(opt, "--debug-history") == 0 && arg)
+		{
+			char *end;
+
+			history_mib = strtol(argv[++i], &end, 10);
+			if (end == argv[i] || *end != '\0' || history_mib < 0
+				|| history_mib > 65536)
+			{
+				usage();
+				return 1;
+			}
+
+			debug = true;
+		}
+		else if (strcmp(opt, "--debug") == 0)
+		{
+			debug = true;
+		}
+		else if (strcmp(opt, "--batch") == 0)
+		{
+			batch = true;
+		}
+		else if (strcmp(opt, "--jobs") == 0)
+		{
+			jobs = true;
+		}
+		else if (strcmp(opt, "--job-threads") == 0)
+		{
+			job_threads = true;
+		}
+		else if (strcmp(opt, "--no-dedupe") == 0)
+		{
+			dedupe = false;
+		}
+		else if (strcmp(opt, "--max-steps") == 0 && arg)
+		{
+			char *end;
+
+			errno = 0;
+			max_steps = strtoul(argv[++i], &end, 10);
+			if (errno || end == argv[i] || *end != '\0' || !max_steps)
+			{
+				usage();
+				return 1;
+			}
+		}
+		else if (strcmp(opt, "--fork-server") == 0)
+		{
+			serve = true;
+		}
+		else if (strcmp(opt, "--list-engines") == 0)
+		{
+			for (j = 0; ENGINES[j].name; ++j)
+				printf("%s\n", ENGINES[j].name);
+
+			return 0;
+		}
+		else if (strcmp(opt, "-q") == 0 || strcmp(opt, "--quiet") == 0)
+		{
+			quiet = true;
+		}
+		else if (strcmp(opt, "--sample-hz") == 0 && arg)
+		{
+			sample_hz = atoi(argv[++i]);
+			if (sample_hz <= 0)
+			{
+				usage();
+				return 1;
+			}
+		}
+		else if (strcmp(opt, "--sample") == 0)
+		{
+			if (!sample_hz)
+				sample_hz = SAMPLE_DEFAULT_HZ;
+		}
+		else if (strcmp(opt, "--profile") == 0)
+		{
+			profile = true;
+		}
+		else if (strcmp(opt, "--trace-compress") == 0)
+		{
+			compress = true;
+		}
+		else if (strcmp(opt, "--stats") == 0)
+		{
+			print_stats = true;
+		}
+		else if (strcmp(opt, "--stats=hw") == 0)
+		{
+			print_stats = true;
+			hw_stats = true;
+		}
+		else if ('-' == opt[0] || input_path)
+		{
+			usage();
+			return 1;
+		}
+		else
+		{
+			input_path = opt;
+		}
+	}
+
+	if (!input_path)
+	{
+		usage();
 		return 1;
 	}
 
-	memset(&lmc, 0, sizeof lmc);
+	/* each of these runs on its own engine, but stats can be kept around
+	   any of the engines */
+	if (!!trace_path + (profile || profile_outputs) + !!sample_hz
+		+ (print_stats || stats_path || engine) + debug > 1)
+	{
+		fprintf(stderr, "Only one of --engine, --debug, tracing, "
+			"profiling and sampling may be used; stats can only "
+			"be kept with --engine\n");
+		return 1;
+	}
 
-	input_file = fopen(argv[1], "rb");
-	if (!input_file)
+	/* a replayed run has nothing to observe */
+	if (cache_path && (debug || trace_path || profile || profile_outputs
+			|| print_stats || stats_path || sample_hz))
 	{
-		fprintf(stderr, "Error opening %s: %s\n", argv[1],
-			strerror(errno));
+		fprintf(stderr, "--cache can only be used with --engine\n");
 		return 1;
 	}
 
-	i = 0;
-	while ((c = fgetc(input_file)) != EOF)
+	/* nor are the runs of a fork server, which only report how they
+	   ended */
+	if (serve && (cache_path || debug || trace_path || profile
+			|| profile_outputs || print_stats || stats_path || sample_hz))
 	{
-		int *mailbox;
+		fprintf(stderr, "--fork-server can only be used with --engine\n");
+		return 1;
+	}
 
-		if (c > 9) /* not a digit */
+	/* and a batch reports how each of its entries did */
+	if (batch && (serve || image_cache_name || cache_path || debug
+			|| trace_path || profile || profile_outputs || sample_hz))
+	{
+		fprintf(stderr, "--batch can only be used with --engine\n");
+		return 1;
+	}
+
+	/* as does a job list */
+	if (jobs && (batch || serve || image_cache_name || cache_path || debug
+			|| trace_path || profile || profile_outputs || sample_hz))
+	{
+		fprintf(stderr, "--jobs can only be used with --engine\n");
+		return 1;
+	}
+
+	if (job_threads && !jobs)
+	{
+		fprintf(stderr, "--job-threads needs --jobs\n");
+		return 1;
+	}
+
+	if (!dedupe && !batch && !jobs)
+	{
+		fprintf(stderr, "--no-dedupe needs --batch or --jobs\n");
+		return 1;
+	}
+
+	if (max_steps && !batch && !jobs)
+	{
+		fprintf(stderr, "--max-steps needs --batch or --jobs\n");
+		return 1;
+	}
+
+	if (!max_steps)
+		max_steps = DEFAULT_MAX_STEPS;
+
+	chose_engine = engine != NULL;
+	if (!engine)
+		engine = &ENGINES[0];
+
+	/* a batch's stats add up all of its runs */
+	if (batch || jobs)
+	{
+		struct lmc_stats *counted = print_stats || stats_path ? &stats
+			: NULL;
+
+		stats_init(&stats, hw_stats);
+		if (batch)
 		{
-			fprintf(stderr, "Digit %d at position %d is too big\n",
-				c, i);
-			return 1;
+			rc = run_batch(input_path, engine, max_steps, dedupe,
+				counted);
 		}
+		else
+		{
+			rc = run_jobs(input_path, engine, max_steps, dedupe,
+				job_threads, counted);
+		}
+
+		fflush(stdout);
+		if (print_stats && stats_report(stderr, &stats))
+			rc = 1;
 
-		mailbox = &lmc.mailboxes[i / NUM_DIGITS];
-		*mailbox *= 10;
-		*mailbox += c;
+		if (stats_path && write_stats(stats_path, &stats))
+			rc = 1;
 
-		++i;
+		stats_close(&stats);
+		return rc;
 	}
 
-	if (ferror(input_file))
+	memset(&lmc, 0, sizeof lmc);
+	lmc.in = stdin;
+	lmc.out = stdout;
+	lmc.quiet = quiet;
+
+	if (image_cache_name)
 	{
-		fprintf(stderr, "Error loading %s: %s\n", argv[1],
-			strerror(errno));
-		fclose(input_file);
+		struct lmc_image_cache image_cache;
+
+		if (image_cache_open(&image_cache, image_cache_name))
+			return 1;
+
+		i = image_cache_load(&image_cache, &lmc, input_path);
+		image_cache_close(&image_cache);
+	}
+	else
+	{
+		i = lmc_load_image(&lmc, input_path);
+	}
+
+	if (i < 0)
 		return 1;
+
+	/* a fork server's stdout carries its replies */
+	if (!quiet && !serve)
+		printf("%s loaded. %d mailboxes.\n", input_path, i);
+
+	stats_init(&stats, hw_stats);
+
+	if (map_path)
+	{
+		map = malloc(sizeof *map);
+		if (!map)
+		{
+			fprintf(stderr, "Out of memory\n");
+			goto end;
+		}
+
+		if (srcmap_load(map, map_path))
+			goto end;
+	}
+
+	if (profile || profile_outputs)
+	{
+		prof = calloc(1, sizeof *prof);
+		if (!prof)
+		{
+			fprintf(stderr, "Out of memory\n");
+			goto end;
+		}
 	}
 
-	fclose(input_file);
+	if (trace_path)
+	{
+		trace = trace_open(trace_path, compress, &lmc);
+		if (!trace)
+			goto end;
+	}
 
-	if ((i % NUM_DIGITS) != 0)
+	if (script_path)
 	{
-		fprintf(stderr,
-			"File size is not a multiple of the number of digits per mailbox\n");
-		return 1;
+		script = fopen(script_path, "r");
+		if (!script)
+		{
+			fprintf(stderr, "Error opening %s: %s\n", script_path,
+				strerror(errno));
+			goto end;
+		}
 	}
 
-	printf("%s loaded. %d mailboxes.\n", argv[1], i / NUM_DIGITS);
+	if (sample_hz && sample_start(sample_hz))
+		goto end;
 
-	while (!lmc.cpu.halted)
+	rc = 0;
+	if (serve)
+		rc = fork_server(&lmc, engine);
+	else if (cache_path)
+		rc = run_cached(&lmc, engine, cache_path);
+	else if (debug)
+		rc = debug_run(&lmc, script ? script : stdin, !script, map,
+			(size_t) history_mib << 20);
+	else if (trace)
+		lmc_run_traced(&lmc, trace);
+	else if ((print_stats || stats_path) && chose_engine)
+		lmc_run_engine_counted(&lmc, engine, UINT64_MAX, &stats);
+	else if (print_stats || stats_path)
+		lmc_run_counted(&lmc, &stats);
+	else if (prof)
+		lmc_run_profiled(&lmc, prof);
+	else if (sample_hz)
+		lmc_run_sampled(&lmc);
+	else
+		engine->run(&lmc);
+
+	if (sample_hz)
+		sample_stop();
+
+	rc = rc || lmc.cpu.error;
+	fflush(stdout);
+
+	if (trace)
 	{
-		lmc_op op;
+		if (trace_close(trace, &lmc))
+			rc = 1;
+
+		trace = NULL;
+	}
+
+	if (sample_hz && sample_report(stderr, &lmc, map))
+		rc = 1;
+
+	if (profile && profile_report(stderr, &lmc, prof, map))
+		rc = 1;
 
-		lmc.cpu.instruction = lmc.mailboxes[lmc.cpu.pc++];
-		lmc.cpu.opcode = lmc.cpu.instruction / NUM_MAILBOXES;
-		lmc.cpu.addr = lmc.cpu.instruction % NUM_MAILBOXES;
+	if (print_stats && stats_report(stderr, &stats))
+		rc = 1;
 
-		if (lmc.cpu.opcode > 9 || (op = OPS[lmc.cpu.opcode]) == NULL)
+	if (stats_path && write_stats(stats_path, &stats))
+		rc = 1;
+
+	for (i = 0; i < NUM_PROFILE_OUTPUTS; ++i)
+	{
+		if (PROFILE_OUTPUTS[i].path
+			&& write_profile(&PROFILE_OUTPUTS[i], &lmc, prof, map))
 		{
-			bad_instruction(&lmc);
-			break;
+			rc = 1;
 		}
-
-		op(&lmc);
 	}
 
-	return !!lmc.cpu.error;
+end:
+	if (trace)
+		trace_close(trace, &lmc);
+
+	stats_close(&stats);
+
+	if (script)
+		fclose(script);
+
+	free(prof);
+	free(map);
+	return rc;
 }
@@ -0,0 +1,158 @@
+/*
+ * lmc - Little Man Computer
+ * Copyright (C) 2020 David McMackins II
+ *
+ * Redistributions, modified or unmodified, in whole or in part, must retain
+ * applicable copyright or other legal privilege notices, these conditions, and
+ * the following license terms and disclaimer.  Subject to these conditions,
+ * the holder(s) of copyright or other legal privileges, author(s) or
+ * assembler(s), and contributors of this work hereby grant to any person who
+ * obtains a copy of this work in any form:
+ *
+ * 1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ * use, and/or otherwise deal in the licensed material without restriction.
+ *
+ * 2. A perpetual, worldwide, non-exclusive, royalty-free, irrevocable patent
+ * license to reproduce, modify, distribute, publish, sell, use, and/or
+ * otherwise deal in the licensed material without restriction, for any and all
+ * patents:
+ *
+ *     a. Held by each such holder of copyright or other legal privilege,
+ *     author or assembler, or contributor, necessarily infringed by the
+ *     contributions alone or by combination with the work, of that privilege
+ *     holder, author or assembler, or contributor.
+ *
+ *     b. Necessarily infringed by the work at the time that holder of
+ *     copyright or other privilege, author or assembler, or contributor made
+ *     any contribution to the work.
+ *
+ * NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ * LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ * A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ * ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ * ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT, TORT,
+ * OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR THE USE
+ * OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#ifndef LMC_H
+#define LMC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifndef NUM_MAILBOXES
+# define NUM_MAILBOXES 100
+#endif
+
+#ifndef NUM_DIGITS
+# define NUM_DIGITS 3
+#endif
+
+#ifndef MAX_VALUE
+# define MAX_VALUE 999
+#endif
+
+#define NUM_OPCODES 10
+
+#define UNUSED(X) (void)(X)
+
+struct lmc_cpu
+{
+	int a;
+	int pc;
+	int instruction;
+	int opcode;
+	int addr;
+	bool neg;
+	bool halted;
+
+	bool error; /* controls program exit code */
+};
+
+struct lmc
+{
+	int mailboxes[NUM_MAILBOXES];
+	struct lmc_cpu cpu;
+	FILE *in; /* INP reads from here */
+	FILE *out; /* OUT and prompts write here */
+
+	/* if set, OUT passes its value here instead of writing it to out;
+	   setting cpu.halted stops the machine right after the OUT */
+	void (*output)(struct lmc *lmc, int value);
+	void *output_data;
+
+	bool quiet; /* don't prompt for input */
+
+	/* INP and OUT instructions run so far, whichever engine ran them */
+	uint64_t inputs;
+	uint64_t outputs;
+};
+
+typedef void (*lmc_op)(struct lmc *lmc);
+
+/* interchangeable execution loops; all of them must behave identically */
+struct lmc_engine
+{
+	const char *name;
+	void (*run)(struct lmc *lmc);
+
+	/* executes at most steps instructions; stopping between any two of
+	   them must leave the machine exactly as lmc_step would. Returns how
+	   many it executed, counting the one it halted on. */
+	uint64_t (*run_for)(struct lmc *lmc, uint64_t steps);
+};
+
+extern const struct lmc_engine ENGINES[]; /* terminated by a NULL name */
+
+extern const lmc_op OPS[NUM_OPCODES];
+
+void
+bad_instruction(struct lmc *lmc);
+
+/* returns the assembler mnemonic for an instruction word, or NULL if the
+   instruction is invalid */
+const char *
+lmc_mnemonic(int instruction);
+
+/* loads a memory image written by lmasm; returns the number of mailboxes
+   loaded or -1 on error */
+int
+lmc_load_image(struct lmc *lmc, const char *path);
+
+/* lmc_load_image in two steps: reads an image file without checking it,
+   into a buffer to free, or returns NULL on error */
+unsigned char *
+lmc_read_image(const char *path, size_t *len);
+
+/* checks and loads an image read by lmc_read_image, or taken from
+   anywhere else, into zeroed mailboxes; name is for errors */
+int
+lmc_decode_image(struct lmc *lmc, const unsigned char *image, size_t len,
+	const char *name);
+
+/* returns NULL if there's no engine by that name */
+const struct lmc_engine *
+lmc_find_engine(const char *name);
+
+/* executes a single instruction; the reference every engine is checked
+   against */
+void
+lmc_step(struct lmc *lmc);
+
+void
+lmc_run(struct lmc *lmc);
+
+uint64_t
+lmc_run_for(struct lmc *lmc, uint64_t steps);
+
+/* lmc_run() with the CPU kept in locals rather than in struct lmc */
+void
+lmc_run_resident(struct lmc *lmc);
+
+uint64_t
+lmc_run_resident_for(struct lmc *lmc, uint64_t steps);
+
+#endif
@@ -0,0 +1,378 @@
+/*
+ * lmcbench - Little Man Computer dispatch microbenchmarks
+ * Copyright (C) 2020 David McMackins II
+ *
+ * Redistributions, modified or unmodified, in whole or in part, must retain
+ * applicable copyright or other legal privilege notices, these conditions, and
+ * the following license terms and disclaimer.  Subject to these conditions,
+ * the holder(s) of copyright or other legal privileges, author(s) or
+ * assembler(s), and contributors of this work hereby grant to any person who
+ * obtains a copy of this work in any form:
+ *
+ * 1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ * use, and/or otherwise deal in the licensed material without restriction.
+ *
+ * 2. A perpetual, worldwide, non-exclusive, royalty-free, irrevocable patent
+ * license to reproduce, modify, distribute, publish, sell, use, and/or
+ * otherwise deal in the licensed material without restriction, for any and all
+ * patents:
+ *
+ *     a. Held by each such holder of copyright or other legal privilege,
+ *     author or assembler, or contributor, necessarily infringed by the
+ *     contributions alone or by combination with the work, of that privilege
+ *     holder, author or assembler, or contributor.
+ *
+ *     b. Necessarily infringed by the work at the time that holder of
+ *     copyright or other privilege, author or assembler, or contributor made
+ *     any contribution to the work.
+ *
+ * NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ * LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ * A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ * ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ * ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT, TORT,
+ * OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR THE USE
+ * OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lmc.h"
+#include "stats.h"
+
+#if NUM_MAILBOXES != 100
+# error "lmcbench's kernels are laid out for 100 mailboxes"
+#endif
+
+/*
+ * Every kernel is a straight-line body of the instructions under test,
+ * followed by a countdown that branches back to mailbox 0 999 times:
+ *
+ *   0 .. n-1   body
+ *   n          LDA CNT
+ *   n+1        SUB ONE
+ *   n+2        STA CNT
+ *   n+3        BRP 0
+ *   n+4        HLT
+ *   65 ..      data
+ *
+ * The machine is reset from the image between runs, so the countdown
+ * overhead is a fixed and small fraction of each run.
+ */
+#define DATA_START 65
+#define CNT 65
+#define ONE 66
+#define ZERO 67
+#define X 68
+#define Y 69
+#define INS 70
+#define TABLE 71
+#define TABLE_LEN (NUM_MAILBOXES - TABLE)
+
+#define OP(CODE, ADDR) ((CODE) * NUM_MAILBOXES + (ADDR))
+
+#define DEFAULT_TARGET 50000000UL
+
+struct kernel
+{
+	const char *name;
+	const char *opcodes;
+	int (*build)(int *image, int param);
+	int param;
+};
+
+static int
+build_repeat(int *image, int instruction)
+{
+	int i;
+
+	for (i = 0; i < DATA_START - 5; ++i)
+		image[i] = instruction;
+
+	return i;
+}
+
+static int
+build_add(int *image, int param)
+{
+	UNUSED(param);
+	return build_repeat(image, OP(1, ONE));
+}
+
+static int
+build_sub(int *image, int param)
+{
+	UNUSED(param);
+	return build_repeat(image, OP(2, ONE));
+}
+
+static int
+build_load_store(int *image, int param)
+{
+	int i;
+
+	UNUSED(param);
+
+	for (i = 0; i < DATA_START - 6; i += 2)
+	{
+		image[i] = OP(5, X);
+		image[i + 1] = OP(3, Y);
+	}
+
+	return i;
+}
+
+static int
+build_bra(int *image, int param)
+{
+	int i;
+
+	UNUSED(param);
+
+	for (i = 0; i < DATA_START - 5; ++i)
+		image[i] = OP(6, i + 1);
+
+	return i;
+}
+
+/* each BRZ goes to the next mailbox either way, so the LMC program's
+   path is fixed while the host sees taken/not-taken in the pattern held
+   in the table; param is the percentage of zeroes in the table */
+static int
+build_brz(int *image, int param)
+{
+	int i;
+
+	for (i = 0; i < TABLE_LEN; ++i)
+	{
+		image[2 * i] = OP(5, TABLE + i);
+		image[2 * i + 1] = OP(7, 2 * i + 2);
+		image[TABLE + i] = rand() % 100 < param ? 0 : 1;
+	}
+
+	return 2 * i;
+}
+
+/* stores an instruction over the one about to be executed, which is what
+   defeats any engine that caches decoded instructions */
+static int
+build_self_modify(int *image, int param)
+{
+	int i;
+
+	UNUSED(param);
+
+	for (i = 0; i < DATA_START - 7; i += 3)
+	{
+		image[i] = OP(5, INS);
+		image[i + 1] = OP(3, i + 2);
+		image[i + 2] = OP(1, ZERO);
+	}
+
+	image[INS] = OP(1, ZERO);
+	return i;
+}
+
+static const struct kernel KERNELS[] =
+{
+	{ "add", "ADD", build_add, 0 },
+	{ "sub", "SUB", build_sub, 0 },
+	{ "load-store", "LDA/STA", build_load_store, 0 },
+	{ "bra", "BRA", build_bra, 0 },
+	{ "brz-never", "LDA/BRZ", build_brz, 0 },
+	{ "brz-10", "LDA/BRZ", build_brz, 10 },
+	{ "brz-50", "LDA/BRZ", build_brz, 50 },
+	{ "brz-always", "LDA/BRZ", build_brz, 100 },
+	{ "self-modify", "LDA/STA/ADD", build_self_modify, 0 },
+	{ NULL, NULL, NULL, 0 }
+};
+
+static void
+build_kernel(struct lmc *lmc, const struct kernel *kernel)
+{
+	int n;
+
+	memset(lmc, 0, sizeof *lmc);
+	lmc->in = stdin;
+	lmc->out = stdout;
+	lmc->quiet = true;
+
+	n = kernel->build(lmc->mailboxes, kernel->param);
+	lmc->mailboxes[n] = OP(5, CNT);
+	lmc->mailboxes[n + 1] = OP(2, ONE);
+	lmc->mailboxes[n + 2] = OP(3, CNT);
+	lmc->mailboxes[n + 3] = OP(8, 0);
+	lmc->mailboxes[n + 4] = OP(0, 0);
+
+	lmc->mailboxes[CNT] = 999;
+	lmc->mailboxes[ONE] = 1;
+	lmc->mailboxes[ZERO] = 0;
+}
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int
+bench(FILE *out, const struct lmc_engine *engine, const struct kernel *kernel,
+	uint64_t target)
+{
+	struct lmc image, ref, lmc;
+	struct lmc_stats stats;
+	uint64_t per_run, runs = 0, start, elapsed;
+
+	build_kernel(&image, kernel);
+
+	/* the counted engine tells us how many instructions one run is */
+	ref = image;
+	stats_init(&stats, false);
+	lmc_run_counted(&ref, &stats);
+	stats_close(&stats);
+	if (ref.cpu.error)
+	{
+		fprintf(stderr, "Kernel %s failed\n", kernel->name);
+		return 1;
+	}
+
+	per_run = stats.instructions;
+
+	lmc = image; /* warm up */
+	engine->run(&lmc);
+
+	start = now_ns();
+	do
+	{
+		lmc = image;
+		engine->run(&lmc);
+		++runs;
+	}
+	while (runs * per_run < target);
+	elapsed = now_ns() - start;
+
+	if (memcmp(lmc.mailboxes, ref.mailboxes, sizeof lmc.mailboxes)
+		|| lmc.cpu.a != ref.cpu.a || lmc.cpu.pc != ref.cpu.pc
+		|| lmc.cpu.error)
+	{
+		fprintf(stderr, "Engine %s failed kernel %s\n", engine->name,
+			kernel->name);
+		return 1;
+	}
+
+	fprintf(out, "%s,%s,%s,%lu,%.6f,%.3f,%.2f\n", engine->name,
+		kernel->name, kernel->opcodes,
+		(unsigned long) (runs * per_run), elapsed / 1e9,
+		(double) elapsed / (double) (runs * per_run),
+		(double) (runs * per_run) * 1e3 / (double) elapsed);
+	fflush(out);
+
+	return 0;
+}
+
+static void
+usage(void)
+{
+	int i;
+
+	fprintf(stderr, "Usage: lmcbench [--engine <name>] [--kernel <name>] "
+		"[--insns <count>] [--seed <n>] [-o <csv>]\nKernels:");
+	for (i = 0; KERNELS[i].name; ++i)
+		fprintf(stderr, " %s", KERNELS[i].name);
+
+	fputc('\n', stderr);
+}
+
+int
+main(int argc, char *argv[])
+{
+	FILE *out = stdout;
+	const char *engine_name = NULL, *kernel_name = NULL;
+	unsigned long target = DEFAULT_TARGET, seed = 1;
+	int i, j, rc = 0;
+
+	for (i = 1; i < argc; ++i)
+	{
+		const char *arg = i + 1 < argc ? argv[i + 1] : NULL;
+
+		if (!arg)
+		{
+			usage();
+			return 1;
+		}
+
+		if (strcmp(argv[i], "--engine") == 0)
+			engine_name = arg;
+		else if (strcmp(argv[i], "--kernel") == 0)
+			kernel_name = arg;
+		else if (strcmp(argv[i], "--insns") == 0)
+			target = strtoul(arg, NULL, 10);
+		else if (strcmp(argv[i], "--seed") == 0)
+			seed = strtoul(arg, NULL, 10);
+		else if (strcmp(argv[i], "-o") == 0)
+		{
+			out = fopen(arg, "w");
+			if (!out)
+			{
+				fprintf(stderr, "Error opening %s: %s\n", arg,
+					strerror(errno));
+				return 1;
+			}
+		}
+		else
+		{
+			usage();
+			return 1;
+		}
+
+		++i;
+	}
+
+	if (engine_name && !lmc_find_engine(engine_name))
+	{
+		fprintf(stderr, "No such engine: %s\n", engine_name);
+		return 1;
+	}
+
+	fprintf(out, "engine,kernel,opcodes,instructions,seconds,"
+		"ns_per_instruction,mips\n");
+
+	for (i = 0; ENGINES[i].name; ++i)
+	{
+		if (engine_name && strcmp(engine_name, ENGINES[i].name) != 0)
+			continue;
+
+		for (j = 0; KERNELS[j].name; ++j)
+		{
+			if (kernel_name
+				&& strcmp(kernel_name, KERNELS[j].name) != 0)
+			{
+				continue;
+			}
+
+			/* same branch patterns for every engine */
+			srand(seed + j);
+			if (bench(out, &ENGINES[i], &KERNELS[j], target))
+				rc = 1;
+		}
+	}
+
+	if (out != stdout && fclose(out))
+	{
+		fprintf(stderr, "Error writing CSV: %s\n", strerror(errno));
+		rc = 1;
+	}
+
+	return rc;
+}
@@ -0,0 +1,576 @@
+/*
+ * lmdiff - Little Man Computer differential engine checker
+ * Copyright (C) 2020 David McMackins II
+ *
+ * Redistributions, modified or unmodified, in whole or in part, must retain
+ * applicable copyright or other legal privilege notices, these conditions, and
+ * the following license terms and disclaimer.  Subject to these conditions,
+ * the holder(s) of copyright or other legal privileges, author(s) or
+ * assembler(s), and contributors of this work hereby grant to any person who
+ * obtains a copy of this work in any form:
+ *
+ * 1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ * use, and/or otherwise deal in the licensed material without restriction.
+ *
+ * 2. A perpetual, worldwide, non-exclusive, royalty-free, irrevocable patent
+ * license to reproduce, modify, distribute, publish, sell, use, and/or
+ * otherwise deal in the licensed material without restriction, for any and all
+ * patents:
+ *
+ *     a. Held by each such holder of copyright or other legal privilege,
+ *     author or assembler, or contributor, necessarily infringed by the
+ *     contributions alone or by combination with the work, of that privilege
+ *     holder, author or assembler, or contributor.
+ *
+ *     b. Necessarily infringed by the work at the time that holder of
+ *     copyright or other privilege, author or assembler, or contributor made
+ *     any contribution to the work.
+ *
+ * NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ * LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ * A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ * ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ * ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT, TORT,
+ * OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR THE USE
+ * OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lmc.h"
+#include "pool.h"
+#include "profile.h"
+#include "sample.h"
+#include "stats.h"
+#include "trace.h"
+
+#define DEFAULT_MAX_STEPS 100000000UL
+#define DEFAULT_CHECKPOINT 100000UL
+
+#define WHY_LEN 128
+
+struct program
+{
+	const char *path;
+	char *input_path; /* NULL if the program has no input file */
+	struct lmc image;
+};
+
+struct diff_conf
+{
+	const char *engine; /* only check this one, if set */
+	uint64_t max_steps;
+	uint64_t checkpoint;
+};
+
+static void
+run_profiled(struct lmc *lmc)
+{
+	struct lmc_profile prof;
+
+	memset(&prof, 0, sizeof prof);
+	lmc_run_profiled(lmc, &prof);
+}
+
+static void
+run_counted(struct lmc *lmc)
+{
+	struct lmc_stats stats;
+
+	stats_init(&stats, false);
+	lmc_run_counted(lmc, &stats);
+	stats_close(&stats);
+}
+
+static void
+run_traced(struct lmc *lmc)
+{
+	struct lmc_trace *trace;
+
+	trace = trace_open("/dev/null", false, lmc);
+	if (!trace)
+	{
+		lmc->cpu.halted = true;
+		lmc->cpu.error = true;
+		return;
+	}
+
+	lmc_run_traced(lmc, trace);
+	trace_close(trace, lmc);
+}
+
+/* the instrumented loops lmc picks for --profile, --stats, --trace and
+   --sample must not change what a program does either */
+static const struct lmc_engine INSTRUMENTED[] =
+{
+	{ "profiled", run_profiled, NULL },
+	{ "counted", run_counted, NULL },
+	{ "traced", run_traced, NULL },
+	{ "sampled", lmc_run_sampled, NULL },
+	{ NULL, NULL, NULL }
+};
+
+static int
+start(struct lmc *lmc, const struct program *prog)
+{
+	*lmc = prog->image;
+
+	lmc->in = fopen(prog->input_path ? prog->input_path : "/dev/null",
+		"r");
+	if (!lmc->in)
+	{
+		fprintf(stderr, "Error opening %s: %s\n", prog->input_path,
+			strerror(errno));
+		return 1;
+	}
+
+	lmc->out = tmpfile();
+	if (!lmc->out)
+	{
+		fprintf(stderr, "Error creating output file: %s\n",
+			strerror(errno));
+		fclose(lmc->in);
+		return 1;
+	}
+
+	return 0;
+}
+
+static void
+finish(struct lmc *lmc)
+{
+	fclose(lmc->in);
+	fclose(lmc->out);
+}
+
+static uint64_t
+step(struct lmc *lmc, uint64_t steps)
+{
+	uint64_t n;
+
+	for (n = 0; n < steps && !lmc->cpu.halted; ++n)
+		lmc_step(lmc);
+
+	return n;
+}
+
+/* returns the offset of the first byte where the outputs differ, or -1 */
+static long
+compare_output(FILE *a, FILE *b)
+{
+	long offset = 0;
+	int ca, cb;
+
+	rewind(a);
+	rewind(b);
+
+	do
+	{
+		ca = fgetc(a);
+		cb = fgetc(b);
+		if (ca != cb)
+			return offset;
+
+		++offset;
+	}
+	while (ca != EOF);
+
+	return -1;
+}
+
+/* describes the first difference between the machines in why; returns 0 if
+   there is none */
+static int
+compare(const struct lmc *ref, const struct lmc *lmc, bool full, char *why)
+{
+	const struct lmc_cpu *a = &ref->cpu, *b = &lmc->cpu;
+	long offset;
+	int i;
+
+#define FIELD(F) \
+	if (a->F != b->F) \
+	{ \
+		sprintf(why, #F " is %d, expected %d", (int) b->F, \
+			(int) a->F); \
+		return 1; \
+	}
+
+	FIELD(halted)
+	FIELD(error)
+	FIELD(pc)
+	FIELD(a)
+	FIELD(neg)
+	FIELD(instruction)
+	FIELD(opcode)
+	FIELD(addr)
+
+#undef FIELD
+
+	for (i = 0; i < NUM_MAILBOXES; ++i)
+	{
+		if (ref->mailboxes[i] != lmc->mailboxes[i])
+		{
+			sprintf(why, "mailbox %d is %d, expected %d", i,
+				lmc->mailboxes[i], ref->mailboxes[i]);
+			return 1;
+		}
+	}
+
+	fflush(ref->out);
+	fflush(lmc->out);
+
+	if (ftell(ref->out) != ftell(lmc->out))
+	{
+		sprintf(why, "%ld bytes of output, expected %ld",
+			ftell(lmc->out), ftell(ref->out));
+		return 1;
+	}
+
+	if (full && (offset = compare_output(ref->out, lmc->out)) >= 0)
+	{
+		sprintf(why, "output differs at byte %ld", offset);
+		return 1;
+	}
+
+	return 0;
+}
+
+/* compares the engine and the reference after exactly steps instructions;
+   returns -1 on error */
+static int
+compare_after(const struct program *prog, const struct lmc_engine *engine,
+	uint64_t steps, char *why)
+{
+	struct lmc ref, lmc;
+	int rc;
+
+	if (start(&ref, prog))
+		return -1;
+
+	if (start(&lmc, prog))
+	{
+		finish(&ref);
+		return -1;
+	}
+
+	step(&ref, steps);
+	engine->run_for(&lmc, steps);
+	rc = compare(&ref, &lmc, true, why);
+
+	finish(&ref);
+	finish(&lmc);
+	return rc;
+}
+
+/* the machines agree after good steps and not after bad; narrows that down
+   to the first instruction after which they don't */
+static int
+localize(const struct program *prog, const struct lmc_engine *engine,
+	uint64_t good, uint64_t bad)
+{
+	struct lmc ref;
+	char why[WHY_LEN];
+	const char *name;
+	int rc;
+
+	while (bad - good > 1)
+	{
+		uint64_t mid = good + (bad - good) / 2;
+
+		rc = compare_after(prog, engine, mid, why);
+		if (rc < 0)
+			return 2;
+
+		if (rc)
+			bad = mid;
+		else
+			good = mid;
+	}
+
+	if (start(&ref, prog))
+		return 2;
+
+	step(&ref, good);
+	name = lmc_mnemonic(ref.mailboxes[ref.cpu.pc]);
+	finish(&ref);
+
+	if (compare_after(prog, engine, bad, why) < 0)
+		return 2;
+
+	printf("FAIL %s: %s: instruction %" PRIu64 " (%s at mailbox %d): "
+		"%s\n", prog->path, engine->name, bad, name ? name : "invalid",
+		ref.cpu.pc, why);
+	return 1;
+}
+
+static int
+check_checkpoints(const struct program *prog,
+	const struct lmc_engine *engine, const struct diff_conf *conf)
+{
+	struct lmc ref, lmc;
+	char why[WHY_LEN];
+	uint64_t done = 0, ran, got;
+	int rc = 0;
+
+	if (start(&ref, prog))
+		return 2;
+
+	if (start(&lmc, prog))
+	{
+		finish(&ref);
+		return 2;
+	}
+
+	while (done < conf->max_steps && !ref.cpu.halted)
+	{
+		uint64_t n = conf->checkpoint;
+
+		if (n > conf->max_steps - done)
+			n = conf->max_steps - done;
+
+		ran = step(&ref, n);
+		if ((got = engine->run_for(&lmc, n)) != ran)
+		{
+			printf("FAIL %s: %s: after instruction %" PRIu64 ": ran %"
+				PRIu64 " instructions, expected %" PRIu64 "\n",
+				prog->path, engine->name, done, got, ran);
+			rc = 1;
+			break;
+		}
+		done += n;
+
+		if (compare(&ref, &lmc, false, why))
+		{
+			rc = localize(prog, engine, done - n, done);
+			break;
+		}
+	}
+
+	finish(&ref);
+	finish(&lmc);
+	return rc;
+}
+
+static int
+check_engine(const struct program *prog, const struct lmc_engine *engine,
+	const struct diff_conf *conf, const struct lmc *ref)
+{
+	struct lmc lmc;
+	char why[WHY_LEN];
+	int rc;
+
+	if (engine->run_for && conf->checkpoint)
+	{
+		rc = check_checkpoints(prog, engine, conf);
+		if (rc)
+			return rc;
+	}
+
+	/* an engine's run can't be stopped, so only try it if we know the
+	   program halts */
+	if (!ref->cpu.halted)
+		return 0;
+
+	if (start(&lmc, prog))
+		return 2;
+
+	engine->run(&lmc);
+	rc = compare(ref, &lmc, true, why);
+	if (rc)
+	{
+		printf("FAIL %s: %s: at halt: %s\n", prog->path, engine->name,
+			why);
+	}
+
+	finish(&lmc);
+	return rc;
+}
+
+static char *
+input_path_for(const char *path)
+{
+	const char *slash = strrchr(path, '/'), *dot = strrchr(path, '.');
+	size_t len = dot && (!slash || dot > slash) ? (size_t) (dot - path)
+		: strlen(path);
+	char *input_path;
+	FILE *f;
+
+	input_path = malloc(len + sizeof ".in");
+	if (!input_path)
+		return NULL;
+
+	memcpy(input_path, path, len);
+	strcpy(input_path + len, ".in");
+
+	f = fopen(input_path, "r");
+	if (!f)
+	{
+		free(input_path);
+		return NULL;
+	}
+
+	fclose(f);
+	return input_path;
+}
+
+static int
+check_program(const char *path, const struct diff_conf *conf)
+{
+	const struct lmc_engine *tables[2];
+	struct program prog;
+	struct lmc ref;
+	uint64_t steps;
+	int i, j, rc = 0, engines = 0;
+
+	tables[0] = ENGINES;
+	tables[1] = INSTRUMENTED;
+
+	memset(&prog, 0, sizeof prog);
+	prog.path = path;
+	prog.image.quiet = true;
+	if (lmc_load_image(&prog.image, path) < 0)
+		return 2;
+
+	prog.input_path = input_path_for(path);
+
+	if (start(&ref, &prog))
+	{
+		free(prog.input_path);
+		return 2;
+	}
+
+	steps = step(&ref, conf->max_steps);
+
+	for (i = 0; i < 2 && rc < 2; ++i)
+	{
+		for (j = 0; tables[i][j].name && rc < 2; ++j)
+		{
+			const struct lmc_engine *engine = &tables[i][j];
+			int engine_rc;
+
+			if (conf->engine && strcmp(conf->engine, engine->name))
+				continue;
+
+			engine_rc = check_engine(&prog, engine, conf, &ref);
+			if (engine_rc > rc)
+				rc = engine_rc;
+
+			++engines;
+		}
+	}
+
+	if (0 == rc)
+	{
+		printf("ok   %s: %d engines, %" PRIu64 " instructions%s\n", path,
+			engines, steps,
+			ref.cpu.halted ? "" : " (did not halt)");
+	}
+
+	finish(&ref);
+	free(prog.input_path);
+	return rc;
+}
+
+static const char *const USAGE[] =
+{
+	"Usage: lmdiff [options] <image>...",
+	"  -j <jobs>             check this many images at once",
+	"                        (default: one per CPU)",
+	"  --engine <name>       only check this engine",
+	"  --checkpoint <steps>  compare state every this many instructions",
+	"                        (default 100000, 0 to only compare at halt)",
+	"  --max-steps <n>       give up on programs that run longer than this",
+	"                        (default 100000000)",
+	"Input for <name>.lexe is read from <name>.in if it exists.",
+	NULL
+};
+
+struct diff_run
+{
+	char **paths;
+	const struct diff_conf *conf;
+};
+
+static int
+check_image(int i, void *data)
+{
+	const struct diff_run *run = data;
+
+	return check_program(run->paths[i], run->conf);
+}
+
+static const char *
+image_name(int i, void *data)
+{
+	const struct diff_run *run = data;
+
+	return run->paths[i];
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct diff_conf conf;
+	struct diff_run run;
+	unsigned long jobs, max_steps = DEFAULT_MAX_STEPS;
+	unsigned long checkpoint = DEFAULT_CHECKPOINT;
+	struct pool_option options[4];
+	int i, next, rc, failed, checked;
+
+	jobs = pool_default_jobs();
+
+	options[0].name = "-j";
+	options[0].value = &jobs;
+	options[0].zero_ok = false;
+	options[1].name = "--checkpoint";
+	options[1].value = &checkpoint;
+	options[1].zero_ok = true;
+	options[2].name = "--max-steps";
+	options[2].value = &max_steps;
+	options[2].zero_ok = false;
+	options[3].name = NULL;
+
+	conf.engine = NULL;
+	i = pool_options(argc, argv, &conf.engine, options, USAGE);
+	if (i < 0)
+		return 2;
+
+	if (i == argc)
+	{
+		pool_usage(USAGE);
+		return 2;
+	}
+
+	conf.max_steps = max_steps;
+	conf.checkpoint = checkpoint;
+
+	if (conf.engine && !lmc_find_engine(conf.engine))
+	{
+		for (next = 0; INSTRUMENTED[next].name; ++next)
+		{
+			if (strcmp(INSTRUMENTED[next].name, conf.engine) == 0)
+				break;
+		}
+
+		if (!INSTRUMENTED[next].name)
+		{
+			fprintf(stderr, "No such engine: %s\n", conf.engine);
+			return 2;
+		}
+	}
+
+	run.paths = argv + i;
+	run.conf = &conf;
+	rc = pool_run(argc - i, jobs, check_image, image_name, &run, &checked,
+		&failed);
+
+	printf("%d of %d images passed\n", checked - failed, checked);
+	return rc;
+}
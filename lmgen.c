@@ -0,0 +1,753 @@
+/*
+ * lmgen - random Little Man Computer program generator
+ * Copyright (C) 2020 David McMackins II
+ *
+ * Redistributions, modified or unmodified, in whole or in part, must retain
+ * applicable copyright or other legal privilege notices, these conditions, and
+ * the following license terms and disclaimer.  Subject to these conditions,
+ * the holder(s) of copyright or other legal privileges, author(s) or
+ * assembler(s), and contributors of this work hereby grant to any person who
+ * obtains a copy of this work in any form:
+ *
+ * 1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ * use, and/or otherwise deal in the licensed material without restriction.
+ *
+ * 2. A perpetual, worldwide, non-exclusive, royalty-free, irrevocable patent
+ * license to reproduce, modify, distribute, publish, sell, use, and/or
+ * otherwise deal in the licensed material without restriction, for any and all
+ * patents:
+ *
+ *     a. Held by each such holder of copyright or other legal privilege,
+ *     author or assembler, or contributor, necessarily infringed by the
+ *     contributions alone or by combination with the work, of that privilege
+ *     holder, author or assembler, or contributor.
+ *
+ *     b. Necessarily infringed by the work at the time that holder of
+ *     copyright or other privilege, author or assembler, or contributor made
+ *     any contribution to the work.
+ *
+ * NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ * LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ * A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ * ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ * ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT, TORT,
+ * OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR THE USE
+ * OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lmc.h"
+
+#define MAX_LABEL_LEN 32
+#define MAX_DEPTH 5
+#define MAX_SKIP 4
+
+/* mailboxes a loop costs beyond its body: LDA, STA before; LDA, SUB, STA,
+   BRP after; the counter and its initial value */
+#define LOOP_COST 8
+
+/* LDA and STA of a patch, the line it patches and the patch itself */
+#define PATCH_COST 4
+
+enum gen_op
+{
+	GEN_HLT,
+	GEN_ADD,
+	GEN_SUB,
+	GEN_STA,
+	GEN_LDA,
+	GEN_BRA,
+	GEN_BRZ,
+	GEN_BRP,
+	GEN_INP,
+	GEN_OUT,
+	GEN_DAT,
+	GEN_NUM_OPS
+};
+
+/* the ops a straight-line slot can be filled with */
+#define GEN_NUM_MIX (GEN_BRP + 1)
+
+#define OP(CODE, ADDR) ((CODE) * NUM_MAILBOXES + (ADDR))
+
+struct gen_op_info
+{
+	const char *name;
+	int code; /* instruction with a zero address field */
+};
+
+static const struct gen_op_info OP_INFO[GEN_NUM_OPS] =
+{
+	{ "HLT", OP(0, 0) },
+	{ "ADD", OP(1, 0) },
+	{ "SUB", OP(2, 0) },
+	{ "STA", OP(3, 0) },
+	{ "LDA", OP(5, 0) },
+	{ "BRA", OP(6, 0) },
+	{ "BRZ", OP(7, 0) },
+	{ "BRP", OP(8, 0) },
+	{ "INP", OP(9, 1) },
+	{ "OUT", OP(9, 2) },
+	{ "DAT", 0 }
+};
+
+static const char *const MIX_NAMES[GEN_NUM_MIX] =
+{
+	NULL, "add", "sub", "sta", "lda", "bra", "brz", "brp"
+};
+
+static const int DEFAULT_MIX[GEN_NUM_MIX] = { 0, 4, 3, 3, 4, 1, 2, 2 };
+
+struct gen_line
+{
+	enum gen_op op;
+	int value; /* added to the address of sym, if any */
+	int sym;
+	bool patchable; /* safe to overwrite with another patch */
+};
+
+struct gen_sym
+{
+	char name[MAX_LABEL_LEN + 1];
+	bool data;
+	int index; /* line in its section, -1 until placed */
+};
+
+struct gen
+{
+	uint64_t state;
+
+	/* knobs */
+	int depth;
+	int max_trips;
+	int mix[GEN_NUM_MIX];
+	int mix_total;
+	int loop_rate;
+	int patch_rate;
+	int io_rate;
+	int num_vars;
+	int num_aliases;
+
+	struct gen_line code[NUM_MAILBOXES];
+	struct gen_line data[NUM_MAILBOXES];
+	int num_code;
+	int num_data;
+
+	struct gen_sym *syms;
+	int num_syms;
+	int syms_size;
+
+	int one; /* symbol of the constant 1 */
+	int vars; /* symbol of the first scratch variable */
+	int aliases; /* symbol of the first alias */
+
+	int skip; /* symbol of a pending forward branch target, or -1 */
+	int skip_left;
+
+	int num_loops;
+	int num_patches;
+};
+
+/* splitmix64, so that a seed means the same program everywhere */
+static uint64_t
+gen_next(struct gen *g)
+{
+	uint64_t z;
+
+	g->state += UINT64_C(0x9e3779b97f4a7c15);
+	z = g->state;
+	z = (z ^ (z >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+	z = (z ^ (z >> 27)) * UINT64_C(0x94d049bb133111eb);
+	return z ^ (z >> 31);
+}
+
+static int
+gen_rand(struct gen *g, int n)
+{
+	return (int) (gen_next(g) % (uint64_t) n);
+}
+
+static int
+gen_sym(struct gen *g, const char *prefix, int n, bool data, int index)
+{
+	struct gen_sym *sym;
+
+	if (g->num_syms == g->syms_size)
+	{
+		void *temp;
+
+		g->syms_size = g->syms_size ? g->syms_size * 2 : 64;
+		temp = realloc(g->syms, g->syms_size * sizeof *g->syms);
+		if (!temp)
+		{
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
+		}
+
+		g->syms = temp;
+	}
+
+	sym = &g->syms[g->num_syms];
+	if (n < 0)
+		sprintf(sym->name, "%s", prefix);
+	else
+		sprintf(sym->name, "%s%d", prefix, n);
+	sym->data = data;
+	sym->index = index;
+	return g->num_syms++;
+}
+
+static int
+gen_data(struct gen *g, const char *prefix, int n, int value)
+{
+	struct gen_line *line = &g->data[g->num_data];
+
+	line->op = GEN_DAT;
+	line->value = value;
+	line->sym = -1;
+	line->patchable = false;
+	return gen_sym(g, prefix, n, true, g->num_data++);
+}
+
+static struct gen_line *
+gen_code(struct gen *g, enum gen_op op, int sym)
+{
+	struct gen_line *line = &g->code[g->num_code];
+
+	if (g->skip >= 0 && g->skip_left-- <= 0)
+	{
+		g->syms[g->skip].index = g->num_code;
+		g->skip = -1;
+	}
+
+	line->op = op;
+	line->value = OP_INFO[op].code;
+	line->sym = sym;
+	line->patchable = false;
+	++g->num_code;
+	return line;
+}
+
+/* a pending branch target lands on the next line, so that no branch
+   crosses into or out of a loop */
+static void
+gen_flush_skip(struct gen *g)
+{
+	g->skip_left = 0;
+}
+
+/* a scratch variable, by its own name or any of its aliases */
+static int
+gen_var(struct gen *g)
+{
+	int var = gen_rand(g, g->num_vars);
+	int aliases = (g->num_aliases - var + g->num_vars - 1) / g->num_vars;
+	int which = gen_rand(g, aliases + 1);
+
+	if (0 == which)
+		return g->vars + var;
+
+	return g->aliases + var + (which - 1) * g->num_vars;
+}
+
+static int
+gen_budget(const struct gen *g)
+{
+	return g->num_code + g->num_data;
+}
+
+static uint64_t
+gen_block(struct gen *g, int depth, int budget, uint64_t *inputs);
+
+static uint64_t
+gen_loop(struct gen *g, int depth, int budget, uint64_t *inputs)
+{
+	uint64_t body, body_inputs = 0;
+	int n = ++g->num_loops, trips = 1 + gen_rand(g, g->max_trips);
+	int counter, init, top;
+
+	counter = gen_data(g, "count", n, 0);
+	init = gen_data(g, "trips", n, trips - 1);
+	top = gen_sym(g, "loop", n, false, -1);
+
+	gen_flush_skip(g);
+	gen_code(g, GEN_LDA, init);
+	gen_code(g, GEN_STA, counter);
+	g->syms[top].index = g->num_code;
+
+	body = gen_block(g, depth + 1, budget, &body_inputs);
+
+	gen_flush_skip(g);
+	gen_code(g, GEN_LDA, counter);
+	gen_code(g, GEN_SUB, g->one);
+	gen_code(g, GEN_STA, counter);
+	gen_code(g, GEN_BRP, top);
+
+	*inputs += trips * body_inputs;
+	return 2 + trips * (body + 4);
+}
+
+/* overwrites a line with another harmless instruction: usually the next
+   one, to catch engines that run stale decoded code, and sometimes one
+   that ran earlier */
+static uint64_t
+gen_patch(struct gen *g)
+{
+	static const enum gen_op PATCH_OPS[] = { GEN_ADD, GEN_SUB, GEN_LDA };
+	struct gen_line *target;
+	int n = ++g->num_patches, patch, sym, i;
+
+	patch = gen_data(g, "patch", n,
+		OP_INFO[PATCH_OPS[gen_rand(g, 3)]].code);
+	g->data[g->syms[patch].index].sym = gen_var(g);
+
+	/* a branch landing on the STA would store whatever is in A */
+	gen_flush_skip(g);
+	gen_code(g, GEN_LDA, patch);
+	sym = gen_sym(g, "target", n, false, -1);
+	gen_code(g, GEN_STA, sym);
+
+	i = gen_rand(g, g->num_code);
+	if (gen_rand(g, 2) && g->code[i].patchable)
+	{
+		g->syms[sym].index = i;
+		return 2;
+	}
+
+	g->syms[sym].index = g->num_code;
+	target = gen_code(g, PATCH_OPS[gen_rand(g, 3)], gen_var(g));
+	target->patchable = true;
+	return 3;
+}
+
+static uint64_t
+gen_op(struct gen *g, uint64_t *inputs)
+{
+	struct gen_line *line;
+	int r = gen_rand(g, g->mix_total), op;
+
+	if (gen_rand(g, 100) < g->io_rate)
+	{
+		op = gen_rand(g, 2) ? GEN_INP : GEN_OUT;
+		if (GEN_INP == op)
+			++*inputs;
+
+		gen_code(g, op, -1);
+		return 1;
+	}
+
+	for (op = 0; r >= g->mix[op]; ++op)
+		r -= g->mix[op];
+
+	if (op >= GEN_BRA && g->skip < 0)
+	{
+		g->skip = gen_sym(g, "skip", g->num_syms, false, -1);
+		g->skip_left = 1 + gen_rand(g, MAX_SKIP);
+		gen_code(g, op, g->skip);
+		return 1;
+	}
+
+	if (op >= GEN_BRA)
+		op = GEN_LDA;
+
+	line = gen_code(g, op, gen_var(g));
+	line->patchable = GEN_STA != op;
+	return 1;
+}
+
+static uint64_t
+gen_block(struct gen *g, int depth, int budget, uint64_t *inputs)
+{
+	uint64_t steps = 0;
+	int used;
+
+	do
+	{
+		int start = gen_budget(g), r = gen_rand(g, 100);
+
+		if (depth < g->depth && budget > LOOP_COST && r < g->loop_rate)
+		{
+			steps += gen_loop(g, depth,
+				1 + gen_rand(g, budget - LOOP_COST), inputs);
+		}
+		else if (budget >= PATCH_COST
+			&& gen_rand(g, 100) < g->patch_rate)
+		{
+			steps += gen_patch(g);
+		}
+		else
+		{
+			steps += gen_op(g, inputs);
+		}
+
+		used = gen_budget(g) - start;
+		budget -= used;
+	}
+	while (budget > 0);
+
+	return steps;
+}
+
+static int
+gen_addr(const struct gen *g, int sym)
+{
+	const struct gen_sym *s = &g->syms[sym];
+
+	return s->data ? g->num_code + s->index : s->index;
+}
+
+static int
+gen_value(const struct gen *g, const struct gen_line *line)
+{
+	return line->value + (line->sym >= 0 ? gen_addr(g, line->sym) : 0);
+}
+
+static int
+write_line(FILE *out, const struct gen *g, const struct gen_line *line,
+	int addr)
+{
+	const char *label = "";
+	int i;
+
+	for (i = 0; i < g->num_syms; ++i)
+	{
+		if (gen_addr(g, i) != addr)
+			continue;
+
+		if (*label)
+			fprintf(out, "%s\n", label);
+
+		label = g->syms[i].name;
+	}
+
+	fprintf(out, "%-15s %s", label, OP_INFO[line->op].name);
+	if (GEN_DAT == line->op)
+		fprintf(out, " %d", gen_value(g, line));
+	else if (line->sym >= 0)
+		fprintf(out, " %s", g->syms[line->sym].name);
+
+	return fputc('\n', out) == EOF;
+}
+
+static int
+write_source(FILE *out, const struct gen *g, unsigned long seed,
+	uint64_t steps, uint64_t inputs)
+{
+	int i;
+
+	fprintf(out, "// lmgen --seed %lu\n"
+		"// halts within %" PRIu64 " instructions after at most %"
+		PRIu64 " inputs\n", seed, steps, inputs);
+
+	for (i = 0; i < g->num_code; ++i)
+	{
+		if (write_line(out, g, &g->code[i], i))
+			return 1;
+	}
+
+	for (i = 0; i < g->num_data; ++i)
+	{
+		if (write_line(out, g, &g->data[i], g->num_code + i))
+			return 1;
+	}
+
+	return 0;
+}
+
+static int
+write_mailbox(FILE *out, int value)
+{
+	char buf[NUM_DIGITS];
+	int i;
+
+	for (i = NUM_DIGITS - 1; i >= 0; --i)
+	{
+		buf[i] = value % 10;
+		value /= 10;
+	}
+
+	return fwrite(buf, 1, NUM_DIGITS, out) != NUM_DIGITS;
+}
+
+static int
+write_image(FILE *out, const struct gen *g)
+{
+	int i;
+
+	for (i = 0; i < g->num_code; ++i)
+	{
+		if (write_mailbox(out, gen_value(g, &g->code[i])))
+			return 1;
+	}
+
+	for (i = 0; i < g->num_data; ++i)
+	{
+		if (write_mailbox(out, gen_value(g, &g->data[i])))
+			return 1;
+	}
+
+	return 0;
+}
+
+static int
+write_inputs(const char *path, struct gen *g, uint64_t inputs)
+{
+	FILE *out;
+	uint64_t i;
+	int rc = 0;
+
+	out = fopen(path, "w");
+	if (!out)
+	{
+		fprintf(stderr, "Error opening %s: %s\n", path,
+			strerror(errno));
+		return 1;
+	}
+
+	for (i = 0; i < inputs && !rc; ++i)
+		rc = fprintf(out, "%d\n", gen_rand(g, MAX_VALUE + 1)) < 0;
+
+	if (fclose(out) || rc)
+	{
+		fprintf(stderr, "Error writing %s: %s\n", path,
+			strerror(errno));
+		return 1;
+	}
+
+	return 0;
+}
+
+static int
+parse_mix(struct gen *g, const char *s)
+{
+	char name[4];
+	int i, weight, len;
+
+	memset(g->mix, 0, sizeof g->mix);
+
+	while (*s)
+	{
+		if (sscanf(s, "%3[a-z]=%d%n", name, &weight, &len) != 2
+			|| weight < 0)
+		{
+			return 1;
+		}
+
+		for (i = 1; i < GEN_NUM_MIX; ++i)
+		{
+			if (strcmp(name, MIX_NAMES[i]) == 0)
+				break;
+		}
+
+		if (GEN_NUM_MIX == i)
+			return 1;
+
+		g->mix[i] = weight;
+		s += len;
+		if (',' == *s)
+			++s;
+	}
+
+	return 0;
+}
+
+static const char *const USAGE[] =
+{
+	"Usage: lmgen [options]",
+	"  --seed <n>           program to generate (default 1)",
+	"  --size <mailboxes>   at most this many mailboxes (default 100)",
+	"  --depth <n>          loops nest at most this deep (default 2, max 5)",
+	"  --trips <n>          loops run at most this many times (default 10)",
+	"  --loops <percent>    chance of a loop at each line (default 10)",
+	"  --mix <op>=<weight>,...",
+	"                       add, sub, lda, sta, bra, brz and brp weights",
+	"  --self-mod <percent> chance of a self-modifying store (default 5)",
+	"  --io <percent>       chance of INP or OUT (default 5)",
+	"  --vars <n>           scratch variables (default 4)",
+	"  --labels <n>         extra labels naming the variables (default 0)",
+	"  --image              write a memory image instead of source",
+	"  --input <file>       write enough input for every INP",
+	"  -o <file>            write here instead of standard output",
+	NULL
+};
+
+static void
+usage(void)
+{
+	int i;
+
+	for (i = 0; USAGE[i]; ++i)
+		fprintf(stderr, "%s\n", USAGE[i]);
+}
+
+static int
+parse_number(const char *s, unsigned long max, int *value)
+{
+	unsigned long n;
+	char *end;
+
+	errno = 0;
+	n = strtoul(s, &end, 10);
+	if (errno || end == s || *end != '\0' || n > max)
+		return 1;
+
+	*value = (int) n;
+	return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct gen g;
+	FILE *out = stdout;
+	const char *output_path = NULL, *input_path = NULL;
+	unsigned long seed = 1;
+	uint64_t steps, inputs = 0;
+	int i, size = NUM_MAILBOXES, rc = 1;
+	bool image = false, bad = false;
+
+	memset(&g, 0, sizeof g);
+	g.depth = 2;
+	g.max_trips = 10;
+	g.loop_rate = 10;
+	g.patch_rate = 5;
+	g.io_rate = 5;
+	g.num_vars = 4;
+	memcpy(g.mix, DEFAULT_MIX, sizeof g.mix);
+
+	for (i = 1; i < argc && !bad; ++i)
+	{
+		const char *arg = argv[i + 1];
+
+		if (strcmp(argv[i], "--image") == 0)
+		{
+			image = true;
+			continue;
+		}
+
+		if (!arg)
+		{
+			bad = true;
+			break;
+		}
+
+		if (strcmp(argv[i], "--seed") == 0)
+		{
+			char *end;
+
+			seed = strtoul(arg, &end, 10);
+			bad = end == arg || *end != '\0';
+		}
+		else if (strcmp(argv[i], "--size") == 0)
+			bad = parse_number(arg, NUM_MAILBOXES, &size);
+		else if (strcmp(argv[i], "--depth") == 0)
+			bad = parse_number(arg, MAX_DEPTH, &g.depth);
+		else if (strcmp(argv[i], "--trips") == 0)
+			bad = parse_number(arg, MAX_VALUE, &g.max_trips)
+				|| 0 == g.max_trips;
+		else if (strcmp(argv[i], "--loops") == 0)
+			bad = parse_number(arg, 100, &g.loop_rate);
+		else if (strcmp(argv[i], "--mix") == 0)
+			bad = parse_mix(&g, arg);
+		else if (strcmp(argv[i], "--self-mod") == 0)
+			bad = parse_number(arg, 100, &g.patch_rate);
+		else if (strcmp(argv[i], "--io") == 0)
+			bad = parse_number(arg, 100, &g.io_rate);
+		else if (strcmp(argv[i], "--vars") == 0)
+			bad = parse_number(arg, NUM_MAILBOXES, &g.num_vars)
+				|| 0 == g.num_vars;
+		else if (strcmp(argv[i], "--labels") == 0)
+			bad = parse_number(arg, 1000000, &g.num_aliases);
+		else if (strcmp(argv[i], "--input") == 0)
+			input_path = arg;
+		else if (strcmp(argv[i], "-o") == 0)
+			output_path = arg;
+		else
+			bad = true;
+
+		++i;
+	}
+
+	for (i = 0; i < GEN_NUM_MIX; ++i)
+		g.mix_total += g.mix[i];
+
+	if (bad || 0 == g.mix_total)
+	{
+		usage();
+		return 1;
+	}
+
+	/* the HLT, the constant 1, the variables and at least one line */
+	if (size < g.num_vars + 3)
+	{
+		fprintf(stderr, "%d mailboxes is too small for %d variables\n",
+			size, g.num_vars);
+		return 1;
+	}
+
+	g.state = seed;
+	g.skip = -1;
+
+	g.one = gen_data(&g, "one", -1, 1);
+	g.vars = g.num_syms;
+	for (i = 0; i < g.num_vars; ++i)
+		gen_data(&g, "v", i, gen_rand(&g, MAX_VALUE + 1));
+
+	g.aliases = g.num_syms;
+	for (i = 0; i < g.num_aliases; ++i)
+	{
+		gen_sym(&g, "v_alias_", i, true,
+			g.syms[g.vars + i % g.num_vars].index);
+	}
+
+	steps = gen_block(&g, 0, size - gen_budget(&g) - 1, &inputs);
+	gen_flush_skip(&g);
+	gen_code(&g, GEN_HLT, -1);
+	++steps;
+
+	if (output_path)
+	{
+		out = fopen(output_path, image ? "wb" : "w");
+		if (!out)
+		{
+			fprintf(stderr, "Error opening %s: %s\n", output_path,
+				strerror(errno));
+			goto end;
+		}
+	}
+
+	if (image ? write_image(out, &g)
+		: write_source(out, &g, seed, steps, inputs))
+	{
+		fprintf(stderr, "Error writing program: %s\n",
+			strerror(errno));
+		goto end;
+	}
+
+	if (input_path && write_inputs(input_path, &g, inputs))
+		goto end;
+
+	fprintf(stderr, "%d mailboxes, halts within %" PRIu64
+		" instructions after at most %" PRIu64 " inputs\n",
+		gen_budget(&g), steps, inputs);
+	rc = 0;
+
+end:
+	if (out && out != stdout && fclose(out))
+	{
+		fprintf(stderr, "Error writing %s: %s\n", output_path,
+			strerror(errno));
+		rc = 1;
+	}
+
+	free(g.syms);
+	return rc;
+}
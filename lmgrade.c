@@ -0,0 +1,202 @@
+/*
+ * lmgrade.c - Grade a program against test cases
+ * Copyright (C) 2020 David McMackins II
+ *
+ * Redistributions, modified or unmodified, in whole or in part, must retain
+ * applicable copyright or other legal privilege notices, these conditions, and
+ * the following license terms and disclaimer.  Subject to these conditions,
+ * the holder(s) of copyright or other legal privileges, author(s) or
+ * assembler(s), and contributors of this work hereby grant to any person who
+ * obtains a copy of this work in any form:
+ *
+ * 1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ * use, and/or otherwise deal in the licensed material without restriction.
+ *
+ * 2. A perpetual, worldwide, non-exclusive, royalty-free, irrevocable patent
+ * license to reproduce, modify, distribute, publish, sell, use, and/or
+ * otherwise deal in the licensed material without restriction, for any and all
+ * patents:
+ *
+ *     a. Held by each such holder of copyright or other legal privilege,
+ *     author or assembler, or contributor, necessarily infringed by the
+ *     contributions alone or by combination with the work, of that privilege
+ *     holder, author or assembler, or contributor.
+ *
+ *     b. Necessarily infringed by the work at the time that holder of
+ *     copyright or other privilege, author or assembler, or contributor made
+ *     any contribution to the work.
+ *
+ * NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ * LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ * A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ * ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ * ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT, TORT,
+ * OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR THE USE
+ * OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "grade.h"
+#include "lmc.h"
+#include "pool.h"
+
+#define DEFAULT_MAX_STEPS 100000000UL
+#define DEFAULT_ENGINE "predecoded"
+
+struct grade_conf
+{
+	const struct lmc_engine *engine;
+	uint64_t max_steps;
+};
+
+/* runs in its own process; returns 0 if the test passed, 1 if it failed
+   or 2 on error */
+static int
+grade(const struct lmc *image, const struct grade_test *test,
+	const struct grade_conf *conf)
+{
+	struct grade_check check;
+	struct lmc lmc;
+	int32_t *values;
+	unsigned long count;
+	char why[GRADE_WHY_LEN];
+	bool passed;
+
+	lmc = *image;
+	lmc.in = fopen(test->input_path, "r");
+	if (!lmc.in)
+	{
+		fprintf(stderr, "Error opening %s: %s\n", test->input_path,
+			strerror(errno));
+		return 2;
+	}
+
+	values = grade_read_numbers(test->expected_path, false, &count);
+	if (!values)
+	{
+		fclose(lmc.in);
+		return 2;
+	}
+
+	lmc.out = stdout;
+	grade_start(&check, &lmc, values, count, NULL);
+
+	/* the machine's own complaints would only repeat what we report */
+	if (!freopen("/dev/null", "w", stderr))
+		return 2;
+
+	conf->engine->run_for(&lmc, conf->max_steps);
+
+	passed = grade_verdict(&lmc, &check, conf->max_steps, why);
+	printf("%s %s: %s\n", passed ? "ok  " : "FAIL", test->name, why);
+
+	fclose(lmc.in);
+	free(values);
+	return !passed;
+}
+
+static const char *const USAGE[] =
+{
+	"Usage: lmgrade [options] <image> <manifest>",
+	"  -j <jobs>          run this many tests at once",
+	"                     (default: one per CPU)",
+	"  --engine <name>    execution engine (default " DEFAULT_ENGINE ")",
+	"  --max-steps <n>    fail tests that run longer than this",
+	"                     (default 100000000)",
+	"Each manifest line is <name> <input file> <expected output file>,",
+	"with paths relative to the manifest; lines starting with # are",
+	"skipped. Each test stops at its first wrong or extra output.",
+	NULL
+};
+
+struct grade_run
+{
+	const struct lmc *image;
+	const struct grade_test *tests;
+	const struct grade_conf *conf;
+};
+
+static int
+grade_test(int i, void *data)
+{
+	const struct grade_run *run = data;
+
+	return grade(run->image, &run->tests[i], run->conf);
+}
+
+static const char *
+test_name(int i, void *data)
+{
+	const struct grade_run *run = data;
+
+	return run->tests[i].name;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct grade_conf conf;
+	struct grade_run run;
+	struct lmc image;
+	struct grade_test *tests;
+	const char *engine = DEFAULT_ENGINE;
+	unsigned long jobs, max_steps = DEFAULT_MAX_STEPS;
+	struct pool_option options[3];
+	int i, num_tests, rc, failed, graded;
+
+	jobs = pool_default_jobs();
+
+	options[0].name = "-j";
+	options[0].value = &jobs;
+	options[0].zero_ok = false;
+	options[1].name = "--max-steps";
+	options[1].value = &max_steps;
+	options[1].zero_ok = false;
+	options[2].name = NULL;
+
+	i = pool_options(argc, argv, &engine, options, USAGE);
+	if (i < 0)
+		return 2;
+
+	if (argc - i != 2)
+	{
+		pool_usage(USAGE);
+		return 2;
+	}
+
+	conf.engine = lmc_find_engine(engine);
+	conf.max_steps = max_steps;
+	if (!conf.engine || !conf.engine->run_for)
+	{
+		fprintf(stderr, "No such engine: %s\n", engine);
+		return 2;
+	}
+
+	memset(&image, 0, sizeof image);
+	image.quiet = true;
+	if (lmc_load_image(&image, argv[i]) < 0)
+		return 2;
+
+	num_tests = grade_load_manifest(argv[i + 1], &tests);
+	if (num_tests < 0)
+		return 2;
+
+	run.image = &image;
+	run.tests = tests;
+	run.conf = &conf;
+	rc = pool_run(num_tests, jobs, grade_test, test_name, &run, &graded,
+		&failed);
+
+	printf("%d of %d tests passed\n", graded - failed, graded);
+
+	grade_free_tests(tests, num_tests);
+	return rc;
+}
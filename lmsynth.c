@@ -0,0 +1,917 @@
+/*
+ * lmsynth - evolves programs that pass a set of test cases
+ * Copyright (C) 2020 David McMackins II
+ *
+ * Redistributions, modified or unmodified, in whole or in part, must retain
+ * applicable copyright or other legal privilege notices, these conditions, and
+ * the following license terms and disclaimer.  Subject to these conditions,
+ * the holder(s) of copyright or other legal privileges, author(s) or
+ * assembler(s), and contributors of this work hereby grant to any person who
+ * obtains a copy of this work in any form:
+ *
+ * 1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ * use, and/or otherwise deal in the licensed material without restriction.
+ *
+ * 2. A perpetual, worldwide, non-exclusive, royalty-free, irrevocable patent
+ * license to reproduce, modify, distribute, publish, sell, use, and/or
+ * otherwise deal in the licensed material without restriction, for any and all
+ * patents:
+ *
+ *     a. Held by each such holder of copyright or other legal privilege,
+ *     author or assembler, or contributor, necessarily infringed by the
+ *     contributions alone or by combination with the work, of that privilege
+ *     holder, author or assembler, or contributor.
+ *
+ *     b. Necessarily infringed by the work at the time that holder of
+ *     copyright or other privilege, author or assembler, or contributor made
+ *     any contribution to the work.
+ *
+ * NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ * LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ * A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ * ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ * ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT, TORT,
+ * OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR THE USE
+ * OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "grade.h"
+#include "lmc.h"
+
+#define DEFAULT_SIZE 20
+#define DEFAULT_POPULATION 2000
+#define DEFAULT_GENERATIONS 2000
+#define DEFAULT_MAX_STEPS 1000
+#define TOURNAMENT 4
+#define ELITES 2
+#define CROSSOVER_PCT 90
+
+#define OP(CODE, ADDR) ((CODE) * NUM_MAILBOXES + (ADDR))
+
+/* what a test costs a candidate beyond the instructions it ran; a program
+   passes when all of these are zero */
+#define COST_OUTPUT 1024 /* per expected output not produced correctly */
+#define COST_EXTRA 512 /* printed more than expected */
+#define COST_UNFINISHED 256 /* didn't halt cleanly */
+
+/* candidates are evaluated a few thousand at a time, so the smallest word
+   that holds a mailbox keeps more of them in cache */
+#if MAX_VALUE <= SHRT_MAX
+typedef short synth_word;
+#else
+typedef int synth_word;
+#endif
+
+struct test
+{
+	char *name;
+	char *input_path;
+	int32_t *inputs;
+	int num_inputs;
+	int32_t *outputs;
+	int num_outputs;
+};
+
+struct synth
+{
+	const struct test *tests;
+	int num_tests;
+	int size; /* mailboxes per candidate; the rest are zero */
+	int population;
+	uint64_t max_steps;
+
+	synth_word *genomes; /* population * size */
+	uint64_t *fitness; /* cost in the high 32 bits, steps in the low */
+
+	pthread_barrier_t start, finish;
+	bool done;
+};
+
+struct worker
+{
+	struct synth *synth;
+	pthread_t thread;
+	int first;
+	int last;
+	uint64_t runs;
+	synth_word *mem; /* NUM_MAILBOXES, for run_test to work in */
+};
+
+/* splitmix64, as in lmgen */
+static uint64_t
+next_rand(uint64_t *state)
+{
+	uint64_t z;
+
+	*state += UINT64_C(0x9e3779b97f4a7c15);
+	z = *state;
+	z = (z ^ (z >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+	z = (z ^ (z >> 27)) * UINT64_C(0x94d049bb133111eb);
+	return z ^ (z >> 31);
+}
+
+/*
+ * Runs one candidate against one test with the same semantics as
+ * lmc_step, but with input and expected output in arrays and a stop at the
+ * first wrong output, as lmgrade does. Returns the test's cost and adds the
+ * instructions run to *steps. mem is NUM_MAILBOXES of scratch, allocated
+ * once by the caller since this runs millions of times a second.
+ */
+static uint64_t
+run_test(const synth_word *genome, int size, const struct test *test,
+	uint64_t max_steps, synth_word *mem, uint64_t *steps)
+{
+	uint64_t n;
+	int a = 0, pc = 0, in = 0, out = 0, distance;
+	bool neg = false;
+
+	memcpy(mem, genome, size * sizeof *mem);
+	memset(mem + size, 0, (NUM_MAILBOXES - size) * sizeof *mem);
+
+	for (n = 0; n < max_steps; ++n)
+	{
+		int instruction = mem[pc], addr = instruction % NUM_MAILBOXES;
+
+		pc = (pc + 1) % NUM_MAILBOXES;
+		switch (instruction / NUM_MAILBOXES)
+		{
+		case 0:
+			*steps += n + 1;
+			return (uint64_t) (test->num_outputs - out)
+				* COST_OUTPUT;
+
+		case 1:
+			a += mem[addr];
+			neg = a > MAX_VALUE;
+			if (neg)
+				a -= MAX_VALUE + 1;
+			break;
+
+		case 2:
+			a -= mem[addr];
+			neg = a < 0;
+			if (neg)
+				a += MAX_VALUE + 1;
+			break;
+
+		case 3:
+			mem[addr] = a;
+			break;
+
+		case 5:
+			a = mem[addr];
+			break;
+
+		case 6:
+			pc = addr;
+			break;
+
+		case 7:
+			if (0 == a)
+				pc = addr;
+			break;
+
+		case 8:
+			if (!neg)
+				pc = addr;
+			break;
+
+		case 9:
+			if (1 == addr && in < test->num_inputs)
+			{
+				a = test->inputs[in++];
+				break;
+			}
+
+			if (2 == addr && out < test->num_outputs
+				&& a == test->outputs[out])
+			{
+				++out;
+				break;
+			}
+
+			*steps += n + 1;
+			if (2 == addr && out == test->num_outputs)
+				return COST_EXTRA + COST_UNFINISHED;
+
+			if (2 == addr)
+			{
+				distance = a - test->outputs[out];
+				return (uint64_t) (test->num_outputs - out)
+					* COST_OUTPUT + COST_UNFINISHED
+					+ (distance < 0 ? -distance : distance)
+					* (COST_UNFINISHED - 1) / (MAX_VALUE + 1);
+			}
+
+			/* out of input, or a bad 9xx */
+			return (uint64_t) (test->num_outputs - out)
+				* COST_OUTPUT + COST_UNFINISHED;
+
+		default:
+			*steps += n + 1;
+			return (uint64_t) (test->num_outputs - out)
+				* COST_OUTPUT + COST_UNFINISHED;
+		}
+	}
+
+	*steps += n;
+	return (uint64_t) (test->num_outputs - out) * COST_OUTPUT
+		+ COST_UNFINISHED;
+}
+
+static uint64_t
+evaluate(const struct synth *s, const synth_word *genome, synth_word *mem,
+	uint64_t *runs)
+{
+	uint64_t cost = 0, steps = 0;
+	int i;
+
+	for (i = 0; i < s->num_tests; ++i)
+		cost += run_test(genome, s->size, &s->tests[i], s->max_steps,
+			mem, &steps);
+
+	*runs += s->num_tests;
+	if (cost > UINT32_MAX)
+		cost = UINT32_MAX;
+
+	if (steps > UINT32_MAX)
+		steps = UINT32_MAX;
+
+	return cost << 32 | steps;
+}
+
+static void
+evaluate_slice(struct worker *w)
+{
+	struct synth *s = w->synth;
+	int i;
+
+	for (i = w->first; i < w->last; ++i)
+		s->fitness[i] = evaluate(s, &s->genomes[(size_t) i * s->size],
+			w->mem, &w->runs);
+}
+
+static void *
+work(void *arg)
+{
+	struct worker *w = arg;
+
+	for (;;)
+	{
+		pthread_barrier_wait(&w->synth->start);
+		if (w->synth->done)
+			return NULL;
+
+		evaluate_slice(w);
+		pthread_barrier_wait(&w->synth->finish);
+	}
+}
+
+static int
+random_word(uint64_t *state, int size)
+{
+	static const int CODES[16] =
+	{
+		0, 1, 1, 2, 3, 3, 5, 5, 6, 7, 8, 9, 9, 9, 9, -1
+	};
+	uint64_t r = next_rand(state);
+	int code = CODES[r % 16], addr = (int) (r / 16 % size);
+
+	switch (code)
+	{
+	case -1: /* a constant */
+		return (int) (r / 16 % (MAX_VALUE + 1));
+
+	case 0:
+		return 0;
+
+	case 9:
+		return OP(9, 1 + (int) (r / 16 % 2));
+
+	default:
+		return OP(code, addr);
+	}
+}
+
+static void
+mutate(synth_word *genome, int size, uint64_t *state)
+{
+	uint64_t r = next_rand(state);
+	int i = (int) (r % size), j, opcode = genome[i] / NUM_MAILBOXES;
+	synth_word temp;
+
+	switch (r / size % 8)
+	{
+	case 0: /* swap two mailboxes */
+		j = (int) (r / size / 8 % size);
+		temp = genome[i];
+		genome[i] = genome[j];
+		genome[j] = temp;
+		break;
+
+	case 1:
+	case 2: /* point an instruction somewhere else */
+		if (opcode >= 1 && opcode <= 8)
+		{
+			genome[i] = OP(opcode, (int) (r / size / 8 % size));
+			break;
+		}
+
+		/* FALLS THROUGH! */
+
+	default:
+		genome[i] = random_word(state, size);
+		break;
+	}
+}
+
+static int
+tournament(const struct synth *s, uint64_t *state)
+{
+	int i, best = -1;
+
+	for (i = 0; i < TOURNAMENT; ++i)
+	{
+		int j = (int) (next_rand(state) % s->population);
+
+		if (best < 0 || s->fitness[j] < s->fitness[best])
+			best = j;
+	}
+
+	return best;
+}
+
+/* fills next with the elites of the current generation and children bred
+   from it */
+static void
+breed(const struct synth *s, synth_word *next, uint64_t *state)
+{
+	size_t size = s->size;
+	int elites[ELITES], i, j;
+
+	for (i = 0; i < ELITES; ++i)
+	{
+		elites[i] = -1;
+		for (j = 0; j < s->population; ++j)
+		{
+			if ((i > 0 && j == elites[0])
+				|| (elites[i] >= 0
+					&& s->fitness[j] >= s->fitness[elites[i]]))
+			{
+				continue;
+			}
+
+			elites[i] = j;
+		}
+
+		memcpy(&next[i * size], &s->genomes[elites[i] * size],
+			size * sizeof *next);
+	}
+
+	for (i = ELITES; i < s->population; ++i)
+	{
+		synth_word *child = &next[i * size];
+		const synth_word *p1, *p2;
+		int mutations = 1;
+
+		p1 = &s->genomes[tournament(s, state) * size];
+		memcpy(child, p1, size * sizeof *child);
+
+		/* two-point crossover; addresses are absolute, so mailboxes
+		   only ever trade with the same mailbox of the other parent */
+		if ((int) (next_rand(state) % 100) < CROSSOVER_PCT)
+		{
+			size_t a = next_rand(state) % size;
+			size_t b = next_rand(state) % size;
+
+			if (a > b)
+			{
+				size_t temp = a;
+				a = b;
+				b = temp;
+			}
+
+			p2 = &s->genomes[tournament(s, state) * size];
+			memcpy(&child[a], &p2[a], (b - a + 1) * sizeof *child);
+			mutations = (int) (next_rand(state) % 2);
+		}
+
+		while (next_rand(state) % 3 == 0)
+			++mutations;
+
+		for (j = 0; j < mutations; ++j)
+			mutate(child, (int) size, state);
+	}
+}
+
+static int
+count_passing(const struct synth *s, const synth_word *genome,
+	synth_word *mem)
+{
+	uint64_t steps = 0;
+	int i, passing = 0;
+
+	for (i = 0; i < s->num_tests; ++i)
+	{
+		if (!run_test(genome, s->size, &s->tests[i], s->max_steps,
+				mem, &steps))
+		{
+			++passing;
+		}
+	}
+
+	return passing;
+}
+
+/* what the reference interpreter printed, checked as it prints */
+struct reference_output
+{
+	const struct test *test;
+	int pos;
+	bool wrong;
+};
+
+static void
+check_output(struct lmc *lmc, int value)
+{
+	struct reference_output *ref = lmc->output_data;
+
+	if (ref->pos == ref->test->num_outputs
+		|| value != ref->test->outputs[ref->pos])
+	{
+		ref->wrong = true;
+		lmc->cpu.halted = true;
+		return;
+	}
+
+	++ref->pos;
+}
+
+/* runs a program the search says passes on the loop engine, reading the
+   test inputs the way lmc would */
+static bool
+confirm(const struct synth *s, const synth_word *genome)
+{
+	int i, j;
+
+	for (i = 0; i < s->num_tests; ++i)
+	{
+		struct reference_output ref;
+		struct lmc lmc;
+
+		memset(&lmc, 0, sizeof lmc);
+		for (j = 0; j < s->size; ++j)
+			lmc.mailboxes[j] = genome[j];
+
+		lmc.quiet = true;
+		lmc.output = check_output;
+		lmc.output_data = &ref;
+		ref.test = &s->tests[i];
+		ref.pos = 0;
+		ref.wrong = false;
+
+		lmc.in = fopen(s->tests[i].input_path, "r");
+		if (!lmc.in)
+		{
+			fprintf(stderr, "Error opening %s: %s\n",
+				s->tests[i].input_path, strerror(errno));
+			return false;
+		}
+
+		lmc_run_for(&lmc, s->max_steps);
+		fclose(lmc.in);
+
+		if (ref.wrong || !lmc.cpu.halted || lmc.cpu.error
+			|| ref.pos != ref.test->num_outputs)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/* prints the program as lmasm source, leaving out the zeroes at the end */
+static void
+print_source(FILE *out, const synth_word *genome, int size)
+{
+	int i, last = size - 1;
+
+	while (last >= 0 && 0 == genome[last])
+		--last;
+
+	for (i = 0; i <= last; ++i)
+	{
+		int opcode = genome[i] / NUM_MAILBOXES;
+		int addr = genome[i] % NUM_MAILBOXES;
+		const char *name = lmc_mnemonic(genome[i]);
+
+		if (0 == genome[i] || 9 == opcode)
+			fprintf(out, "\t%s", name);
+		else if (opcode && name)
+			fprintf(out, "\t%s %d", name, addr);
+		else
+			fprintf(out, "\tDAT %d", genome[i]);
+
+		fprintf(out, "\t// %d\n", i);
+	}
+}
+
+static int
+write_image(const char *path, const synth_word *genome, int size)
+{
+	FILE *f;
+	int i, j;
+
+	f = fopen(path, "wb");
+	if (!f)
+	{
+		fprintf(stderr, "Error opening %s: %s\n", path,
+			strerror(errno));
+		return 1;
+	}
+
+	for (i = 0; i < size; ++i)
+	{
+		int value = genome[i], digits[NUM_DIGITS];
+
+		for (j = NUM_DIGITS - 1; j >= 0; --j)
+		{
+			digits[j] = value % 10;
+			value /= 10;
+		}
+
+		for (j = 0; j < NUM_DIGITS; ++j)
+			fputc(digits[j], f);
+	}
+
+	if (fclose(f))
+	{
+		fprintf(stderr, "Error writing %s: %s\n", path,
+			strerror(errno));
+		return 1;
+	}
+
+	return 0;
+}
+
+static void
+free_tests(struct test *tests, int num_tests)
+{
+	int i;
+
+	for (i = 0; i < num_tests; ++i)
+	{
+		free(tests[i].name);
+		free(tests[i].input_path);
+		free(tests[i].inputs);
+		free(tests[i].outputs);
+	}
+
+	free(tests);
+}
+
+/* reads an lmgrade manifest and the numbers of its tests; returns the
+   number of tests or -1 on error */
+static int
+load_manifest(const char *path, struct test **tests_out)
+{
+	struct grade_test *lines;
+	struct test *tests;
+	unsigned long count;
+	int i, num_tests;
+
+	num_tests = grade_load_manifest(path, &lines);
+	if (num_tests < 0)
+		return -1;
+
+	tests = calloc(num_tests ? num_tests : 1, sizeof *tests);
+	if (!tests)
+	{
+		fprintf(stderr, "Out of memory\n");
+		grade_free_tests(lines, num_tests);
+		return -1;
+	}
+
+	/* the tests take the names and input paths */
+	for (i = 0; i < num_tests; ++i)
+	{
+		tests[i].name = lines[i].name;
+		tests[i].input_path = lines[i].input_path;
+		lines[i].name = NULL;
+		lines[i].input_path = NULL;
+	}
+
+	for (i = 0; i < num_tests; ++i)
+	{
+		tests[i].inputs = grade_read_numbers(tests[i].input_path, true,
+			&count);
+		tests[i].num_inputs = count;
+		if (!tests[i].inputs)
+			break;
+
+		tests[i].outputs = grade_read_numbers(lines[i].expected_path,
+			false, &count);
+		tests[i].num_outputs = count;
+		if (!tests[i].outputs)
+			break;
+	}
+
+	grade_free_tests(lines, num_tests);
+	if (i < num_tests)
+	{
+		free_tests(tests, num_tests);
+		return -1;
+	}
+
+	*tests_out = tests;
+	return num_tests;
+}
+
+static const char *const USAGE[] =
+{
+	"Usage: lmsynth [options] <manifest>",
+	"  -j <threads>         evaluate with this many threads",
+	"                       (default: one per CPU)",
+	"  --size <mailboxes>   length of a program (default 20)",
+	"  --population <n>     programs per generation (default 2000)",
+	"  --generations <n>    how long to search (default 2000)",
+	"  --max-steps <n>      instructions a test may take (default 1000)",
+	"  --seed <n>           seed for the search (default 1)",
+	"  --first              stop at the first program that passes",
+	"  -o <image>           write the best program as an image",
+	"The manifest is the same as lmgrade's. Once a program passes, the",
+	"search keeps going for ones that run fewer instructions.",
+	NULL
+};
+
+static void
+usage(void)
+{
+	int i;
+
+	for (i = 0; USAGE[i]; ++i)
+		fprintf(stderr, "%s\n", USAGE[i]);
+}
+
+static int
+parse_number(const char *s, unsigned long *value)
+{
+	char *end;
+
+	errno = 0;
+	*value = strtoul(s, &end, 10);
+	return errno || end == s || *end != '\0';
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct synth s;
+	struct worker *workers = NULL;
+	struct test *tests = NULL;
+	synth_word *next = NULL, *best = NULL, *temp;
+	const char *image_path = NULL;
+	unsigned long value, threads, generations = DEFAULT_GENERATIONS;
+	unsigned long generation, seed = 1;
+	uint64_t state, best_fitness = UINT64_MAX, runs = 0;
+	bool first = false, started = false;
+	double start;
+	long cpus;
+	int i, j, num_tests, rc = 2, passing = 0, num_workers = 0;
+
+	memset(&s, 0, sizeof s);
+	s.size = DEFAULT_SIZE;
+	s.population = DEFAULT_POPULATION;
+	s.max_steps = DEFAULT_MAX_STEPS;
+
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	threads = cpus > 0 ? (unsigned long) cpus : 1;
+
+	for (i = 1; i < argc && '-' == argv[i][0]; ++i)
+	{
+		if (strcmp(argv[i], "--first") == 0)
+		{
+			first = true;
+			continue;
+		}
+
+		if (i + 1 == argc)
+		{
+			usage();
+			return 2;
+		}
+
+		if (strcmp(argv[i], "-o") == 0)
+		{
+			image_path = argv[++i];
+			continue;
+		}
+
+		if (parse_number(argv[i + 1], &value))
+		{
+			usage();
+			return 2;
+		}
+
+		if (strcmp(argv[i], "-j") == 0 && value > 0 && value <= 1024)
+			threads = value;
+		else if (strcmp(argv[i], "--size") == 0 && value > 0
+			&& value <= NUM_MAILBOXES)
+		{
+			s.size = (int) value;
+		}
+		else if (strcmp(argv[i], "--population") == 0
+			&& value > ELITES && value <= INT_MAX / NUM_MAILBOXES)
+		{
+			s.population = (int) value;
+		}
+		else if (strcmp(argv[i], "--generations") == 0 && value > 0)
+			generations = value;
+		else if (strcmp(argv[i], "--max-steps") == 0 && value > 0)
+			s.max_steps = value;
+		else if (strcmp(argv[i], "--seed") == 0)
+			seed = value;
+		else
+		{
+			usage();
+			return 2;
+		}
+
+		++i;
+	}
+
+	if (i + 1 != argc)
+	{
+		usage();
+		return 2;
+	}
+
+	num_tests = load_manifest(argv[i], &tests);
+	if (num_tests < 0)
+		return 2;
+
+	if (0 == num_tests)
+	{
+		fprintf(stderr, "%s has no tests\n", argv[i]);
+		goto end;
+	}
+
+	s.tests = tests;
+	s.num_tests = num_tests;
+	s.genomes = malloc((size_t) s.population * s.size * sizeof *s.genomes);
+	s.fitness = malloc(s.population * sizeof *s.fitness);
+	next = malloc((size_t) s.population * s.size * sizeof *next);
+	best = malloc(s.size * sizeof *best);
+	if ((unsigned long) s.population < threads)
+		threads = s.population;
+
+	workers = calloc(threads, sizeof *workers);
+	if (!s.genomes || !s.fitness || !next || !best || !workers)
+	{
+		fprintf(stderr, "Out of memory\n");
+		goto end;
+	}
+
+	for (j = 0; j < (int) threads; ++j)
+	{
+		workers[j].mem = malloc(NUM_MAILBOXES * sizeof *workers[j].mem);
+		if (!workers[j].mem)
+		{
+			fprintf(stderr, "Out of memory\n");
+			goto end;
+		}
+	}
+
+	state = seed;
+	for (j = 0; j < s.population * s.size; ++j)
+		s.genomes[j] = random_word(&state, s.size);
+
+	/* the main thread evaluates the first slice itself */
+	if (pthread_barrier_init(&s.start, NULL, threads)
+		|| pthread_barrier_init(&s.finish, NULL, threads))
+	{
+		fprintf(stderr, "Error starting threads\n");
+		goto end;
+	}
+
+	started = true;
+	for (j = 0; j < (int) threads; ++j)
+	{
+		workers[j].synth = &s;
+		workers[j].first = (int) (s.population * (uint64_t) j / threads);
+		workers[j].last = (int) (s.population * (uint64_t) (j + 1)
+			/ threads);
+
+		if (j > 0 && pthread_create(&workers[j].thread, NULL, work,
+				&workers[j]))
+		{
+			fprintf(stderr, "Error starting threads\n");
+			goto end;
+		}
+
+		num_workers = j + 1;
+	}
+
+	start = now();
+	for (generation = 0; generation < generations; ++generation)
+	{
+		pthread_barrier_wait(&s.start);
+		evaluate_slice(&workers[0]);
+		pthread_barrier_wait(&s.finish);
+
+		for (i = -1, j = 0; j < s.population; ++j)
+		{
+			if (s.fitness[j] < best_fitness)
+			{
+				best_fitness = s.fitness[j];
+				i = j;
+			}
+		}
+
+		if (i >= 0)
+		{
+			memcpy(best, &s.genomes[(size_t) i * s.size],
+				s.size * sizeof *best);
+			/* the other workers are parked at the barrier, and
+			   worker 0's scratch is the main thread's own */
+			passing = count_passing(&s, best, workers[0].mem);
+			printf("generation %lu: %d of %d tests pass, "
+				"%" PRIu64 " instructions\n", generation,
+				passing, num_tests, best_fitness & UINT32_MAX);
+		}
+
+		if (first && passing == num_tests)
+			break;
+
+		breed(&s, next, &state);
+		temp = s.genomes;
+		s.genomes = next;
+		next = temp;
+	}
+
+	for (j = 0; j < num_workers; ++j)
+		runs += workers[j].runs;
+
+	printf("%" PRIu64 " test runs in %.2f s, %.0f per second\n", runs,
+		now() - start, runs / (now() - start));
+
+	print_source(stdout, best, s.size);
+	rc = passing == num_tests ? 0 : 1;
+
+	if (0 == rc && !confirm(&s, best))
+	{
+		fprintf(stderr, "The reference interpreter disagrees\n");
+		rc = 2;
+	}
+
+	if (image_path && write_image(image_path, best, s.size))
+		rc = 2;
+
+end:
+	/* wake the workers one last time, to leave; if some never started,
+	   the rest can't be woken and go when the process does */
+	if (started && (int) threads == num_workers)
+	{
+		s.done = true;
+		pthread_barrier_wait(&s.start);
+		for (j = 1; j < num_workers; ++j)
+			pthread_join(workers[j].thread, NULL);
+
+		pthread_barrier_destroy(&s.start);
+		pthread_barrier_destroy(&s.finish);
+	}
+
+	for (j = 0; workers && j < (int) threads; ++j)
+		free(workers[j].mem);
+
+	free(workers);
+	free(best);
+	free(next);
+	free(s.genomes);
+	free(s.fitness);
+	free_tests(tests, num_tests);
+	return rc;
+}
@@ -0,0 +1,543 @@
+/*
+ * lmtrace - Little Man Computer trace decoder
+ * Copyright (C) 2020 David McMackins II
+ *
+ * Redistributions, modified or unmodified, in whole or in part, must retain
+ * applicable copyright or other legal privilege notices, these conditions, and
+ * the following license terms and disclaimer.  Subject to these conditions,
+ * the holder(s) of copyright or other legal privileges, author(s) or
+ * assembler(s), and contributors of this work hereby grant to any person who
+ * obtains a copy of this work in any form:
+ *
+ * 1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ * use, and/or otherwise deal in the licensed material without restriction.
+ *
+ * 2. A perpetual, worldwide, non-exclusive, royalty-free, irrevocable patent
+ * license to reproduce, modify, distribute, publish, sell, use, and/or
+ * otherwise deal in the licensed material without restriction, for any and all
+ * patents:
+ *
+ *     a. Held by each such holder of copyright or other legal privilege,
+ *     author or assembler, or contributor, necessarily infringed by the
+ *     contributions alone or by combination with the work, of that privilege
+ *     holder, author or assembler, or contributor.
+ *
+ *     b. Necessarily infringed by the work at the time that holder of
+ *     copyright or other privilege, author or assembler, or contributor made
+ *     any contribution to the work.
+ *
+ * NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ * LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ * A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ * ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ * ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT, TORT,
+ * OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR THE USE
+ * OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef WITH_ZLIB
+# include <zlib.h>
+#endif
+
+#include "lmc.h"
+#include "trace.h"
+
+struct trace_reader
+{
+#ifdef WITH_ZLIB
+	gzFile file;
+#else
+	FILE *file;
+#endif
+	const char *path;
+	int mailboxes[NUM_MAILBOXES];
+	int prev_pc;
+	int a;
+	uint64_t steps;
+	bool ended;
+	bool error; /* the traced machine stopped on an error */
+};
+
+struct trace_step
+{
+	uint64_t n;
+	int pc;
+	int instruction;
+	int a;
+	bool neg;
+	int write; /* mailbox written, or -1 */
+	bool input;
+	bool output;
+};
+
+struct trace_filter
+{
+	uint64_t from;
+	uint64_t to;
+	int pc;
+	int mailbox;
+	bool io;
+};
+
+static int
+reader_getc(struct trace_reader *reader)
+{
+#ifdef WITH_ZLIB
+	return gzgetc(reader->file);
+#else
+	return getc(reader->file);
+#endif
+}
+
+static int
+get_varint(struct trace_reader *reader, unsigned long *value)
+{
+	int c, shift = 0;
+
+	*value = 0;
+	do
+	{
+		c = reader_getc(reader);
+		if (EOF == c || shift > 56)
+		{
+			fprintf(stderr, "%s: truncated trace\n", reader->path);
+			return 1;
+		}
+
+		*value |= (unsigned long) (c & 0x7f) << shift;
+		shift += 7;
+	}
+	while (c & 0x80);
+
+	return 0;
+}
+
+static int
+get_int(struct trace_reader *reader, int *value, int max)
+{
+	unsigned long temp;
+
+	if (get_varint(reader, &temp))
+		return 1;
+
+	if (temp > (unsigned long) max)
+	{
+		fprintf(stderr, "%s: value %lu out of range\n", reader->path,
+			temp);
+		return 1;
+	}
+
+	*value = temp;
+	return 0;
+}
+
+static void
+reader_close(struct trace_reader *reader)
+{
+	if (!reader->file)
+		return;
+
+#ifdef WITH_ZLIB
+	gzclose(reader->file);
+#else
+	fclose(reader->file);
+#endif
+	reader->file = NULL;
+}
+
+static int
+reader_open(struct trace_reader *reader, const char *path)
+{
+	char magic[TRACE_MAGIC_LEN];
+	int i, c, version, num_mailboxes, pc;
+
+	memset(reader, 0, sizeof *reader);
+	reader->path = path;
+
+#ifdef WITH_ZLIB
+	reader->file = gzopen(path, "rb");
+#else
+	reader->file = fopen(path, "rb");
+#endif
+	if (!reader->file)
+	{
+		fprintf(stderr, "Error opening %s: %s\n", path,
+			strerror(errno));
+		return 1;
+	}
+
+	for (i = 0; i < TRACE_MAGIC_LEN; ++i)
+	{
+		if ((c = reader_getc(reader)) == EOF)
+			break;
+
+		magic[i] = c;
+	}
+
+	if (i < TRACE_MAGIC_LEN || memcmp(magic, TRACE_MAGIC, i) != 0)
+	{
+		fprintf(stderr, "%s is not an lmc trace\n", path);
+		goto fail;
+	}
+
+	if (get_int(reader, &version, TRACE_VERSION)
+		|| get_int(reader, &num_mailboxes, NUM_MAILBOXES)
+		|| get_int(reader, &pc, NUM_MAILBOXES - 1))
+	{
+		goto fail;
+	}
+
+	if (version != TRACE_VERSION || num_mailboxes != NUM_MAILBOXES)
+	{
+		fprintf(stderr, "%s: unsupported trace version or size\n",
+			path);
+		goto fail;
+	}
+
+	for (i = 0; i < NUM_MAILBOXES; ++i)
+	{
+		if (get_int(reader, &reader->mailboxes[i], MAX_VALUE))
+			goto fail;
+	}
+
+	reader->prev_pc = pc - 1;
+	return 0;
+
+fail:
+	reader_close(reader);
+	return 1;
+}
+
+/* returns 1 if a step was read, 0 at the end of the trace, -1 on error */
+static int
+reader_next(struct trace_reader *reader, struct trace_step *step)
+{
+	unsigned long delta;
+	int flags, error;
+
+	if (reader->ended)
+		return 0;
+
+	flags = reader_getc(reader);
+	if (EOF == flags)
+	{
+		fprintf(stderr, "%s: truncated trace\n", reader->path);
+		return -1;
+	}
+
+	if (flags & TRACE_END)
+	{
+		if (get_int(reader, &error, 1))
+			return -1;
+
+		reader->ended = true;
+		reader->error = error;
+		return 0;
+	}
+
+	step->n = reader->steps++;
+	step->pc = reader->prev_pc + 1;
+	if (step->pc == NUM_MAILBOXES)
+		step->pc = 0;
+
+	if ((flags & TRACE_JUMP)
+		&& get_int(reader, &step->pc, NUM_MAILBOXES - 1))
+	{
+		return -1;
+	}
+
+	step->instruction = reader->mailboxes[step->pc];
+
+	if (flags & TRACE_ACC)
+	{
+		if (get_varint(reader, &delta))
+			return -1;
+
+		if (delta & 1)
+			reader->a -= (delta + 1) / 2;
+		else
+			reader->a += delta / 2;
+	}
+
+	step->a = reader->a;
+	step->neg = flags & TRACE_NEG;
+	step->write = -1;
+	if (flags & TRACE_WRITE)
+	{
+		if (get_int(reader, &step->write, NUM_MAILBOXES - 1))
+			return -1;
+
+		reader->mailboxes[step->write] = reader->a;
+	}
+
+	step->input = flags & TRACE_INPUT;
+	step->output = flags & TRACE_OUTPUT;
+
+	reader->prev_pc = step->pc;
+	return 1;
+}
+
+static bool
+filter_match(const struct trace_filter *filter, const struct trace_step *step)
+{
+	if (step->n < filter->from || step->n > filter->to)
+		return false;
+
+	if (filter->pc != -1 && step->pc != filter->pc)
+		return false;
+
+	if (filter->mailbox != -1 && step->write != filter->mailbox)
+		return false;
+
+	if (filter->io && !step->input && !step->output)
+		return false;
+
+	return true;
+}
+
+static void
+print_step(FILE *out, const struct trace_step *step)
+{
+	const char *name = lmc_mnemonic(step->instruction);
+	int opcode = step->instruction / NUM_MAILBOXES;
+
+	fprintf(out, "%10" PRIu64 "  %2d  ", step->n, step->pc);
+	if (!name)
+		fprintf(out, "%0*d    ", NUM_DIGITS, step->instruction);
+	else if (0 == opcode || 9 == opcode)
+		fprintf(out, "%s    ", name);
+	else
+		fprintf(out, "%s %2d ", name, step->instruction % NUM_MAILBOXES);
+
+	fprintf(out, "a=%-4d neg=%d", step->a, !!step->neg);
+
+	if (step->write != -1)
+		fprintf(out, "  [%d]=%d", step->write, step->a);
+
+	if (step->input)
+		fprintf(out, "  in=%d", step->a);
+
+	if (step->output)
+		fprintf(out, "  out=%d", step->a);
+
+	fputc('\n', out);
+}
+
+static int
+dump(const char *path, const struct trace_filter *filter)
+{
+	struct trace_reader reader;
+	struct trace_step step;
+	int rc;
+
+	if (reader_open(&reader, path))
+		return 1;
+
+	while ((rc = reader_next(&reader, &step)) == 1)
+	{
+		if (step.n > filter->to)
+			break;
+
+		if (filter_match(filter, &step))
+			print_step(stdout, &step);
+	}
+
+	if (reader.ended)
+	{
+		printf("end after %" PRIu64 " steps%s\n", reader.steps,
+			reader.error ? " (error)" : "");
+	}
+
+	reader_close(&reader);
+	return rc < 0;
+}
+
+static bool
+step_equal(const struct trace_step *x, const struct trace_step *y)
+{
+	return x->pc == y->pc && x->instruction == y->instruction
+		&& x->a == y->a && x->neg == y->neg && x->write == y->write
+		&& x->input == y->input && x->output == y->output;
+}
+
+/* returns 0 if the traces are identical, 1 if they diverge, 2 on error */
+static int
+diff(const char *path_a, const char *path_b)
+{
+	struct trace_reader a, b;
+	struct trace_step step_a, step_b;
+	int rc_a, rc_b, rc = 0;
+
+	if (reader_open(&a, path_a))
+		return 2;
+
+	if (reader_open(&b, path_b))
+	{
+		reader_close(&a);
+		return 2;
+	}
+
+	if (memcmp(a.mailboxes, b.mailboxes, sizeof a.mailboxes) != 0)
+	{
+		printf("Traces start from different images\n");
+		rc = 1;
+		goto end;
+	}
+
+	for (;;)
+	{
+		rc_a = reader_next(&a, &step_a);
+		rc_b = reader_next(&b, &step_b);
+
+		if (rc_a < 0 || rc_b < 0)
+		{
+			rc = 2;
+			break;
+		}
+
+		if (0 == rc_a || 0 == rc_b)
+		{
+			if (rc_a != rc_b)
+			{
+				const char *longer = rc_a ? path_a : path_b;
+
+				printf("%s continues after step %" PRIu64 ":\n",
+					longer, rc_a ? a.steps - 1 : b.steps - 1);
+				print_step(stdout, rc_a ? &step_a : &step_b);
+				rc = 1;
+			}
+			else if (a.error != b.error)
+			{
+				printf("Traces end differently: %s, %s\n",
+					a.error ? "error" : "halt",
+					b.error ? "error" : "halt");
+				rc = 1;
+			}
+
+			break;
+		}
+
+		if (!step_equal(&step_a, &step_b))
+		{
+			printf("First divergence at step %" PRIu64 ":\n",
+				step_a.n);
+			printf("%s:\n", path_a);
+			print_step(stdout, &step_a);
+			printf("%s:\n", path_b);
+			print_step(stdout, &step_b);
+			rc = 1;
+			break;
+		}
+	}
+
+	if (0 == rc)
+		printf("Traces are identical (%" PRIu64 " steps)\n", a.steps);
+
+end:
+	reader_close(&a);
+	reader_close(&b);
+	return rc;
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr,
+		"Usage: lmtrace dump [filters] <trace>\n"
+		"       lmtrace diff <trace> <trace>\n"
+		"Filters:\n"
+		"  --from <step>     skip steps before this one\n"
+		"  --to <step>       stop after this step\n"
+		"  --pc <mailbox>    only instructions executed at mailbox\n"
+		"  --write <mailbox> only stores to mailbox\n"
+		"  --io              only INP and OUT\n");
+}
+
+static int
+parse_number(const char *s, unsigned long *value)
+{
+	char *end;
+
+	errno = 0;
+	*value = strtoul(s, &end, 10);
+	return errno || end == s || *end != '\0';
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct trace_filter filter;
+	unsigned long value;
+	int i;
+
+	if (argc < 3)
+	{
+		usage();
+		return 2;
+	}
+
+	if (strcmp(argv[1], "diff") == 0)
+	{
+		if (argc != 4)
+		{
+			usage();
+			return 2;
+		}
+
+		return diff(argv[2], argv[3]);
+	}
+
+	if (strcmp(argv[1], "dump") != 0)
+	{
+		usage();
+		return 2;
+	}
+
+	filter.from = 0;
+	filter.to = UINT64_MAX;
+	filter.pc = -1;
+	filter.mailbox = -1;
+	filter.io = false;
+
+	for (i = 2; i < argc - 1; ++i)
+	{
+		if (strcmp(argv[i], "--io") == 0)
+		{
+			filter.io = true;
+			continue;
+		}
+
+		if (i + 1 == argc - 1 || parse_number(argv[i + 1], &value))
+		{
+			usage();
+			return 2;
+		}
+
+		if (strcmp(argv[i], "--from") == 0)
+			filter.from = value;
+		else if (strcmp(argv[i], "--to") == 0)
+			filter.to = value;
+		else if (strcmp(argv[i], "--pc") == 0 && value < NUM_MAILBOXES)
+			filter.pc = value;
+		else if (strcmp(argv[i], "--write") == 0
+			&& value < NUM_MAILBOXES)
+			filter.mailbox = value;
+		else
+		{
+			usage();
+			return 2;
+		}
+
+		++i;
+	}
+
+	return dump(argv[argc - 1], &filter);
+}
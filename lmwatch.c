@@ -0,0 +1,485 @@
+/*
+ * lmwatch - reassembles and reruns a program whenever it's saved
+ * Copyright (C) 2020 David McMackins II
+ *
+ * Redistributions, modified or unmodified, in whole or in part, must retain
+ * applicable copyright or other legal privilege notices, these conditions, and
+ * the following license terms and disclaimer.  Subject to these conditions,
+ * the holder(s) of copyright or other legal privileges, author(s) or
+ * assembler(s), and contributors of this work hereby grant to any person who
+ * obtains a copy of this work in any form:
+ *
+ * 1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ * use, and/or otherwise deal in the licensed material without restriction.
+ *
+ * 2. A perpetual, worldwide, non-exclusive, royalty-free, irrevocable patent
+ * license to reproduce, modify, distribute, publish, sell, use, and/or
+ * otherwise deal in the licensed material without restriction, for any and all
+ * patents:
+ *
+ *     a. Held by each such holder of copyright or other legal privilege,
+ *     author or assembler, or contributor, necessarily infringed by the
+ *     contributions alone or by combination with the work, of that privilege
+ *     holder, author or assembler, or contributor.
+ *
+ *     b. Necessarily infringed by the work at the time that holder of
+ *     copyright or other privilege, author or assembler, or contributor made
+ *     any contribution to the work.
+ *
+ * NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ * LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ * A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ * ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ * ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT, TORT,
+ * OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR THE USE
+ * OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+# include <poll.h>
+# include <sys/inotify.h>
+#endif
+
+#include "asm.h"
+#include "lmc.h"
+
+#define DEFAULT_MAX_STEPS UINT64_C(100000000)
+#define DEFAULT_ENGINE "predecoded"
+#define SETTLE_MS 10 /* how long a save may take to finish */
+#define POLL_MS 100 /* how often to check the source without inotify */
+
+struct watch_conf
+{
+	const char *source_path;
+	const char *image_path;
+	const struct lmc_engine *engine;
+	uint64_t max_steps;
+};
+
+struct watched_input
+{
+	const char *path;
+	char *output; /* from the last run; NULL before the first */
+	size_t output_len;
+};
+
+struct line
+{
+	const char *text;
+	int len;
+};
+
+/* returns the lines of buf, without their newlines, or NULL if out of
+   memory */
+static struct line *
+split_lines(const char *buf, size_t len, size_t *count)
+{
+	struct line *lines;
+	size_t i, start = 0;
+
+	*count = 0;
+	for (i = 0; i < len; ++i)
+	{
+		if ('\n' == buf[i])
+			++*count;
+	}
+
+	lines = malloc((*count + 1) * sizeof *lines);
+	if (!lines)
+		return NULL;
+
+	*count = 0;
+	for (i = 0; i <= len; ++i)
+	{
+		if (i == len ? i > start : '\n' == buf[i])
+		{
+			lines[*count].text = buf + start;
+			lines[(*count)++].len = (int) (i - start);
+			start = i + 1;
+		}
+	}
+
+	return lines;
+}
+
+static bool
+same_line(const struct line *a, const struct line *b)
+{
+	return a->len == b->len && memcmp(a->text, b->text, a->len) == 0;
+}
+
+/* prints the lines between the longest common head and tail of the two
+   outputs, which for a program's output is nearly always the change */
+static void
+print_diff(const char *old, size_t old_len, const char *new, size_t new_len)
+{
+	struct line *a, *b;
+	size_t na, nb, head = 0, tail = 0, i;
+
+	a = split_lines(old, old_len, &na);
+	b = split_lines(new, new_len, &nb);
+	if (!a || !b)
+	{
+		fprintf(stderr, "Out of memory\n");
+		goto end;
+	}
+
+	while (head < na && head < nb && same_line(&a[head], &b[head]))
+		++head;
+
+	while (tail < na - head && tail < nb - head
+		&& same_line(&a[na - 1 - tail], &b[nb - 1 - tail]))
+	{
+		++tail;
+	}
+
+	for (i = head; i < na - tail; ++i)
+		printf("  -%.*s\n", a[i].len, a[i].text);
+
+	for (i = head; i < nb - tail; ++i)
+		printf("  +%.*s\n", b[i].len, b[i].text);
+
+end:
+	free(a);
+	free(b);
+}
+
+/* runs the image against one input and reports how its output changed
+   since the last run */
+static void
+run_input(const struct lmc *image, struct watched_input *input,
+	const struct watch_conf *conf)
+{
+	struct lmc lmc;
+	char *output = NULL;
+	size_t output_len = 0;
+	const char *how;
+
+	lmc = *image;
+	lmc.in = fopen(input->path, "r");
+	if (!lmc.in)
+	{
+		fprintf(stderr, "Error opening %s: %s\n", input->path,
+			strerror(errno));
+		return;
+	}
+
+	lmc.out = open_memstream(&output, &output_len);
+	if (!lmc.out)
+	{
+		fprintf(stderr, "Error buffering the run: %s\n",
+			strerror(errno));
+		fclose(lmc.in);
+		return;
+	}
+
+	conf->engine->run_for(&lmc, conf->max_steps);
+	fclose(lmc.in);
+	if (fclose(lmc.out))
+	{
+		fprintf(stderr, "Error buffering the run: %s\n",
+			strerror(errno));
+		free(output);
+		return;
+	}
+
+	if (lmc.cpu.error)
+		how = "stopped with an error";
+	else if (!lmc.cpu.halted)
+		how = "still running";
+	else
+		how = "halted";
+
+	if (!input->output)
+	{
+		printf("%s: %s\n", input->path, how);
+		print_diff("", 0, output, output_len);
+	}
+	else if (input->output_len == output_len
+		&& memcmp(input->output, output, output_len) == 0)
+	{
+		printf("%s: %s, output unchanged\n", input->path, how);
+	}
+	else
+	{
+		printf("%s: %s, output changed\n", input->path, how);
+		print_diff(input->output, input->output_len, output,
+			output_len);
+	}
+
+	free(input->output);
+	input->output = output;
+	input->output_len = output_len;
+}
+
+static double
+ms_between(const struct timespec *start, const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1e3
+		+ (end->tv_nsec - start->tv_nsec) / 1e6;
+}
+
+static void
+rebuild(const struct watch_conf *conf, struct watched_input *inputs,
+	int num_inputs)
+{
+	struct lmc image;
+	struct timespec start, built, done;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (lmasm_assemble(conf->source_path, conf->image_path, NULL, false))
+	{
+		printf("-- %s doesn't assemble\n", conf->source_path);
+		fflush(stdout);
+		return;
+	}
+
+	memset(&image, 0, sizeof image);
+	image.quiet = true;
+	if (lmc_load_image(&image, conf->image_path) < 0)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &built);
+	for (i = 0; i < num_inputs; ++i)
+		run_input(&image, &inputs[i], conf);
+
+	clock_gettime(CLOCK_MONOTONIC, &done);
+	printf("-- assembled %s in %.2f ms, ran %d inputs in %.2f ms\n",
+		conf->source_path, ms_between(&start, &built), num_inputs,
+		ms_between(&built, &done));
+	fflush(stdout);
+}
+
+#ifdef __linux__
+/* editors often save by writing a new file and renaming it over the old
+   one, so this watches the directory for either */
+static int
+watch(const struct watch_conf *conf, struct watched_input *inputs,
+	int num_inputs)
+{
+	union
+	{
+		struct inotify_event event;
+		char buf[4096];
+	} events;
+	struct pollfd pfd;
+	const char *name, *slash;
+	char *dir;
+	bool changed = false;
+	int fd, rc = 1;
+
+	slash = strrchr(conf->source_path, '/');
+	name = slash ? slash + 1 : conf->source_path;
+	dir = slash ? strndup(conf->source_path,
+		slash == conf->source_path ? 1 : slash - conf->source_path)
+		: strdup(".");
+	if (!dir)
+	{
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+
+	fd = inotify_init();
+	if (fd < 0 || inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO)
+		< 0)
+	{
+		fprintf(stderr, "Error watching %s: %s\n", dir,
+			strerror(errno));
+		goto end;
+	}
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	for (;;)
+	{
+		ssize_t len;
+		char *p;
+
+		/* one save can be several events; rebuild once they stop */
+		switch (poll(&pfd, 1, changed ? SETTLE_MS : -1))
+		{
+		case -1:
+			if (EINTR == errno)
+				continue;
+
+			fprintf(stderr, "Error watching %s: %s\n", dir,
+				strerror(errno));
+			goto end;
+
+		case 0:
+			rebuild(conf, inputs, num_inputs);
+			changed = false;
+			continue;
+		}
+
+		len = read(fd, events.buf, sizeof events.buf);
+		if (len < 0)
+		{
+			if (EINTR == errno)
+				continue;
+
+			fprintf(stderr, "Error watching %s: %s\n", dir,
+				strerror(errno));
+			goto end;
+		}
+
+		for (p = events.buf; p < events.buf + len;
+			p += sizeof (struct inotify_event)
+				+ ((struct inotify_event *) p)->len)
+		{
+			const struct inotify_event *event = (void *) p;
+
+			if (event->len && strcmp(event->name, name) == 0)
+				changed = true;
+		}
+	}
+
+end:
+	if (fd >= 0)
+		close(fd);
+
+	free(dir);
+	return rc;
+}
+#else
+static int
+watch(const struct watch_conf *conf, struct watched_input *inputs,
+	int num_inputs)
+{
+	struct timespec interval;
+	struct stat last, now;
+
+	interval.tv_sec = 0;
+	interval.tv_nsec = POLL_MS * 1000000L;
+
+	if (stat(conf->source_path, &last))
+		memset(&last, 0, sizeof last);
+
+	for (;;)
+	{
+		nanosleep(&interval, NULL);
+		if (stat(conf->source_path, &now))
+			continue;
+
+		if (now.st_mtime != last.st_mtime
+			|| now.st_size != last.st_size
+			|| now.st_ino != last.st_ino)
+		{
+			last = now;
+			rebuild(conf, inputs, num_inputs);
+		}
+	}
+}
+#endif
+
+static const char *const USAGE[] =
+{
+	"Usage: lmwatch [options] <source> <image> [input...]",
+	"  --engine <name>    execution engine (default " DEFAULT_ENGINE ")",
+	"  --max-steps <n>    stop runs that take longer than this",
+	"                     (default 100000000)",
+	"  --once             build and run once instead of watching",
+	"Assembles <source> into <image> and runs it against each input",
+	"file, then does it again whenever <source> is saved, showing how",
+	"each input's output changed.",
+	NULL
+};
+
+static void
+usage(void)
+{
+	int i;
+
+	for (i = 0; USAGE[i]; ++i)
+		fprintf(stderr, "%s\n", USAGE[i]);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct watch_conf conf;
+	struct watched_input *inputs;
+	bool once = false;
+	int i, num_inputs, rc = 0;
+
+	conf.engine = lmc_find_engine(DEFAULT_ENGINE);
+	conf.max_steps = DEFAULT_MAX_STEPS;
+
+	for (i = 1; i < argc && '-' == argv[i][0]; ++i)
+	{
+		if (strcmp(argv[i], "--once") == 0)
+		{
+			once = true;
+		}
+		else if (strcmp(argv[i], "--engine") == 0 && i + 1 < argc)
+		{
+			conf.engine = lmc_find_engine(argv[++i]);
+			if (!conf.engine || !conf.engine->run_for)
+			{
+				fprintf(stderr, "No such engine: %s\n", argv[i]);
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--max-steps") == 0 && i + 1 < argc)
+		{
+			char *end;
+
+			errno = 0;
+			conf.max_steps = strtoul(argv[++i], &end, 10);
+			if (errno || end == argv[i] || *end != '\0'
+				|| !conf.max_steps)
+			{
+				usage();
+				return 1;
+			}
+		}
+		else
+		{
+			usage();
+			return 1;
+		}
+	}
+
+	if (argc - i < 2)
+	{
+		usage();
+		return 1;
+	}
+
+	conf.source_path = argv[i];
+	conf.image_path = argv[i + 1];
+	num_inputs = argc - i - 2;
+
+	inputs = calloc(num_inputs + 1, sizeof *inputs);
+	if (!inputs)
+	{
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+
+	for (i = 0; i < num_inputs; ++i)
+		inputs[i].path = argv[argc - num_inputs + i];
+
+	rebuild(&conf, inputs, num_inputs);
+	if (!once)
+		rc = watch(&conf, inputs, num_inputs);
+
+	for (i = 0; i < num_inputs; ++i)
+		free(inputs[i].output);
+
+	free(inputs);
+	return rc;
+}
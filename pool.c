@@ -0,0 +1,203 @@
+/*
+ * pool.c - checks run in a pool of child processes
+ * Copyright (C) 2020 David McMackins II
+ *
+ * Redistributions, modified or unmodified, in whole or in part, must retain
+ * applicable copyright or other legal privilege notices, these conditions, and
+ * the following license terms and disclaimer.  Subject to these conditions,
+ * the holder(s) of copyright or other legal privileges, author(s) or
+ * assembler(s), and contributors of this work hereby grant to any person who
+ * obtains a copy of this work in any form:
+ *
+ * 1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ * use, and/or otherwise deal in the licensed material without restriction.
+ *
+ * 2. A perpetual, worldwide, non-exclusive, royalty-free, irrevocable patent
+ * license to reproduce, modify, distribute, publish, sell, use, and/or
+ * otherwise deal in the licensed material without restriction, for any and all
+ * patents:
+ *
+ *     a. Held by each such holder of copyright or other legal privilege,
+ *     author or assembler, or contributor, necessarily infringed by the
+ *     contributions alone or by combination with the work, of that privilege
+ *     holder, author or assembler, or contributor.
+ *
+ *     b. Necessarily infringed by the work at the time that holder of
+ *     copyright or other privilege, author or assembler, or contributor made
+ *     any contribution to the work.
+ *
+ * NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ * LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ * A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ * ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ * ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT, TORT,
+ * OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR THE USE
+ * OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "pool.h"
+
+unsigned long
+pool_default_jobs(void)
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return cpus > 0 ? (unsigned long) cpus : 1;
+}
+
+void
+pool_usage(const char *const usage[])
+{
+	int i;
+
+	for (i = 0; usage[i]; ++i)
+		fprintf(stderr, "%s\n", usage[i]);
+}
+
+static int
+parse_number(const char *s, unsigned long *value)
+{
+	char *end;
+
+	errno = 0;
+	*value = strtoul(s, &end, 10);
+	return errno || end == s || *end != '\0';
+}
+
+int
+pool_options(int argc, char *argv[], const char **engine,
+	const struct pool_option *options, const char *const usage[])
+{
+	const struct pool_option *option;
+	unsigned long value;
+	int i;
+
+	for (i = 1; i < argc && '-' == argv[i][0]; i += 2)
+	{
+		if (i + 1 == argc)
+			goto usage;
+
+		if (strcmp(argv[i], "--engine") == 0)
+		{
+			*engine = argv[i + 1];
+			continue;
+		}
+
+		for (option = options; option->name; ++option)
+		{
+			if (strcmp(argv[i], option->name) == 0)
+				break;
+		}
+
+		if (!option->name || parse_number(argv[i + 1], &value)
+			|| (!value && !option->zero_ok))
+		{
+			goto usage;
+		}
+
+		*option->value = value;
+	}
+
+	return i;
+
+usage:
+	pool_usage(usage);
+	return -1;
+}
+
+struct job
+{
+	pid_t pid; /* 0 if the slot is free */
+	int index;
+};
+
+int
+pool_run(int count, unsigned long jobs, int (*check)(int i, void *data),
+	const char *(*name)(int i, void *data), void *data, int *done,
+	int *failed)
+{
+	struct job *running_jobs;
+	int next = 0, running = 0, rc = 0;
+
+	*done = 0;
+	*failed = 0;
+
+	running_jobs = calloc(jobs, sizeof *running_jobs);
+	if (!running_jobs)
+	{
+		fprintf(stderr, "Out of memory\n");
+		return 2;
+	}
+
+	while (next < count || running)
+	{
+		int status, slot;
+		pid_t pid;
+
+		if (next < count && running < (int) jobs)
+		{
+			for (slot = 0; running_jobs[slot].pid; ++slot)
+				;
+
+			fflush(stdout);
+			pid = fork();
+			if (-1 == pid)
+			{
+				fprintf(stderr, "Failed to fork: %s\n",
+					strerror(errno));
+				rc = 2;
+				break;
+			}
+
+			if (0 == pid)
+				exit(check(next, data));
+
+			running_jobs[slot].pid = pid;
+			running_jobs[slot].index = next;
+			++running;
+			++next;
+			continue;
+		}
+
+		pid = wait(&status);
+		if (-1 == pid)
+			break;
+
+		for (slot = 0; running_jobs[slot].pid != pid; ++slot)
+			;
+
+		running_jobs[slot].pid = 0;
+		--running;
+		++*done;
+
+		if (WIFSIGNALED(status))
+		{
+			printf("FAIL %s: killed by signal %d\n",
+				name(running_jobs[slot].index, data),
+				WTERMSIG(status));
+			++*failed;
+			if (rc < 1)
+				rc = 1;
+		}
+		else if (WEXITSTATUS(status))
+		{
+			++*failed;
+			if ((int) WEXITSTATUS(status) > rc)
+				rc = WEXITSTATUS(status);
+		}
+	}
+
+	free(running_jobs);
+	return rc;
+}
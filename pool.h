@@ -0,0 +1,80 @@
+/*
+ * pool.h - checks run in a pool of child processes
+ * Copyright (C) 2020 David McMackins II
+ *
+ * Redistributions, modified or unmodified, in whole or in part, must retain
+ * applicable copyright or other legal privilege notices, these conditions, and
+ * the following license terms and disclaimer.  Subject to these conditions,
+ * the holder(s) of copyright or other legal privileges, author(s) or
+ * assembler(s), and contributors of this work hereby grant to any person who
+ * obtains a copy of this work in any form:
+ *
+ * 1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ * use, and/or otherwise deal in the licensed material without restriction.
+ *
+ * 2. A perpetual, worldwide, non-exclusive, royalty-free, irrevocable patent
+ * license to reproduce, modify, distribute, publish, sell, use, and/or
+ * otherwise deal in the licensed material without restriction, for any and all
+ * patents:
+ *
+ *     a. Held by each such holder of copyright or other legal privilege,
+ *     author or assembler, or contributor, necessarily infringed by the
+ *     contributions alone or by combination with the work, of that privilege
+ *     holder, author or assembler, or contributor.
+ *
+ *     b. Necessarily infringed by the work at the time that holder of
+ *     copyright or other privilege, author or assembler, or contributor made
+ *     any contribution to the work.
+ *
+ * NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ * LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ * A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ * ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ * ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT, TORT,
+ * OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR THE USE
+ * OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#ifndef LMC_POOL_H
+#define LMC_POOL_H
+
+#include "lmc.h"
+
+/* an option taking a number; -j and --max-steps are the usual ones */
+struct pool_option
+{
+	const char *name; /* NULL ends a list of them */
+	unsigned long *value;
+	bool zero_ok;
+};
+
+/* one per CPU */
+unsigned long
+pool_default_jobs(void);
+
+/* reads the options before the first argument that isn't one: --engine,
+   whose value is left in *engine, and those in options. Returns the index
+   of that argument, or -1 after printing usage. */
+int
+pool_options(int argc, char *argv[], const char **engine,
+	const struct pool_option *options, const char *const usage[]);
+
+void
+pool_usage(const char *const usage[]);
+
+/*
+ * Runs check(i, data) for each i below count, each in its own process and
+ * up to jobs of them at once, so that one that crashes or corrupts memory
+ * takes down only itself. A check's return value is its exit status: 0 if
+ * it passed, 1 if it failed and 2 on error. A check killed by a signal is
+ * reported under name(i, data) as failed. Returns the worst status, or 2
+ * if a process couldn't be started, and sets how many checks finished and
+ * how many of those didn't pass.
+ */
+int
+pool_run(int count, unsigned long jobs, int (*check)(int i, void *data),
+	const char *(*name)(int i, void *data), void *data, int *done,
+	int *failed);
+
+#endif
@@ -0,0 +1,268 @@
+/*
+ * lmc - Little Man Computer
+ * Copyright (C) 2020 David McMackins II
+ *
+ * Redistributions, modified or unmodified, in whole or in part, must retain
+ * applicable copyright or other legal privilege notices, these conditions, and
+ * the following license terms and disclaimer.  Subject to these conditions,
+ * the holder(s) of copyright or other legal privileges, author(s) or
+ * assembler(s), and contributors of this work hereby grant to any person who
+ * obtains a copy of this work in any form:
+ *
+ * 1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ * use, and/or otherwise deal in the licensed material without restriction.
+ *
+ * 2. A perpetual, worldwide, non-exclusive, royalty-free, irrevocable patent
+ * license to reproduce, modify, distribute, publish, sell, use, and/or
+ * otherwise deal in the licensed material without restriction, for any and all
+ * patents:
+ *
+ *     a. Held by each such holder of copyright or other legal privilege,
+ *     author or assembler, or contributor, necessarily infringed by the
+ *     contributions alone or by combination with the work, of that privilege
+ *     holder, author or assembler, or contributor.
+ *
+ *     b. Necessarily infringed by the work at the time that holder of
+ *     copyright or other privilege, author or assembler, or contributor made
+ *     any contribution to the work.
+ *
+ * NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ * LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ * A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ * ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ * ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT, TORT,
+ * OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR THE USE
+ * OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+/*
+ * Minimal encoder for pprof's profile.proto. Only the handful of fields
+ * needed to describe one sample per executed mailbox are written. pprof
+ * accepts the message without gzip, so no compression library is needed.
+ */
+
+#define _POSIX_C_SOURCE 200809L /* snprintf */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "profile.h"
+
+/* field numbers from profile.proto */
+#define PROFILE_SAMPLE_TYPE 1
+#define PROFILE_SAMPLE 2
+#define PROFILE_LOCATION 4
+#define PROFILE_FUNCTION 5
+#define PROFILE_STRING_TABLE 6
+#define VALUE_TYPE_TYPE 1
+#define VALUE_TYPE_UNIT 2
+#define SAMPLE_LOCATION_ID 1
+#define SAMPLE_VALUE 2
+#define LOCATION_ID 1
+#define LOCATION_ADDRESS 3
+#define LOCATION_LINE 4
+#define LINE_FUNCTION_ID 1
+#define LINE_LINE 2
+#define FUNCTION_ID 1
+#define FUNCTION_NAME 2
+#define FUNCTION_SYSTEM_NAME 3
+#define FUNCTION_FILENAME 4
+
+#define WIRE_VARINT 0
+#define WIRE_BYTES 2
+
+struct pb_buf
+{
+	unsigned char *data;
+	size_t len;
+	size_t cap;
+	bool oom;
+};
+
+static void
+pb_put(struct pb_buf *buf, const void *data, size_t len)
+{
+	if (buf->oom || 0 == len)
+		return;
+
+	if (buf->len + len > buf->cap)
+	{
+		size_t cap = buf->cap ? buf->cap : 256;
+		void *temp;
+
+		while (cap < buf->len + len)
+			cap *= 2;
+
+		temp = realloc(buf->data, cap);
+		if (!temp)
+		{
+			buf->oom = true;
+			return;
+		}
+
+		buf->data = temp;
+		buf->cap = cap;
+	}
+
+	memcpy(buf->data + buf->len, data, len);
+	buf->len += len;
+}
+
+static void
+pb_varint(struct pb_buf *buf, uint64_t value)
+{
+	unsigned char bytes[10];
+	size_t n = 0;
+
+	do
+	{
+		bytes[n] = value & 0x7f;
+		value >>= 7;
+		if (value)
+			bytes[n] |= 0x80;
+
+		++n;
+	}
+	while (value);
+
+	pb_put(buf, bytes, n);
+}
+
+static void
+pb_uint(struct pb_buf *buf, int field, uint64_t value)
+{
+	pb_varint(buf, (uint64_t) field << 3 | WIRE_VARINT);
+	pb_varint(buf, value);
+}
+
+static void
+pb_bytes(struct pb_buf *buf, int field, const void *data, size_t len)
+{
+	pb_varint(buf, (uint64_t) field << 3 | WIRE_BYTES);
+	pb_varint(buf, len);
+	pb_put(buf, data, len);
+}
+
+/* appends msg as a length-delimited field and empties it for reuse */
+static void
+pb_message(struct pb_buf *buf, int field, struct pb_buf *msg)
+{
+	pb_bytes(buf, field, msg->data, msg->len);
+	buf->oom = buf->oom || msg->oom;
+	msg->len = 0;
+}
+
+/*
+ * String table layout: 0 is the mandatory empty string, followed by the
+ * sample type and unit, the source file name, then one string per
+ * function.
+ */
+#define STR_INSTRUCTIONS 1
+#define STR_COUNT 2
+#define STR_FILE 3
+#define STR_FIRST_FUNCTION 4
+
+int
+profile_write_pprof(FILE *out, const struct lmc *lmc,
+	const struct lmc_profile *prof, const struct lmc_srcmap *map)
+{
+	struct pb_buf profile, msg, line;
+	const char *functions[NUM_MAILBOXES];
+	int function_ids[NUM_MAILBOXES];
+	char names[NUM_MAILBOXES][16];
+	int i, j, num_functions = 0, rc = 0;
+
+	UNUSED(lmc);
+
+	memset(&profile, 0, sizeof profile);
+	memset(&msg, 0, sizeof msg);
+	memset(&line, 0, sizeof line);
+
+	/* without a source map every mailbox is its own function */
+	for (i = 0; i < NUM_MAILBOXES; ++i)
+	{
+		const char *name;
+
+		if (map)
+		{
+			name = map->labels[i];
+		}
+		else
+		{
+			snprintf(names[i], sizeof names[i], "mailbox %d", i);
+			name = names[i];
+		}
+
+		for (j = 0; j < num_functions; ++j)
+		{
+			if (strcmp(functions[j], name) == 0)
+				break;
+		}
+
+		if (j == num_functions)
+			functions[num_functions++] = name;
+
+		function_ids[i] = j + 1;
+	}
+
+	pb_uint(&msg, VALUE_TYPE_TYPE, STR_INSTRUCTIONS);
+	pb_uint(&msg, VALUE_TYPE_UNIT, STR_COUNT);
+	pb_message(&profile, PROFILE_SAMPLE_TYPE, &msg);
+
+	for (i = 0; i < NUM_MAILBOXES; ++i)
+	{
+		if (0 == prof->exec[i])
+			continue;
+
+		pb_uint(&msg, SAMPLE_LOCATION_ID, i + 1);
+		pb_uint(&msg, SAMPLE_VALUE, prof->exec[i]);
+		pb_message(&profile, PROFILE_SAMPLE, &msg);
+
+		pb_uint(&line, LINE_FUNCTION_ID, function_ids[i]);
+		if (map)
+			pb_uint(&line, LINE_LINE, map->lines[i]);
+
+		pb_uint(&msg, LOCATION_ID, i + 1);
+		pb_uint(&msg, LOCATION_ADDRESS, i);
+		pb_message(&msg, LOCATION_LINE, &line);
+		pb_message(&profile, PROFILE_LOCATION, &msg);
+	}
+
+	for (i = 0; i < num_functions; ++i)
+	{
+		pb_uint(&msg, FUNCTION_ID, i + 1);
+		pb_uint(&msg, FUNCTION_NAME, STR_FIRST_FUNCTION + i);
+		pb_uint(&msg, FUNCTION_SYSTEM_NAME, STR_FIRST_FUNCTION + i);
+		if (map)
+			pb_uint(&msg, FUNCTION_FILENAME, STR_FILE);
+
+		pb_message(&profile, PROFILE_FUNCTION, &msg);
+	}
+
+	pb_bytes(&profile, PROFILE_STRING_TABLE, "", 0);
+	pb_bytes(&profile, PROFILE_STRING_TABLE, "instructions", 12);
+	pb_bytes(&profile, PROFILE_STRING_TABLE, "count", 5);
+	pb_bytes(&profile, PROFILE_STRING_TABLE, map ? map->file : "",
+		map ? strlen(map->file) : 0);
+	for (i = 0; i < num_functions; ++i)
+	{
+		pb_bytes(&profile, PROFILE_STRING_TABLE, functions[i],
+			strlen(functions[i]));
+	}
+
+	if (profile.oom || msg.oom || line.oom)
+	{
+		fprintf(stderr, "Out of memory\n");
+		rc = -1;
+	}
+	else if (fwrite(profile.data, 1, profile.len, out) != profile.len)
+	{
+		rc = -1;
+	}
+
+	free(profile.data);
+	free(msg.data);
+	free(line.data);
+	return rc;
+}
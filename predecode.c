@@ -0,0 +1,387 @@
+/*
+ * lmc - Little Man Computer emulator
+ * Copyright (C) 2020 David McMackins II
+ *
+ * Redistributions, modified or unmodified, in whole or in part, must retain
+ * applicable copyright or other legal privilege notices, these conditions, and
+ * the following license terms and disclaimer.  Subject to these conditions,
+ * the holder(s) of copyright or other legal privileges, author(s) or
+ * assembler(s), and contributors of this work hereby grant to any person who
+ * obtains a copy of this work in any form:
+ *
+ * 1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ * use, and/or otherwise deal in the licensed material without restriction.
+ *
+ * 2. A perpetual, worldwide, non-exclusive, royalty-free, irrevocable patent
+ * license to reproduce, modify, distribute, publish, sell, use, and/or
+ * otherwise deal in the licensed material without restriction, for any and all
+ * patents:
+ *
+ *     a. Held by each such holder of copyright or other legal privilege,
+ *     author or assembler, or contributor, necessarily infringed by the
+ *     contributions alone or by combination with the work, of that privilege
+ *     holder, author or assembler, or contributor.
+ *
+ *     b. Necessarily infringed by the work at the time that holder of
+ *     copyright or other privilege, author or assembler, or contributor made
+ *     any contribution to the work.
+ *
+ * NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ * LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ * A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ * ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ * ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT, TORT,
+ * OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR THE USE
+ * OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "lmc.h"
+#include "predecode.h"
+
+static void
+set_instruction(struct lmc_cpu *cpu, int instruction)
+{
+	cpu->instruction = instruction;
+	cpu->opcode = instruction / NUM_MAILBOXES;
+	cpu->addr = instruction % NUM_MAILBOXES;
+}
+
+static void
+p_halt(struct lmc_predecoded *p, const struct lmc_slot *slot)
+{
+	UNUSED(slot);
+	p->lmc->cpu.halted = true;
+}
+
+static void
+p_add(struct lmc_predecoded *p, const struct lmc_slot *slot)
+{
+	struct lmc_cpu *cpu = &p->lmc->cpu;
+
+	cpu->a += p->lmc->mailboxes[slot->addr];
+	cpu->neg = cpu->a > MAX_VALUE;
+	if (cpu->neg)
+		cpu->a -= MAX_VALUE + 1;
+}
+
+static void
+p_sub(struct lmc_predecoded *p, const struct lmc_slot *slot)
+{
+	struct lmc_cpu *cpu = &p->lmc->cpu;
+
+	cpu->a -= p->lmc->mailboxes[slot->addr];
+	cpu->neg = cpu->a < 0;
+	if (cpu->neg)
+		cpu->a += MAX_VALUE + 1;
+}
+
+static void
+decode(struct lmc_predecoded *p, int mailbox);
+
+static void
+p_store(struct lmc_predecoded *p, const struct lmc_slot *slot)
+{
+	int addr = slot->addr;
+
+	p->lmc->mailboxes[addr] = p->lmc->cpu.a;
+
+	/* self-modifying code: keep the decoded copy in step */
+	if (p->slots[addr].instruction != p->lmc->cpu.a)
+		decode(p, addr);
+}
+
+static void
+p_load(struct lmc_predecoded *p, const struct lmc_slot *slot)
+{
+	p->lmc->cpu.a = p->lmc->mailboxes[slot->addr];
+}
+
+static void
+p_branch(struct lmc_predecoded *p, const struct lmc_slot *slot)
+{
+	p->lmc->cpu.pc = slot->addr;
+}
+
+static void
+p_branch_zero(struct lmc_predecoded *p, const struct lmc_slot *slot)
+{
+	if (0 == p->lmc->cpu.a)
+		p->lmc->cpu.pc = slot->addr;
+}
+
+static void
+p_branch_positive(struct lmc_predecoded *p, const struct lmc_slot *slot)
+{
+	if (!p->lmc->cpu.neg)
+		p->lmc->cpu.pc = slot->addr;
+}
+
+/* I/O and bad instructions go through the plain ops, which want the
+   decoded fields in the CPU */
+static void
+p_generic(struct lmc_predecoded *p, const struct lmc_slot *slot)
+{
+	struct lmc *lmc = p->lmc;
+	lmc_op op = NULL;
+
+	set_instruction(&lmc->cpu, slot->instruction);
+	if (lmc->cpu.opcode >= 0 && lmc->cpu.opcode < NUM_OPCODES)
+		op = OPS[lmc->cpu.opcode];
+
+	if (op)
+		op(lmc);
+	else
+		bad_instruction(lmc);
+}
+
+static void
+p_logged_io(struct lmc_predecoded *p, const struct lmc_slot *slot)
+{
+	struct lmc_io_log *log = p->log;
+	struct lmc *lmc = p->lmc;
+
+	if (2 == slot->addr)
+	{
+		if (log->output_pos++ < log->outputs)
+			return;
+
+		log->outputs = log->output_pos;
+		p_generic(p, slot);
+		return;
+	}
+
+	if (log->input_pos < log->num_inputs)
+	{
+		lmc->cpu.a = log->inputs[log->input_pos++];
+		return;
+	}
+
+	p_generic(p, slot);
+	if (lmc->cpu.error)
+		return;
+
+	if (log->num_inputs == log->inputs_size)
+	{
+		size_t size = log->inputs_size ? log->inputs_size * 2 : 64;
+		void *temp;
+
+		temp = realloc(log->inputs, size * sizeof *log->inputs);
+		if (!temp)
+		{
+			fprintf(stderr, "Out of memory\n");
+			lmc->cpu.halted = true;
+			lmc->cpu.error = true;
+			return;
+		}
+
+		log->inputs = temp;
+		log->inputs_size = size;
+	}
+
+	log->inputs[log->num_inputs++] = lmc->cpu.a;
+	++log->input_pos;
+}
+
+static const lmc_handler HANDLERS[NUM_OPCODES] =
+{
+	p_halt,
+	p_add,
+	p_sub,
+	p_store,
+	p_generic,
+	p_load,
+	p_branch,
+	p_branch_zero,
+	p_branch_positive,
+	p_generic
+};
+
+static void
+p_break(struct lmc_predecoded *p, const struct lmc_slot *slot)
+{
+	struct lmc_cpu *cpu = &p->lmc->cpu;
+
+	cpu->pc = slot - p->slots; /* not executed yet */
+	cpu->halted = true;
+	p->stop = STOP_BREAK;
+	p->stop_pc = cpu->pc;
+}
+
+static void
+p_watch(struct lmc_predecoded *p, const struct lmc_slot *slot)
+{
+	/* the op may re-decode this very slot */
+	int addr = slot->addr, write = p_store == slot->op;
+
+	p->stop_pc = slot - p->slots;
+	p->stop_mailbox = addr;
+	p->stop_value = p->lmc->mailboxes[addr];
+
+	slot->op(p, slot);
+
+	p->stop = write ? STOP_WRITE : STOP_READ;
+	p->lmc->cpu.halted = true;
+}
+
+static void
+decode(struct lmc_predecoded *p, int mailbox)
+{
+	struct lmc_slot *slot = &p->slots[mailbox];
+	int instruction = p->lmc->mailboxes[mailbox];
+	int opcode = instruction / NUM_MAILBOXES;
+
+	slot->instruction = instruction;
+	slot->addr = instruction % NUM_MAILBOXES;
+	slot->op = opcode >= 0 && opcode < NUM_OPCODES ? HANDLERS[opcode]
+		: p_generic;
+
+	if (p->log && 9 == opcode && (1 == slot->addr || 2 == slot->addr))
+		slot->op = p_logged_io;
+
+	if (p_store == slot->op)
+		slot->watched = p->traps[slot->addr] & TRAP_WRITE;
+	else if (p_add == slot->op || p_sub == slot->op || p_load == slot->op)
+		slot->watched = p->traps[slot->addr] & TRAP_READ;
+	else
+		slot->watched = false;
+
+	if (p->traps[mailbox] & TRAP_BREAK)
+		slot->handler = p_break;
+	else if (slot->watched)
+		slot->handler = p_watch;
+	else
+		slot->handler = slot->op;
+}
+
+void
+predecode_reload(struct lmc_predecoded *p)
+{
+	int i;
+
+	for (i = 0; i < NUM_MAILBOXES; ++i)
+		decode(p, i);
+}
+
+void
+predecode_init(struct lmc_predecoded *p, struct lmc *lmc)
+{
+	memset(p, 0, sizeof *p);
+	p->lmc = lmc;
+	predecode_reload(p);
+}
+
+void
+predecode_trap(struct lmc_predecoded *p, int mailbox, int traps, bool on)
+{
+	if (on)
+		p->traps[mailbox] |= traps;
+	else
+		p->traps[mailbox] &= ~traps;
+
+	/* a watchpoint patches every slot that touches the mailbox */
+	predecode_reload(p);
+}
+
+void
+predecode_update(struct lmc_predecoded *p, int mailbox)
+{
+	decode(p, mailbox);
+}
+
+uint64_t
+predecode_run(struct lmc_predecoded *p, uint64_t steps)
+{
+	struct lmc *lmc = p->lmc;
+	const struct lmc_slot *slot;
+	uint64_t n = 0;
+	int instruction = -1;
+
+	if (lmc->cpu.halted)
+	{
+		p->stop = STOP_NONE;
+		return 0;
+	}
+
+	/* step over the breakpoint we stopped at */
+	slot = &p->slots[lmc->cpu.pc];
+	if (STOP_BREAK == p->stop && p->stop_pc == lmc->cpu.pc
+		&& p_break == slot->handler)
+	{
+		p->stop = STOP_NONE;
+		instruction = slot->instruction;
+		if (++lmc->cpu.pc == NUM_MAILBOXES)
+			lmc->cpu.pc = 0;
+
+		(slot->watched ? p_watch : slot->op)(p, slot);
+		++n;
+	}
+	else
+	{
+		p->stop = STOP_NONE;
+	}
+
+	if (!steps)
+	{
+		while (!lmc->cpu.halted)
+		{
+			slot = &p->slots[lmc->cpu.pc];
+			instruction = slot->instruction;
+			if (++lmc->cpu.pc == NUM_MAILBOXES)
+				lmc->cpu.pc = 0;
+
+			slot->handler(p, slot);
+		}
+	}
+	else
+	{
+		for (; n < steps && !lmc->cpu.halted; ++n)
+		{
+			slot = &p->slots[lmc->cpu.pc];
+			instruction = slot->instruction;
+			if (++lmc->cpu.pc == NUM_MAILBOXES)
+				lmc->cpu.pc = 0;
+
+			slot->handler(p, slot);
+		}
+	}
+
+	if (STOP_BREAK == p->stop)
+	{
+		--n; /* trapped before executing */
+		lmc->cpu.halted = false;
+		return n;
+	}
+
+	if (instruction >= 0)
+		set_instruction(&lmc->cpu, instruction);
+
+	if (p->stop != STOP_NONE)
+		lmc->cpu.halted = false;
+
+	return n;
+}
+
+void
+lmc_run_predecoded(struct lmc *lmc)
+{
+	struct lmc_predecoded p;
+
+	predecode_init(&p, lmc);
+	predecode_run(&p, 0);
+}
+
+uint64_t
+lmc_run_predecoded_for(struct lmc *lmc, uint64_t steps)
+{
+	struct lmc_predecoded p;
+
+	if (!steps)
+		return 0;
+
+	predecode_init(&p, lmc);
+	return predecode_run(&p, steps);
+}
@@ -0,0 +1,136 @@
+/*
+ * lmc - Little Man Computer emulator
+ * Copyright (C) 2020 David McMackins II
+ *
+ * Redistributions, modified or unmodified, in whole or in part, must retain
+ * applicable copyright or other legal privilege notices, these conditions, and
+ * the following license terms and disclaimer.  Subject to these conditions,
+ * the holder(s) of copyright or other legal privileges, author(s) or
+ * assembler(s), and contributors of this work hereby grant to any person who
+ * obtains a copy of this work in any form:
+ *
+ * 1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ * use, and/or otherwise deal in the licensed material without restriction.
+ *
+ * 2. A perpetual, worldwide, non-exclusive, royalty-free, irrevocable patent
+ * license to reproduce, modify, distribute, publish, sell, use, and/or
+ * otherwise deal in the licensed material without restriction, for any and all
+ * patents:
+ *
+ *     a. Held by each such holder of copyright or other legal privilege,
+ *     author or assembler, or contributor, necessarily infringed by the
+ *     contributions alone or by combination with the work, of that privilege
+ *     holder, author or assembler, or contributor.
+ *
+ *     b. Necessarily infringed by the work at the time that holder of
+ *     copyright or other privilege, author or assembler, or contributor made
+ *     any contribution to the work.
+ *
+ * NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ * LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ * A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ * ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ * ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT, TORT,
+ * OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR THE USE
+ * OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#ifndef LMC_PREDECODE_H
+#define LMC_PREDECODE_H
+
+#include "lmc.h"
+
+/* traps a mailbox can carry */
+#define TRAP_BREAK 0x01 /* stop before executing it */
+#define TRAP_READ 0x02 /* stop after an instruction reads it */
+#define TRAP_WRITE 0x04 /* stop after an instruction writes it */
+
+enum predecode_stop
+{
+	STOP_NONE,
+	STOP_BREAK,
+	STOP_READ,
+	STOP_WRITE
+};
+
+struct lmc_predecoded;
+struct lmc_slot;
+
+/* every value INP has read and how many OUTs have been printed, so that
+   instructions run again after going back in time replay their input
+   instead of reading more, and don't repeat their output */
+struct lmc_io_log
+{
+	int *inputs;
+	size_t num_inputs;
+	size_t inputs_size;
+	size_t input_pos; /* the next INP replays inputs[input_pos], if any */
+	uint64_t outputs;
+	uint64_t output_pos;
+};
+
+typedef void (*lmc_handler)(struct lmc_predecoded *p,
+	const struct lmc_slot *slot);
+
+/* a mailbox decoded once, when loaded or stored to, instead of every time
+   it is executed */
+struct lmc_slot
+{
+	lmc_handler handler; /* what the engine calls: op, or a trap */
+	lmc_handler op; /* what the instruction does */
+	int instruction;
+	int addr;
+	bool watched; /* op touches a watched mailbox */
+};
+
+/*
+ * Traps are patched into the handlers of the slots they affect, so the
+ * engine never looks at them: a breakpoint replaces the handler of its own
+ * slot, and a watchpoint on a mailbox replaces the handlers of every slot
+ * whose instruction reads or writes it. A trap stops the engine by setting
+ * halted, which it checks anyway, and records why in stop.
+ */
+struct lmc_predecoded
+{
+	struct lmc *lmc;
+	struct lmc_slot slots[NUM_MAILBOXES];
+	unsigned char traps[NUM_MAILBOXES];
+	struct lmc_io_log *log; /* NULL to do I/O directly */
+
+	enum predecode_stop stop;
+	int stop_pc; /* mailbox of the instruction that trapped */
+	int stop_mailbox; /* mailbox a watchpoint saw accessed */
+	int stop_value; /* its value before a write */
+};
+
+void
+predecode_init(struct lmc_predecoded *p, struct lmc *lmc);
+
+/* sets or clears TRAP_* flags on a mailbox */
+void
+predecode_trap(struct lmc_predecoded *p, int mailbox, int traps, bool on);
+
+/* re-decodes a mailbox changed from outside the engine */
+void
+predecode_update(struct lmc_predecoded *p, int mailbox);
+
+/* re-decodes every mailbox, after the whole machine or the traps were
+   replaced */
+void
+predecode_reload(struct lmc_predecoded *p);
+
+/* runs until halt or a trap, or for at most steps instructions if steps is
+   nonzero. If the last run stopped at a breakpoint, that one is stepped
+   over. Returns the number of instructions executed when steps is
+   nonzero. */
+uint64_t
+predecode_run(struct lmc_predecoded *p, uint64_t steps);
+
+void
+lmc_run_predecoded(struct lmc *lmc);
+
+uint64_t
+lmc_run_predecoded_for(struct lmc *lmc, uint64_t steps);
+
+#endif
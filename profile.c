@@ -0,0 +1,524 @@
+/*
+ * lmc - Little Man Computer
+ * Copyright (C) 2020 David McMackins II
+ *
+ * Redistributions, modified or unmodified, in whole or in part, must retain
+ * applicable copyright or other legal privilege notices, these conditions, and
+ * the following license terms and disclaimer.  Subject to these conditions,
+ * the holder(s) of copyright or other legal privileges, author(s) or
+ * assembler(s), and contributors of this work hereby grant to any person who
+ * obtains a copy of this work in any form:
+ *
+ * 1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ * use, and/or otherwise deal in the licensed material without restriction.
+ *
+ * 2. A perpetual, worldwide, non-exclusive, royalty-free, irrevocable patent
+ * license to reproduce, modify, distribute, publish, sell, use, and/or
+ * otherwise deal in the licensed material without restriction, for any and all
+ * patents:
+ *
+ *     a. Held by each such holder of copyright or other legal privilege,
+ *     author or assembler, or contributor, necessarily infringed by the
+ *     contributions alone or by combination with the work, of that privilege
+ *     holder, author or assembler, or contributor.
+ *
+ *     b. Necessarily infringed by the work at the time that holder of
+ *     copyright or other privilege, author or assembler, or contributor made
+ *     any contribution to the work.
+ *
+ * NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ * LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ * A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ * ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ * ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT, TORT,
+ * OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR THE USE
+ * OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#define _POSIX_C_SOURCE 200809L /* snprintf */
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "profile.h"
+
+#define MAX_LOOPS NUM_MAILBOXES
+
+static const char *const MIX_NAMES[PROFILE_MIX_SIZE] =
+{
+	"HLT",
+	"ADD",
+	"SUB",
+	"STA",
+	NULL, /* no 4xx instruction in ISA */
+	"LDA",
+	"BRA",
+	"BRZ",
+	"BRP",
+	"INP",
+	"OUT"
+};
+
+struct profile_row
+{
+	int mailbox;
+	uint64_t exec;
+	uint64_t traffic;
+};
+
+struct profile_label
+{
+	const char *name;
+	uint64_t exec;
+};
+
+struct profile_loop
+{
+	int header;
+	int back_edge;
+	uint64_t iterations;
+	uint64_t cost; /* instructions executed inside the loop body */
+};
+
+void
+lmc_run_profiled(struct lmc *lmc, struct lmc_profile *prof)
+{
+	while (!lmc->cpu.halted)
+	{
+		lmc_op op;
+		int pc = lmc->cpu.pc;
+		int branch = -1;
+
+		lmc->cpu.instruction = lmc->mailboxes[lmc->cpu.pc++];
+		lmc->cpu.opcode = lmc->cpu.instruction / NUM_MAILBOXES;
+		lmc->cpu.addr = lmc->cpu.instruction % NUM_MAILBOXES;
+
+		if (lmc->cpu.pc == NUM_MAILBOXES) /* wrap around, don't run off */
+			lmc->cpu.pc = 0;
+
+		if (lmc->cpu.opcode > 9 || (op = OPS[lmc->cpu.opcode]) == NULL)
+		{
+			bad_instruction(lmc);
+			break;
+		}
+
+		++prof->exec[pc];
+		++prof->total;
+
+		switch (lmc->cpu.opcode)
+		{
+		case 1:
+		case 2:
+		case 5:
+			++prof->reads[lmc->cpu.addr];
+			break;
+
+		case 3:
+			++prof->writes[lmc->cpu.addr];
+			break;
+
+		case 6:
+			branch = 1;
+			break;
+
+		case 7:
+			branch = 0 == lmc->cpu.a;
+			break;
+
+		case 8:
+			branch = !lmc->cpu.neg;
+			break;
+		}
+
+		if (9 == lmc->cpu.opcode)
+			++prof->mix[lmc->cpu.addr == 1 ? 9 : 10];
+		else
+			++prof->mix[lmc->cpu.opcode];
+
+		if (1 == branch)
+			++prof->taken[pc];
+		else if (0 == branch)
+			++prof->not_taken[pc];
+
+		op(lmc);
+	}
+}
+
+static int
+compare_rows(const void *a, const void *b)
+{
+	const struct profile_row *x = a, *y = b;
+
+	if (x->exec != y->exec)
+		return x->exec < y->exec ? 1 : -1;
+
+	if (x->traffic != y->traffic)
+		return x->traffic < y->traffic ? 1 : -1;
+
+	return x->mailbox - y->mailbox;
+}
+
+static int
+compare_labels(const void *a, const void *b)
+{
+	const struct profile_label *x = a, *y = b;
+
+	if (x->exec != y->exec)
+		return x->exec < y->exec ? 1 : -1;
+
+	return strcmp(x->name, y->name);
+}
+
+static int
+compare_loops(const void *a, const void *b)
+{
+	const struct profile_loop *x = a, *y = b;
+
+	if (x->cost != y->cost)
+		return x->cost < y->cost ? 1 : -1;
+
+	return x->header - y->header;
+}
+
+static int
+collect_rows(struct profile_row *rows, const struct lmc_profile *prof)
+{
+	int i, n = 0;
+
+	for (i = 0; i < NUM_MAILBOXES; ++i)
+	{
+		uint64_t traffic = prof->reads[i] + prof->writes[i];
+
+		if (0 == prof->exec[i] && 0 == traffic)
+			continue;
+
+		rows[n].mailbox = i;
+		rows[n].exec = prof->exec[i];
+		rows[n].traffic = traffic;
+		++n;
+	}
+
+	qsort(rows, n, sizeof *rows, compare_rows);
+	return n;
+}
+
+static int
+collect_labels(struct profile_label *labels, const struct lmc_profile *prof,
+	const struct lmc_srcmap *map)
+{
+	int i, j, n = 0;
+
+	for (i = 0; i < NUM_MAILBOXES; ++i)
+	{
+		if (0 == prof->exec[i])
+			continue;
+
+		for (j = 0; j < n; ++j)
+		{
+			if (strcmp(labels[j].name, map->labels[i]) == 0)
+				break;
+		}
+
+		if (j == n)
+		{
+			labels[n].name = map->labels[i];
+			labels[n].exec = 0;
+			++n;
+		}
+
+		labels[j].exec += prof->exec[i];
+	}
+
+	qsort(labels, n, sizeof *labels, compare_labels);
+	return n;
+}
+
+/* a loop is any taken branch back to (or onto) itself; the header is the
+   branch target and the iteration count is the number of times the
+   back-edge was followed */
+static int
+collect_loops(struct profile_loop *loops, const struct lmc *lmc,
+	const struct lmc_profile *prof)
+{
+	int i, j, n = 0;
+
+	for (i = 0; i < NUM_MAILBOXES; ++i)
+	{
+		int opcode = lmc->mailboxes[i] / NUM_MAILBOXES;
+		int target = lmc->mailboxes[i] % NUM_MAILBOXES;
+
+		if (0 == prof->taken[i] || opcode < 6 || opcode > 8
+			|| target > i)
+		{
+			continue;
+		}
+
+		loops[n].header = target;
+		loops[n].back_edge = i;
+		loops[n].iterations = prof->taken[i];
+		loops[n].cost = 0;
+		for (j = target; j <= i; ++j)
+			loops[n].cost += prof->exec[j];
+
+		++n;
+	}
+
+	qsort(loops, n, sizeof *loops, compare_loops);
+	return n;
+}
+
+static double
+percent(uint64_t part, uint64_t total)
+{
+	return total ? 100.0 * (double) part / (double) total : 0.0;
+}
+
+static void
+format_instruction(char *buf, size_t len, int instruction, bool executed)
+{
+	const char *name = lmc_mnemonic(instruction);
+	int opcode = instruction / NUM_MAILBOXES;
+
+	if (!name || !executed)
+		snprintf(buf, len, "DAT %d", instruction);
+	else if (0 == opcode || 9 == opcode)
+		snprintf(buf, len, "%s", name);
+	else
+		snprintf(buf, len, "%s %d", name,
+			instruction % NUM_MAILBOXES);
+}
+
+static void
+format_source(char *buf, size_t len, int mailbox,
+	const struct lmc_srcmap *map)
+{
+	if (!map || 0 == map->lines[mailbox])
+		snprintf(buf, len, "mailbox:%d", mailbox);
+	else
+		snprintf(buf, len, "%s:%d", map->file, map->lines[mailbox]);
+}
+
+int
+profile_report(FILE *out, const struct lmc *lmc,
+	const struct lmc_profile *prof, const struct lmc_srcmap *map)
+{
+	struct profile_row *rows;
+	struct profile_loop loops[MAX_LOOPS];
+	struct profile_label *labels = NULL;
+	int i, num_rows, num_loops, num_labels;
+
+	/* wide builds have too many mailboxes for these to go on the stack */
+	rows = malloc(NUM_MAILBOXES * sizeof *rows);
+	if (map)
+		labels = malloc(NUM_MAILBOXES * sizeof *labels);
+
+	if (!rows || (map && !labels))
+	{
+		fprintf(stderr, "Out of memory\n");
+		free(rows);
+		free(labels);
+		return -1;
+	}
+
+	num_rows = collect_rows(rows, prof);
+	num_loops = collect_loops(loops, lmc, prof);
+
+	fprintf(out, "\nProfile: %" PRIu64 " instructions executed\n\n",
+		prof->total);
+
+	fprintf(out, "Hot spots (contents at halt):\n");
+	fprintf(out, "%4s  %-8s %12s %7s %10s %10s %10s %10s", "box",
+		"insn", "exec", "%", "reads", "writes", "taken",
+		"not taken");
+	if (map)
+		fprintf(out, "  source");
+	fputc('\n', out);
+
+	for (i = 0; i < num_rows; ++i)
+	{
+		int box = rows[i].mailbox;
+		char insn[16];
+
+		format_instruction(insn, sizeof insn, lmc->mailboxes[box],
+			prof->exec[box] != 0);
+		fprintf(out, "%4d  %-8s %12" PRIu64 " %6.2f%% %10" PRIu64
+			" %10" PRIu64 " %10" PRIu64 " %10" PRIu64,
+			box, insn, prof->exec[box],
+			percent(prof->exec[box], prof->total),
+			prof->reads[box], prof->writes[box],
+			prof->taken[box], prof->not_taken[box]);
+
+		if (map)
+		{
+			fprintf(out, "  %s:%d (%s)", map->file,
+				map->lines[box], map->labels[box]);
+		}
+
+		fputc('\n', out);
+	}
+
+	if (map)
+	{
+		num_labels = collect_labels(labels, prof, map);
+
+		fprintf(out, "\nBy label:\n");
+		for (i = 0; i < num_labels; ++i)
+		{
+			fprintf(out, "  %-*s %12" PRIu64 " %6.2f%%\n",
+				SRCMAP_MAX_LABEL_LEN, labels[i].name,
+				labels[i].exec,
+				percent(labels[i].exec, prof->total));
+		}
+	}
+
+	fprintf(out, "\nLoops:\n");
+	if (0 == num_loops)
+		fprintf(out, "  none\n");
+
+	for (i = 0; i < num_loops; ++i)
+	{
+		fprintf(out, "  %d-%d: %" PRIu64 " iterations, %" PRIu64
+			" instructions (%.2f%%)\n",
+			loops[i].header, loops[i].back_edge,
+			loops[i].iterations, loops[i].cost,
+			percent(loops[i].cost, prof->total));
+	}
+
+	fprintf(out, "\nOpcode mix:\n");
+	for (i = 0; i < PROFILE_MIX_SIZE; ++i)
+	{
+		if (!MIX_NAMES[i] || 0 == prof->mix[i])
+			continue;
+
+		fprintf(out, "  %s %12" PRIu64 " %6.2f%%\n", MIX_NAMES[i],
+			prof->mix[i], percent(prof->mix[i], prof->total));
+	}
+
+	free(rows);
+	free(labels);
+	return ferror(out) ? -1 : 0;
+}
+
+/* writes s as a JSON string, quotes included */
+static void
+write_json_string(FILE *out, const char *s)
+{
+	fputc('"', out);
+	for (; *s; ++s)
+	{
+		unsigned char c = *s;
+
+		if ('"' == c || '\\' == c)
+			fprintf(out, "\\%c", c);
+		else if (c < 0x20)
+			fprintf(out, "\\u%04x", c);
+		else
+			fputc(c, out);
+	}
+
+	fputc('"', out);
+}
+
+int
+profile_write_json(FILE *out, const struct lmc *lmc,
+	const struct lmc_profile *prof, const struct lmc_srcmap *map)
+{
+	struct profile_row *rows;
+	struct profile_loop loops[MAX_LOOPS];
+	int i, num_rows, num_loops;
+	bool first;
+
+	rows = malloc(NUM_MAILBOXES * sizeof *rows);
+	if (!rows)
+	{
+		fprintf(stderr, "Out of memory\n");
+		return -1;
+	}
+
+	num_rows = collect_rows(rows, prof);
+	num_loops = collect_loops(loops, lmc, prof);
+
+	fprintf(out, "{\n  \"instructions\": %" PRIu64 ",\n", prof->total);
+	if (map)
+	{
+		fprintf(out, "  \"file\": ");
+		write_json_string(out, map->file);
+		fprintf(out, ",\n");
+	}
+
+	fprintf(out, "  \"mailboxes\": [");
+	for (i = 0; i < num_rows; ++i)
+	{
+		int box = rows[i].mailbox;
+
+		fprintf(out, "%s\n    {\"mailbox\": %d, \"contents\": %d, "
+			"\"exec\": %" PRIu64 ", \"reads\": %" PRIu64
+			", \"writes\": %" PRIu64 ", \"taken\": %" PRIu64
+			", \"not_taken\": %" PRIu64,
+			i ? "," : "", box, lmc->mailboxes[box],
+			prof->exec[box], prof->reads[box], prof->writes[box],
+			prof->taken[box], prof->not_taken[box]);
+
+		if (map)
+		{
+			fprintf(out, ", \"line\": %d, \"label\": ",
+				map->lines[box]);
+			write_json_string(out, map->labels[box]);
+		}
+
+		fputc('}', out);
+	}
+	fprintf(out, "\n  ],\n");
+
+	fprintf(out, "  \"loops\": [");
+	for (i = 0; i < num_loops; ++i)
+	{
+		fprintf(out, "%s\n    {\"header\": %d, \"back_edge\": %d, "
+			"\"iterations\": %" PRIu64 ", \"instructions\": %"
+			PRIu64 "}",
+			i ? "," : "", loops[i].header, loops[i].back_edge,
+			loops[i].iterations, loops[i].cost);
+	}
+	fprintf(out, "\n  ],\n");
+
+	fprintf(out, "  \"opcodes\": {");
+	first = true;
+	for (i = 0; i < PROFILE_MIX_SIZE; ++i)
+	{
+		if (!MIX_NAMES[i])
+			continue;
+
+		fprintf(out, "%s", first ? "" : ", ");
+		write_json_string(out, MIX_NAMES[i]);
+		fprintf(out, ": %" PRIu64, prof->mix[i]);
+		first = false;
+	}
+	fprintf(out, "}\n}\n");
+
+	free(rows);
+	return ferror(out) ? -1 : 0;
+}
+
+int
+profile_write_folded(FILE *out, const struct lmc *lmc,
+	const struct lmc_profile *prof, const struct lmc_srcmap *map)
+{
+	char source[SRCMAP_MAX_PATH_LEN + 16];
+	int i;
+
+	UNUSED(lmc);
+
+	for (i = 0; i < NUM_MAILBOXES; ++i)
+	{
+		if (0 == prof->exec[i])
+			continue;
+
+		format_source(source, sizeof source, i, map);
+		fprintf(out, "%s;%s %" PRIu64 "\n", map ? map->labels[i] : "-",
+			source, prof->exec[i]);
+	}
+
+	return ferror(out) ? -1 : 0;
+}
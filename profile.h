@@ -0,0 +1,90 @@
+/*
+ * lmc - Little Man Computer
+ * Copyright (C) 2020 David McMackins II
+ *
+ * Redistributions, modified or unmodified, in whole or in part, must retain
+ * applicable copyright or other legal privilege notices, these conditions, and
+ * the following license terms and disclaimer.  Subject to these conditions,
+ * the holder(s) of copyright or other legal privileges, author(s) or
+ * assembler(s), and contributors of this work hereby grant to any person who
+ * obtains a copy of this work in any form:
+ *
+ * 1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ * use, and/or otherwise deal in the licensed material without restriction.
+ *
+ * 2. A perpetual, worldwide, non-exclusive, royalty-free, irrevocable patent
+ * license to reproduce, modify, distribute, publish, sell, use, and/or
+ * otherwise deal in the licensed material without restriction, for any and all
+ * patents:
+ *
+ *     a. Held by each such holder of copyright or other legal privilege,
+ *     author or assembler, or contributor, necessarily infringed by the
+ *     contributions alone or by combination with the work, of that privilege
+ *     holder, author or assembler, or contributor.
+ *
+ *     b. Necessarily infringed by the work at the time that holder of
+ *     copyright or other privilege, author or assembler, or contributor made
+ *     any contribution to the work.
+ *
+ * NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ * LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ * A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ * ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ * ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT, TORT,
+ * OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR THE USE
+ * OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#ifndef LMC_PROFILE_H
+#define LMC_PROFILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "lmc.h"
+#include "srcmap.h"
+
+/* one slot per mnemonic; 9xx is split into INP and OUT */
+#define PROFILE_MIX_SIZE (NUM_OPCODES + 1)
+
+struct lmc_profile
+{
+	uint64_t exec[NUM_MAILBOXES];
+	uint64_t reads[NUM_MAILBOXES];
+	uint64_t writes[NUM_MAILBOXES];
+	uint64_t taken[NUM_MAILBOXES];
+	uint64_t not_taken[NUM_MAILBOXES];
+	uint64_t mix[PROFILE_MIX_SIZE];
+	uint64_t total;
+};
+
+/* same semantics as lmc_run(), but counts everything into prof; kept as a
+   separate loop so the plain engine pays nothing for profiling */
+void
+lmc_run_profiled(struct lmc *lmc, struct lmc_profile *prof);
+
+/* map is optional in all of the writers below; without one, results are
+   attributed to raw mailbox numbers */
+typedef int (*profile_writer)(FILE *out, const struct lmc *lmc,
+	const struct lmc_profile *prof, const struct lmc_srcmap *map);
+
+int
+profile_report(FILE *out, const struct lmc *lmc,
+	const struct lmc_profile *prof, const struct lmc_srcmap *map);
+
+int
+profile_write_json(FILE *out, const struct lmc *lmc,
+	const struct lmc_profile *prof, const struct lmc_srcmap *map);
+
+/* folded stacks (label;file:line count) for flamegraph.pl and friends */
+int
+profile_write_folded(FILE *out, const struct lmc *lmc,
+	const struct lmc_profile *prof, const struct lmc_srcmap *map);
+
+/* uncompressed profile.proto, readable by `go tool pprof` */
+int
+profile_write_pprof(FILE *out, const struct lmc *lmc,
+	const struct lmc_profile *prof, const struct lmc_srcmap *map);
+
+#endif
@@ -0,0 +1,209 @@
+/*
+ * lmc - Little Man Computer
+ * Copyright (C) 2020 David McMackins II
+ *
+ * Redistributions, modified or unmodified, in whole or in part, must retain
+ * applicable copyright or other legal privilege notices, these conditions, and
+ * the following license terms and disclaimer.  Subject to these conditions,
+ * the holder(s) of copyright or other legal privileges, author(s) or
+ * assembler(s), and contributors of this work hereby grant to any person who
+ * obtains a copy of this work in any form:
+ *
+ * 1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ * use, and/or otherwise deal in the licensed material without restriction.
+ *
+ * 2. A perpetual, worldwide, non-exclusive, royalty-free, irrevocable patent
+ * license to reproduce, modify, distribute, publish, sell, use, and/or
+ * otherwise deal in the licensed material without restriction, for any and all
+ * patents:
+ *
+ *     a. Held by each such holder of copyright or other legal privilege,
+ *     author or assembler, or contributor, necessarily infringed by the
+ *     contributions alone or by combination with the work, of that privilege
+ *     holder, author or assembler, or contributor.
+ *
+ *     b. Necessarily infringed by the work at the time that holder of
+ *     copyright or other privilege, author or assembler, or contributor made
+ *     any contribution to the work.
+ *
+ * NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ * LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ * A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ * ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ * ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT, TORT,
+ * OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR THE USE
+ * OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "sample.h"
+
+/* set while lmc_run_sampled() runs; sig_atomic_t need only hold 0..127,
+   so it's kept to a flag */
+static volatile sig_atomic_t sampling;
+
+/* the mailbox of the instruction being run, which can be past what a
+   sig_atomic_t holds. This assumes an aligned int is read and written in
+   one access, as on every target POSIX runs on; the handler runs on the
+   thread that writes it, so volatile is all the ordering it needs */
+static volatile int running;
+
+/* only the signal handler writes these while the timer is armed, so no
+   locking is needed; they're read once it has been disarmed */
+static volatile unsigned long samples[NUM_MAILBOXES];
+static volatile unsigned long num_samples;
+static int sample_hz;
+
+static void
+on_sigprof(int sig)
+{
+	int box = running;
+
+	UNUSED(sig);
+
+	if (!sampling || box < 0 || box >= NUM_MAILBOXES)
+		return;
+
+	++samples[box];
+	++num_samples;
+}
+
+void
+lmc_run_sampled(struct lmc *lmc)
+{
+	running = lmc->cpu.pc;
+	sampling = 1;
+
+	while (!lmc->cpu.halted)
+	{
+		lmc_op op;
+
+		running = lmc->cpu.pc;
+		lmc->cpu.instruction = lmc->mailboxes[lmc->cpu.pc++];
+		lmc->cpu.opcode = lmc->cpu.instruction / NUM_MAILBOXES;
+		lmc->cpu.addr = lmc->cpu.instruction % NUM_MAILBOXES;
+
+		if (lmc->cpu.pc == NUM_MAILBOXES) /* wrap around, don't run off */
+			lmc->cpu.pc = 0;
+
+		if (lmc->cpu.opcode > 9 || (op = OPS[lmc->cpu.opcode]) == NULL)
+		{
+			bad_instruction(lmc);
+			break;
+		}
+
+		op(lmc);
+	}
+
+	sampling = 0;
+}
+
+int
+sample_start(int hz)
+{
+	struct sigaction sa;
+	struct itimerval timer;
+	long usec;
+
+	memset(&sa, 0, sizeof sa);
+	sa.sa_handler = on_sigprof;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+
+	sample_hz = hz;
+
+	if (sigaction(SIGPROF, &sa, NULL))
+	{
+		fprintf(stderr, "Failed to install SIGPROF handler: %s\n",
+			strerror(errno));
+		return 1;
+	}
+
+	/* tv_usec must stay below a second */
+	usec = 1000000L / hz;
+	if (0 == usec)
+		usec = 1;
+
+	timer.it_interval.tv_sec = usec / 1000000L;
+	timer.it_interval.tv_usec = usec % 1000000L;
+
+	timer.it_value = timer.it_interval;
+	if (setitimer(ITIMER_PROF, &timer, NULL))
+	{
+		fprintf(stderr, "Failed to start sampling timer: %s\n",
+			strerror(errno));
+		return 1;
+	}
+
+	return 0;
+}
+
+void
+sample_stop(void)
+{
+	struct itimerval timer;
+
+	memset(&timer, 0, sizeof timer);
+	setitimer(ITIMER_PROF, &timer, NULL);
+	signal(SIGPROF, SIG_IGN);
+}
+
+int
+sample_report(FILE *out, const struct lmc *lmc, const struct lmc_srcmap *map)
+{
+	unsigned long total = num_samples;
+	int i, j, order[NUM_MAILBOXES], n = 0;
+
+	for (i = 0; i < NUM_MAILBOXES; ++i)
+	{
+		if (0 == samples[i])
+			continue;
+
+		/* insertion sort, most samples first */
+		for (j = n; j > 0 && samples[order[j - 1]] < samples[i]; --j)
+			order[j] = order[j - 1];
+
+		order[j] = i;
+		++n;
+	}
+
+	fprintf(out, "\nSampled profile: %lu samples at %d Hz\n", total,
+		sample_hz);
+	if (0 == total)
+	{
+		fprintf(out, "  (run too short to sample)\n");
+		return ferror(out) ? -1 : 0;
+	}
+
+	fprintf(out, "%4s  %-6s %10s %7s", "box", "insn", "samples", "%");
+	if (map)
+		fprintf(out, "  source");
+	fputc('\n', out);
+
+	for (i = 0; i < n; ++i)
+	{
+		int box = order[i];
+		const char *name = lmc_mnemonic(lmc->mailboxes[box]);
+
+		fprintf(out, "%4d  %-6s %10lu %6.2f%%", box,
+			name ? name : "???", samples[box],
+			100.0 * samples[box] / total);
+
+		if (map && map->lines[box])
+		{
+			fprintf(out, "  %s:%d (%s)", map->file,
+				map->lines[box], map->labels[box]);
+		}
+
+		fputc('\n', out);
+	}
+
+	return ferror(out) ? -1 : 0;
+}
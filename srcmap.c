@@ -0,0 +1,122 @@
+/*
+ * lmc - Little Man Computer
+ * Copyright (C) 2020 David McMackins II
+ *
+ * Redistributions, modified or unmodified, in whole or in part, must retain
+ * applicable copyright or other legal privilege notices, these conditions, and
+ * the following license terms and disclaimer.  Subject to these conditions,
+ * the holder(s) of copyright or other legal privileges, author(s) or
+ * assembler(s), and contributors of this work hereby grant to any person who
+ * obtains a copy of this work in any form:
+ *
+ * 1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ * use, and/or otherwise deal in the licensed material without restriction.
+ *
+ * 2. A perpetual, worldwide, non-exclusive, royalty-free, irrevocable patent
+ * license to reproduce, modify, distribute, publish, sell, use, and/or
+ * otherwise deal in the licensed material without restriction, for any and all
+ * patents:
+ *
+ *     a. Held by each such holder of copyright or other legal privilege,
+ *     author or assembler, or contributor, necessarily infringed by the
+ *     contributions alone or by combination with the work, of that privilege
+ *     holder, author or assembler, or contributor.
+ *
+ *     b. Necessarily infringed by the work at the time that holder of
+ *     copyright or other privilege, author or assembler, or contributor made
+ *     any contribution to the work.
+ *
+ * NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ * LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ * A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ * ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ * ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT, TORT,
+ * OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR THE USE
+ * OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "srcmap.h"
+
+int
+srcmap_load(struct lmc_srcmap *map, const char *path)
+{
+	FILE *map_file;
+	char line[SRCMAP_MAX_PATH_LEN + 8];
+	char label[SRCMAP_MAX_LABEL_LEN + 1];
+	int i, mailbox, source_line, rc = 0, version;
+	size_t len;
+
+	memset(map, 0, sizeof *map);
+	for (i = 0; i < NUM_MAILBOXES; ++i)
+		strcpy(map->labels[i], "-");
+
+	map_file = fopen(path, "r");
+	if (!map_file)
+	{
+		fprintf(stderr, "Error opening %s: %s\n", path,
+			strerror(errno));
+		return 1;
+	}
+
+	if (fscanf(map_file, "lmasm-map %d\n", &version) != 1 || version != 1)
+	{
+		fprintf(stderr, "%s is not an lmasm source map\n", path);
+		rc = 1;
+		goto end;
+	}
+
+	if (!fgets(line, sizeof line, map_file)
+		|| strncmp(line, "file ", 5) != 0)
+	{
+		fprintf(stderr, "%s: missing source file name\n", path);
+		rc = 1;
+		goto end;
+	}
+
+	/* a line that didn't fit stops short of its newline */
+	len = strcspn(line, "\n");
+	if ((!line[len] && !feof(map_file)) || len - 5 >= sizeof map->file)
+	{
+		fprintf(stderr, "%s: source file name is longer than %d "
+			"characters\n", path, SRCMAP_MAX_PATH_LEN);
+		rc = 1;
+		goto end;
+	}
+
+	line[len] = '\0';
+	strcpy(map->file, line + 5);
+
+	/* %32s must track SRCMAP_MAX_LABEL_LEN */
+	while ((rc = fscanf(map_file, "%d %d %32s", &mailbox, &source_line,
+				label)) == 3)
+	{
+		if (mailbox < 0 || mailbox >= NUM_MAILBOXES)
+		{
+			fprintf(stderr, "%s: mailbox %d out of range\n", path,
+				mailbox);
+			rc = 1;
+			goto end;
+		}
+
+		map->lines[mailbox] = source_line;
+		strcpy(map->labels[mailbox], label);
+	}
+
+	if (rc != EOF || ferror(map_file))
+	{
+		fprintf(stderr, "Error reading %s\n", path);
+		rc = 1;
+		goto end;
+	}
+
+	rc = 0;
+
+end:
+	fclose(map_file);
+	return rc;
+}
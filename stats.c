@@ -0,0 +1,400 @@
+/*
+ * lmc - Little Man Computer
+ * Copyright (C) 2020 David McMackins II
+ *
+ * Redistributions, modified or unmodified, in whole or in part, must retain
+ * applicable copyright or other legal privilege notices, these conditions, and
+ * the following license terms and disclaimer.  Subject to these conditions,
+ * the holder(s) of copyright or other legal privileges, author(s) or
+ * assembler(s), and contributors of this work hereby grant to any person who
+ * obtains a copy of this work in any form:
+ *
+ * 1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ * use, and/or otherwise deal in the licensed material without restriction.
+ *
+ * 2. A perpetual, worldwide, non-exclusive, royalty-free, irrevocable patent
+ * license to reproduce, modify, distribute, publish, sell, use, and/or
+ * otherwise deal in the licensed material without restriction, for any and all
+ * patents:
+ *
+ *     a. Held by each such holder of copyright or other legal privilege,
+ *     author or assembler, or contributor, necessarily infringed by the
+ *     contributions alone or by combination with the work, of that privilege
+ *     holder, author or assembler, or contributor.
+ *
+ *     b. Necessarily infringed by the work at the time that holder of
+ *     copyright or other privilege, author or assembler, or contributor made
+ *     any contribution to the work.
+ *
+ * NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ * LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ * A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ * ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ * ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT, TORT,
+ * OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR THE USE
+ * OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#define _DEFAULT_SOURCE /* syscall() */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __linux__
+# include <linux/perf_event.h>
+# include <sys/ioctl.h>
+# include <sys/syscall.h>
+# include <unistd.h>
+#endif
+
+#include "stats.h"
+
+static const char *const HW_EVENT_NAMES[STATS_NUM_HW_EVENTS] =
+{
+	"cycles",
+	"instructions",
+	"branch_misses",
+	"cache_misses"
+};
+
+#ifdef __linux__
+static const unsigned long HW_EVENT_CONFIGS[STATS_NUM_HW_EVENTS] =
+{
+	PERF_COUNT_HW_CPU_CYCLES,
+	PERF_COUNT_HW_INSTRUCTIONS,
+	PERF_COUNT_HW_BRANCH_MISSES,
+	PERF_COUNT_HW_CACHE_MISSES
+};
+
+static int
+open_hw_counter(unsigned long config)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.size = sizeof attr;
+	attr.config = config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+void
+stats_init(struct lmc_stats *stats, bool hw)
+{
+	int i;
+
+	memset(stats, 0, sizeof *stats);
+	stats->hw = hw;
+
+	for (i = 0; i < STATS_NUM_HW_EVENTS; ++i)
+	{
+		stats->hw_fds[i] = -1;
+		stats->hw_errors[i] = ENOSYS;
+
+#ifdef __linux__
+		if (!hw)
+			continue;
+
+		stats->hw_fds[i] = open_hw_counter(HW_EVENT_CONFIGS[i]);
+		stats->hw_errors[i] = stats->hw_fds[i] < 0 ? errno : 0;
+#endif
+	}
+}
+
+void
+stats_close(struct lmc_stats *stats)
+{
+#ifdef __linux__
+	int i;
+
+	for (i = 0; i < STATS_NUM_HW_EVENTS; ++i)
+	{
+		if (stats->hw_fds[i] >= 0)
+			close(stats->hw_fds[i]);
+
+		stats->hw_fds[i] = -1;
+	}
+#else
+	UNUSED(stats);
+#endif
+}
+
+static void
+hw_counters(struct lmc_stats *stats, bool enable)
+{
+#ifdef __linux__
+	uint64_t count;
+	int i;
+
+	for (i = 0; i < STATS_NUM_HW_EVENTS; ++i)
+	{
+		if (stats->hw_fds[i] < 0)
+			continue;
+
+		if (enable)
+		{
+			ioctl(stats->hw_fds[i], PERF_EVENT_IOC_RESET, 0);
+			ioctl(stats->hw_fds[i], PERF_EVENT_IOC_ENABLE, 0);
+			continue;
+		}
+
+		ioctl(stats->hw_fds[i], PERF_EVENT_IOC_DISABLE, 0);
+		if (read(stats->hw_fds[i], &count, sizeof count) != sizeof count)
+			stats->hw_errors[i] = errno ? errno : EIO;
+		else
+			stats->hw_counts[i] += count;
+	}
+#else
+	UNUSED(stats);
+	UNUSED(enable);
+#endif
+}
+
+static volatile sig_atomic_t progress_requested;
+
+static void
+on_sigusr1(int sig)
+{
+	UNUSED(sig);
+	progress_requested = 1;
+}
+
+static uint64_t
+now_ns(clockid_t clock)
+{
+	struct timespec ts;
+
+	if (clock_gettime(clock, &ts))
+		return 0;
+
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+double
+stats_mips(uint64_t instructions, uint64_t ns)
+{
+	return ns ? (double) instructions * 1000.0 / (double) ns : 0.0;
+}
+
+static void
+report_progress(uint64_t instructions, uint64_t wall_start)
+{
+	uint64_t elapsed = now_ns(CLOCK_MONOTONIC) - wall_start;
+
+	fprintf(stderr, "lmc: %" PRIu64 " instructions in %.3fs (%.2f MIPS)\n",
+		instructions, elapsed / 1e9, stats_mips(instructions, elapsed));
+}
+
+void
+lmc_run_counted(struct lmc *lmc, struct lmc_stats *stats)
+{
+	struct sigaction sa, old_sa;
+	uint64_t n = 0, wall_start, cpu_start;
+
+	memset(&sa, 0, sizeof sa);
+	sa.sa_handler = on_sigusr1;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	progress_requested = 0;
+	sigaction(SIGUSR1, &sa, &old_sa);
+
+	wall_start = now_ns(CLOCK_MONOTONIC);
+	cpu_start = now_ns(CLOCK_PROCESS_CPUTIME_ID);
+	hw_counters(stats, true);
+
+	while (!lmc->cpu.halted)
+	{
+		lmc_op op;
+
+		lmc->cpu.instruction = lmc->mailboxes[lmc->cpu.pc++];
+		lmc->cpu.opcode = lmc->cpu.instruction / NUM_MAILBOXES;
+		lmc->cpu.addr = lmc->cpu.instruction % NUM_MAILBOXES;
+
+		if (lmc->cpu.pc == NUM_MAILBOXES) /* wrap around, don't run off */
+			lmc->cpu.pc = 0;
+
+		++n; /* a bad instruction counts, as it does for the engines */
+		if (lmc->cpu.opcode > 9 || (op = OPS[lmc->cpu.opcode]) == NULL)
+		{
+			bad_instruction(lmc);
+			break;
+		}
+
+		op(lmc);
+
+		/* branches and I/O end a basic block; only check there */
+		if (lmc->cpu.opcode < 6)
+			continue;
+
+		if (9 == lmc->cpu.opcode)
+		{
+			if (1 == lmc->cpu.addr)
+				++stats->inputs;
+			else if (2 == lmc->cpu.addr)
+				++stats->outputs;
+		}
+
+		if (progress_requested)
+		{
+			progress_requested = 0;
+			report_progress(stats->instructions + n, wall_start);
+		}
+	}
+
+	hw_counters(stats, false);
+	stats->cpu_ns += now_ns(CLOCK_PROCESS_CPUTIME_ID) - cpu_start;
+	stats->wall_ns += now_ns(CLOCK_MONOTONIC) - wall_start;
+	stats->instructions += n;
+	stats->error = stats->error || lmc->cpu.error;
+
+	sigaction(SIGUSR1, &old_sa, NULL);
+}
+
+/* how many instructions an engine runs between looks at SIGUSR1; enough
+   that restarting a predecoded or tiered engine costs nothing measurable */
+#define ENGINE_CHUNK (UINT64_C(1) << 24)
+
+void
+lmc_run_engine_counted(struct lmc *lmc, const struct lmc_engine *engine,
+	uint64_t steps, struct lmc_stats *stats)
+{
+	struct sigaction sa, old_sa;
+	uint64_t n = 0, wall_start, cpu_start;
+	uint64_t inputs = lmc->inputs, outputs = lmc->outputs;
+
+	memset(&sa, 0, sizeof sa);
+	sa.sa_handler = on_sigusr1;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	progress_requested = 0;
+	sigaction(SIGUSR1, &sa, &old_sa);
+
+	wall_start = now_ns(CLOCK_MONOTONIC);
+	cpu_start = now_ns(CLOCK_PROCESS_CPUTIME_ID);
+	hw_counters(stats, true);
+
+	while (!lmc->cpu.halted && n < steps)
+	{
+		n += engine->run_for(lmc,
+			steps - n < ENGINE_CHUNK ? steps - n : ENGINE_CHUNK);
+
+		if (progress_requested)
+		{
+			progress_requested = 0;
+			report_progress(stats->instructions + n, wall_start);
+		}
+	}
+
+	hw_counters(stats, false);
+	stats->cpu_ns += now_ns(CLOCK_PROCESS_CPUTIME_ID) - cpu_start;
+	stats->wall_ns += now_ns(CLOCK_MONOTONIC) - wall_start;
+	stats->instructions += n;
+	stats->inputs += lmc->inputs - inputs;
+	stats->outputs += lmc->outputs - outputs;
+	stats->error = stats->error || lmc->cpu.error;
+
+	sigaction(SIGUSR1, &old_sa, NULL);
+}
+
+static bool
+hw_valid(const struct lmc_stats *stats, int event)
+{
+	return stats->hw && 0 == stats->hw_errors[event];
+}
+
+int
+stats_report(FILE *out, const struct lmc_stats *stats)
+{
+	int i;
+
+	fprintf(out, "\nInstructions executed: %" PRIu64 "\n",
+		stats->instructions);
+	fprintf(out, "Inputs consumed:       %" PRIu64 "\n", stats->inputs);
+	fprintf(out, "Outputs produced:      %" PRIu64 "\n", stats->outputs);
+	fprintf(out, "Wall time:             %.6fs (%.2f MIPS)\n",
+		stats->wall_ns / 1e9,
+		stats_mips(stats->instructions, stats->wall_ns));
+	fprintf(out, "CPU time:              %.6fs (%.2f MIPS)\n",
+		stats->cpu_ns / 1e9, stats_mips(stats->instructions, stats->cpu_ns));
+
+	if (!stats->hw)
+		return ferror(out) ? -1 : 0;
+
+	fprintf(out, "Host events:\n");
+	for (i = 0; i < STATS_NUM_HW_EVENTS; ++i)
+	{
+		if (!hw_valid(stats, i))
+		{
+			fprintf(out, "  %-14s unavailable (%s)\n",
+				HW_EVENT_NAMES[i], strerror(stats->hw_errors[i]));
+			continue;
+		}
+
+		fprintf(out, "  %-14s %14" PRIu64, HW_EVENT_NAMES[i],
+			stats->hw_counts[i]);
+		if (stats->instructions)
+		{
+			fprintf(out, "  %10.3f per instruction",
+				(double) stats->hw_counts[i]
+				/ (double) stats->instructions);
+		}
+
+		fputc('\n', out);
+	}
+
+	return ferror(out) ? -1 : 0;
+}
+
+int
+stats_write_json(FILE *out, const struct lmc_stats *stats)
+{
+	int i;
+
+	fprintf(out, "{\"instructions\": %" PRIu64 ", \"inputs\": %" PRIu64
+		", \"outputs\": %" PRIu64 ", \"wall_seconds\": %.9f"
+		", \"cpu_seconds\": %.9f, \"mips\": %.3f, \"error\": %s",
+		stats->instructions, stats->inputs, stats->outputs,
+		stats->wall_ns / 1e9, stats->cpu_ns / 1e9,
+		stats_mips(stats->instructions, stats->cpu_ns),
+		stats->error ? "true" : "false");
+
+	if (stats->hw)
+	{
+		fprintf(out, ", \"hw\": {");
+		for (i = 0; i < STATS_NUM_HW_EVENTS; ++i)
+		{
+			fprintf(out, "%s\"%s\": ", i ? ", " : "",
+				HW_EVENT_NAMES[i]);
+
+			if (!hw_valid(stats, i))
+			{
+				fprintf(out, "null");
+				continue;
+			}
+
+			fprintf(out, "{\"count\": %" PRIu64, stats->hw_counts[i]);
+			if (stats->instructions)
+			{
+				fprintf(out, ", \"per_instruction\": %.6f",
+					(double) stats->hw_counts[i]
+					/ (double) stats->instructions);
+			}
+
+			fputc('}', out);
+		}
+
+		fputc('}', out);
+	}
+
+	fprintf(out, "}\n");
+	return ferror(out) ? -1 : 0;
+}
@@ -0,0 +1,102 @@
+/*
+ * lmc - Little Man Computer
+ * Copyright (C) 2020 David McMackins II
+ *
+ * Redistributions, modified or unmodified, in whole or in part, must retain
+ * applicable copyright or other legal privilege notices, these conditions, and
+ * the following license terms and disclaimer.  Subject to these conditions,
+ * the holder(s) of copyright or other legal privileges, author(s) or
+ * assembler(s), and contributors of this work hereby grant to any person who
+ * obtains a copy of this work in any form:
+ *
+ * 1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ * use, and/or otherwise deal in the licensed material without restriction.
+ *
+ * 2. A perpetual, worldwide, non-exclusive, royalty-free, irrevocable patent
+ * license to reproduce, modify, distribute, publish, sell, use, and/or
+ * otherwise deal in the licensed material without restriction, for any and all
+ * patents:
+ *
+ *     a. Held by each such holder of copyright or other legal privilege,
+ *     author or assembler, or contributor, necessarily infringed by the
+ *     contributions alone or by combination with the work, of that privilege
+ *     holder, author or assembler, or contributor.
+ *
+ *     b. Necessarily infringed by the work at the time that holder of
+ *     copyright or other privilege, author or assembler, or contributor made
+ *     any contribution to the work.
+ *
+ * NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ * LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ * A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ * ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ * ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT, TORT,
+ * OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR THE USE
+ * OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#ifndef LMC_STATS_H
+#define LMC_STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "lmc.h"
+
+enum stats_hw_event
+{
+	STATS_CYCLES,
+	STATS_INSTRUCTIONS,
+	STATS_BRANCH_MISSES,
+	STATS_CACHE_MISSES,
+	STATS_NUM_HW_EVENTS
+};
+
+/* what one or more counted runs added up to */
+struct lmc_stats
+{
+	uint64_t instructions; /* emulated, not host */
+	uint64_t inputs;
+	uint64_t outputs;
+	uint64_t wall_ns;
+	uint64_t cpu_ns;
+	bool error; /* any of them ended on an error */
+
+	bool hw;
+	int hw_fds[STATS_NUM_HW_EVENTS];
+	int hw_errors[STATS_NUM_HW_EVENTS]; /* errno if the counter failed */
+	uint64_t hw_counts[STATS_NUM_HW_EVENTS];
+};
+
+/* opens the host performance counters if hw is set; counters that can't
+   be opened are reported as unavailable rather than failing the run */
+void
+stats_init(struct lmc_stats *stats, bool hw);
+
+void
+stats_close(struct lmc_stats *stats);
+
+/* lmc_run() plus run metrics, with the host counters enabled only around
+   the execution loop; SIGUSR1 prints progress to stderr while it runs */
+void
+lmc_run_counted(struct lmc *lmc, struct lmc_stats *stats);
+
+/* the same for one of the engines, for at most steps instructions; it
+   runs in chunks of its run_for so progress can still be reported between
+   them */
+void
+lmc_run_engine_counted(struct lmc *lmc, const struct lmc_engine *engine,
+	uint64_t steps, struct lmc_stats *stats);
+
+/* millions of instructions per second, 0 if no time passed */
+double
+stats_mips(uint64_t instructions, uint64_t ns);
+
+int
+stats_report(FILE *out, const struct lmc_stats *stats);
+
+int
+stats_write_json(FILE *out, const struct lmc_stats *stats);
+
+#endif
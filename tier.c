@@ -0,0 +1,559 @@
+/*
+ * tier.c - Tiered execution engine
+ * Copyright (C) 2020 David McMackins II
+ *
+ * Redistributions, modified or unmodified, in whole or in part, must retain
+ * applicable copyright or other legal privilege notices, these conditions, and
+ * the following license terms and disclaimer.  Subject to these conditions,
+ * the holder(s) of copyright or other legal privileges, author(s) or
+ * assembler(s), and contributors of this work hereby grant to any person who
+ * obtains a copy of this work in any form:
+ *
+ * 1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ * use, and/or otherwise deal in the licensed material without restriction.
+ *
+ * 2. A perpetual, worldwide, non-exclusive, royalty-free, irrevocable patent
+ * license to reproduce, modify, distribute, publish, sell, use, and/or
+ * otherwise deal in the licensed material without restriction, for any and all
+ * patents:
+ *
+ *     a. Held by each such holder of copyright or other legal privilege,
+ *     author or assembler, or contributor, necessarily infringed by the
+ *     contributions alone or by combination with the work, of that privilege
+ *     holder, author or assembler, or contributor.
+ *
+ *     b. Necessarily infringed by the work at the time that holder of
+ *     copyright or other privilege, author or assembler, or contributor made
+ *     any contribution to the work.
+ *
+ * NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ * LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ * A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ * ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ * ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT, TORT,
+ * OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR THE USE
+ * OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "lmc.h"
+#include "tier.h"
+
+#define TIER_HOT 64 /* backward branches to a mailbox before compiling */
+#define TIER_MAX_DEOPTS 4 /* times a loop is thrown away before giving up */
+
+enum tier_kind
+{
+	T_ADD,
+	T_SUB,
+	T_STA,
+	T_LDA,
+	T_BRA,
+	T_BRZ,
+	T_BRP,
+	T_DYNAMIC, /* decoded from its register each time: code the loops
+		      store to, like an array walk's LDA */
+	T_EXIT /* leaves the loop before this mailbox */
+};
+
+/* a loop can use every mailbox, so all of these are as wide as an
+   address */
+struct tier_op
+{
+	int kind;
+	int reg; /* register holding the mailbox it uses */
+	int target; /* op a branch goes to, or -1 if it leaves the loop */
+	int mailbox; /* where the op came from */
+	int instruction;
+};
+
+/* a loop from start to the backward branch at end */
+struct tier_loop
+{
+	int start;
+	int end;
+	int num_regs;
+	bool dynamic; /* has T_DYNAMIC ops, which may store anywhere */
+	int mailboxes[NUM_MAILBOXES]; /* what each register holds */
+	int reg_of[NUM_MAILBOXES]; /* -1 if a mailbox isn't in one */
+	bool stores[NUM_MAILBOXES]; /* mailboxes its STA ops store to */
+	struct tier_op ops[NUM_MAILBOXES + 1]; /* the last one leaves */
+};
+
+struct lmc_tiered
+{
+	struct lmc *lmc;
+	struct tier_loop *loops[NUM_MAILBOXES]; /* by start */
+	unsigned heat[NUM_MAILBOXES];
+	unsigned char deopts[NUM_MAILBOXES];
+	unsigned covered[NUM_MAILBOXES]; /* loops compiled from each */
+};
+
+static void
+discard(struct lmc_tiered *t, int start)
+{
+	struct tier_loop *loop = t->loops[start];
+	int i;
+
+	for (i = loop->start; i <= loop->end; ++i)
+		--t->covered[i];
+
+	free(loop);
+	t->loops[start] = NULL;
+	t->heat[start] = 0;
+	if (t->deopts[start] < TIER_MAX_DEOPTS)
+		++t->deopts[start];
+}
+
+/* throws away the compiled loops a store changed an instruction in */
+static void
+invalidate(struct lmc_tiered *t, int mailbox)
+{
+	int i;
+
+	for (i = 0; i <= mailbox && t->covered[mailbox]; ++i)
+	{
+		const struct tier_loop *loop = t->loops[i];
+		const struct tier_op *op;
+
+		if (!loop || loop->end < mailbox)
+			continue;
+
+		op = &loop->ops[mailbox - i];
+		if (op->kind != T_DYNAMIC
+			&& op->instruction != t->lmc->mailboxes[mailbox])
+		{
+			discard(t, i);
+		}
+	}
+}
+
+static int
+reg_for(struct tier_loop *loop, int mailbox)
+{
+	if (loop->reg_of[mailbox] < 0)
+	{
+		loop->reg_of[mailbox] = loop->num_regs;
+		loop->mailboxes[loop->num_regs++] = mailbox;
+	}
+
+	return loop->reg_of[mailbox];
+}
+
+static void
+compile(struct lmc_tiered *t, int start, int end)
+{
+	struct tier_loop *loop;
+	bool dynamic[NUM_MAILBOXES];
+	int i, j, len = end - start + 1;
+
+	if (t->loops[start] || t->deopts[start] >= TIER_MAX_DEOPTS)
+		return;
+
+	loop = malloc(sizeof *loop);
+	if (!loop)
+		return; /* it can stay in the interpreter */
+
+	loop->start = start;
+	loop->end = end;
+	loop->num_regs = 0;
+	loop->dynamic = false;
+	for (i = 0; i < NUM_MAILBOXES; ++i)
+	{
+		loop->reg_of[i] = -1;
+		loop->stores[i] = false;
+	}
+
+	for (i = start; i <= end; ++i)
+	{
+		int instruction = t->lmc->mailboxes[i];
+
+		if (3 == instruction / NUM_MAILBOXES)
+			loop->stores[instruction % NUM_MAILBOXES] = true;
+	}
+
+	/* code this loop or any other stores to is decoded as it runs */
+	for (i = start; i <= end; ++i)
+	{
+		dynamic[i] = loop->stores[i];
+		for (j = 0; j < NUM_MAILBOXES && !dynamic[i]; ++j)
+		{
+			if (t->loops[j] && t->loops[j]->stores[i])
+				dynamic[i] = true;
+		}
+	}
+
+	for (i = 0; i <= len; ++i)
+	{
+		struct tier_op *op = &loop->ops[i];
+		int instruction = i < len ? t->lmc->mailboxes[start + i] : -1;
+		int opcode = instruction / NUM_MAILBOXES;
+		int addr = instruction % NUM_MAILBOXES;
+
+		op->instruction = instruction;
+		op->mailbox = (start + i) % NUM_MAILBOXES;
+		op->target = -1;
+		op->reg = 0;
+
+		if (i < len && dynamic[start + i])
+			opcode = -2;
+		else if (instruction < 0)
+			opcode = -1;
+
+		switch (opcode)
+		{
+		case 1:
+		case 2:
+		case 3:
+		case 5:
+			op->reg = reg_for(loop, addr);
+			op->kind = 1 == opcode ? T_ADD : 2 == opcode ? T_SUB
+				: 3 == opcode ? T_STA : T_LDA;
+			break;
+
+		case 6:
+		case 7:
+		case 8:
+			op->kind = 6 == opcode ? T_BRA : 7 == opcode ? T_BRZ
+				: T_BRP;
+			if (addr >= start && addr <= end)
+				op->target = addr - start;
+			break;
+
+		case -2:
+			op->reg = reg_for(loop, start + i);
+			op->kind = T_DYNAMIC;
+			loop->dynamic = true;
+			break;
+
+		default: /* HLT, I/O and bad instructions */
+			op->kind = T_EXIT;
+			break;
+		}
+	}
+
+	for (i = start; i <= end; ++i)
+		++t->covered[i];
+
+	t->loops[start] = loop;
+}
+
+/* runs a compiled loop from its start until it leaves or has run steps
+   instructions; returns how many it ran */
+static uint64_t
+run_loop(struct lmc_tiered *t, struct tier_loop *loop, uint64_t steps)
+{
+	struct lmc *lmc = t->lmc;
+	const struct tier_op *op = loop->ops;
+	int regs[NUM_MAILBOXES];
+	int a = lmc->cpu.a, pc, i, r, addr, target, last = -1, changed = -1;
+	bool neg = lmc->cpu.neg;
+	uint64_t n;
+
+	for (i = 0; i < loop->num_regs; ++i)
+		regs[i] = lmc->mailboxes[loop->mailboxes[i]];
+
+	for (n = 0; ; ++n)
+	{
+		if (n == steps)
+		{
+			pc = op->mailbox;
+			goto leave;
+		}
+
+		switch (op->kind)
+		{
+		case T_ADD:
+			a += regs[op->reg];
+			neg = a > MAX_VALUE;
+			if (neg)
+				a -= MAX_VALUE + 1;
+			break;
+
+		case T_SUB:
+			a -= regs[op->reg];
+			neg = a < 0;
+			if (neg)
+				a += MAX_VALUE + 1;
+			break;
+
+		case T_STA:
+			regs[op->reg] = a;
+			break;
+
+		case T_LDA:
+			a = regs[op->reg];
+			break;
+
+		case T_BRA:
+			target = op->target;
+			goto taken;
+
+		case T_BRZ:
+			target = op->target;
+			if (0 == a)
+				goto taken;
+			break;
+
+		case T_BRP:
+			target = op->target;
+			if (!neg)
+				goto taken;
+			break;
+
+		case T_DYNAMIC:
+			addr = regs[op->reg] % NUM_MAILBOXES;
+			r = loop->reg_of[addr];
+			target = addr >= loop->start && addr <= loop->end
+				? addr - loop->start : -1;
+
+			switch (regs[op->reg] / NUM_MAILBOXES)
+			{
+			case 1:
+				a += r >= 0 ? regs[r] : lmc->mailboxes[addr];
+				neg = a > MAX_VALUE;
+				if (neg)
+					a -= MAX_VALUE + 1;
+				break;
+
+			case 2:
+				a -= r >= 0 ? regs[r] : lmc->mailboxes[addr];
+				neg = a < 0;
+				if (neg)
+					a += MAX_VALUE + 1;
+				break;
+
+			case 3:
+				if (r >= 0)
+					regs[r] = a;
+				else
+					lmc->mailboxes[addr] = a;
+
+				/* a new instruction for this loop as compiled */
+				if (target >= 0
+					&& loop->ops[target].kind != T_DYNAMIC)
+				{
+					last = regs[op->reg];
+					++n;
+					pc = (op->mailbox + 1) % NUM_MAILBOXES;
+					changed = addr;
+					goto leave;
+				}
+
+				if (r < 0 && t->covered[addr])
+					invalidate(t, addr);
+				break;
+
+			case 5:
+				a = r >= 0 ? regs[r] : lmc->mailboxes[addr];
+				break;
+
+			case 6:
+				goto taken_dynamic;
+
+			case 7:
+				if (0 == a)
+					goto taken_dynamic;
+				break;
+
+			case 8:
+				if (!neg)
+					goto taken_dynamic;
+				break;
+
+			default:
+				pc = op->mailbox;
+				goto leave;
+			}
+
+			last = regs[op->reg];
+			++op;
+			continue;
+
+taken_dynamic:
+			last = regs[op->reg];
+			goto branch;
+
+		default:
+			pc = op->mailbox;
+			goto leave;
+		}
+
+		last = op->instruction;
+		++op;
+		continue;
+
+taken:
+		last = op->instruction;
+		addr = last % NUM_MAILBOXES;
+branch:
+		if (target < 0)
+		{
+			++n;
+			pc = addr;
+			goto leave;
+		}
+
+		op = &loop->ops[target];
+	}
+
+leave:
+	for (i = 0; i < loop->num_regs; ++i)
+		lmc->mailboxes[loop->mailboxes[i]] = regs[i];
+
+	lmc->cpu.a = a;
+	lmc->cpu.neg = neg;
+	lmc->cpu.pc = pc;
+
+	if (last >= 0)
+	{
+		lmc->cpu.instruction = last;
+		lmc->cpu.opcode = last / NUM_MAILBOXES;
+		lmc->cpu.addr = last % NUM_MAILBOXES;
+	}
+
+	/* loops may have been compiled from what this one stored; collected
+	   first, since this one may be thrown away too */
+	for (i = 0, r = 0; i < loop->num_regs; ++i)
+	{
+		int mailbox = loop->mailboxes[i];
+
+		if (t->covered[mailbox] && mailbox != changed
+			&& (loop->dynamic || loop->stores[mailbox]))
+		{
+			regs[r++] = mailbox;
+		}
+	}
+
+	if (changed >= 0)
+		regs[r++] = changed;
+
+	for (i = 0; i < r; ++i)
+		invalidate(t, regs[i]);
+
+	return n;
+}
+
+static uint64_t
+tier_run(struct lmc_tiered *t, uint64_t steps)
+{
+	struct lmc *lmc = t->lmc;
+	struct lmc_cpu *cpu = &lmc->cpu;
+	uint64_t n = 0;
+
+	while (n < steps && !cpu->halted)
+	{
+		int pc = cpu->pc, instruction;
+
+		if (t->loops[pc])
+		{
+			uint64_t ran = run_loop(t, t->loops[pc], steps - n);
+
+			n += ran;
+			if (ran)
+				continue;
+		}
+
+		instruction = lmc->mailboxes[pc];
+		cpu->instruction = instruction;
+		cpu->opcode = instruction / NUM_MAILBOXES;
+		cpu->addr = instruction % NUM_MAILBOXES;
+		cpu->pc = pc + 1 == NUM_MAILBOXES ? 0 : pc + 1;
+		++n;
+
+		switch (cpu->opcode)
+		{
+		case 0:
+			cpu->halted = true;
+			break;
+
+		case 1:
+			cpu->a += lmc->mailboxes[cpu->addr];
+			cpu->neg = cpu->a > MAX_VALUE;
+			if (cpu->neg)
+				cpu->a -= MAX_VALUE + 1;
+			break;
+
+		case 2:
+			cpu->a -= lmc->mailboxes[cpu->addr];
+			cpu->neg = cpu->a < 0;
+			if (cpu->neg)
+				cpu->a += MAX_VALUE + 1;
+			break;
+
+		case 3:
+			lmc->mailboxes[cpu->addr] = cpu->a;
+			if (t->covered[cpu->addr])
+				invalidate(t, cpu->addr);
+			break;
+
+		case 5:
+			cpu->a = lmc->mailboxes[cpu->addr];
+			break;
+
+		case 6:
+			cpu->pc = cpu->addr;
+			break;
+
+		case 7:
+			if (0 == cpu->a)
+				cpu->pc = cpu->addr;
+			break;
+
+		case 8:
+			if (!cpu->neg)
+				cpu->pc = cpu->addr;
+			break;
+
+		case 9:
+			OPS[9](lmc);
+			break;
+
+		default:
+			bad_instruction(lmc);
+			break;
+		}
+
+		/* a backward branch taken: the end of a loop */
+		if (cpu->pc == cpu->addr && cpu->addr <= pc
+			&& cpu->opcode >= 6 && cpu->opcode <= 8
+			&& t->heat[cpu->addr] < TIER_HOT
+			&& ++t->heat[cpu->addr] == TIER_HOT)
+		{
+			compile(t, cpu->addr, pc);
+		}
+	}
+
+	return n;
+}
+
+static void
+tier_free(struct lmc_tiered *t)
+{
+	int i;
+
+	for (i = 0; i < NUM_MAILBOXES; ++i)
+		free(t->loops[i]);
+}
+
+void
+lmc_run_tiered(struct lmc *lmc)
+{
+	lmc_run_tiered_for(lmc, UINT64_MAX);
+}
+
+uint64_t
+lmc_run_tiered_for(struct lmc *lmc, uint64_t steps)
+{
+	struct lmc_tiered t;
+	uint64_t n;
+
+	memset(&t, 0, sizeof t);
+	t.lmc = lmc;
+	n = tier_run(&t, steps);
+	tier_free(&t);
+	return n;
+}
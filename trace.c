@@ -0,0 +1,397 @@
+/*
+ * lmc - Little Man Computer
+ * Copyright (C) 2020 David McMackins II
+ *
+ * Redistributions, modified or unmodified, in whole or in part, must retain
+ * applicable copyright or other legal privilege notices, these conditions, and
+ * the following license terms and disclaimer.  Subject to these conditions,
+ * the holder(s) of copyright or other legal privileges, author(s) or
+ * assembler(s), and contributors of this work hereby grant to any person who
+ * obtains a copy of this work in any form:
+ *
+ * 1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ * use, and/or otherwise deal in the licensed material without restriction.
+ *
+ * 2. A perpetual, worldwide, non-exclusive, royalty-free, irrevocable patent
+ * license to reproduce, modify, distribute, publish, sell, use, and/or
+ * otherwise deal in the licensed material without restriction, for any and all
+ * patents:
+ *
+ *     a. Held by each such holder of copyright or other legal privilege,
+ *     author or assembler, or contributor, necessarily infringed by the
+ *     contributions alone or by combination with the work, of that privilege
+ *     holder, author or assembler, or contributor.
+ *
+ *     b. Necessarily infringed by the work at the time that holder of
+ *     copyright or other privilege, author or assembler, or contributor made
+ *     any contribution to the work.
+ *
+ * NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ * LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ * A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ * ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ * ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT, TORT,
+ * OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR THE USE
+ * OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef WITH_ZLIB
+# include <zlib.h>
+#endif
+
+#include "trace.h"
+
+#define TRACE_BUF_SIZE (4UL << 20)
+
+/* flags, pc, accumulator delta and mailbox, with room to spare */
+#define TRACE_MAX_RECORD 32
+
+/*
+ * The execution loop fills one buffer while the writer thread drains the
+ * other, so the hot path never waits on the filesystem unless the disk
+ * falls a whole buffer behind.
+ */
+struct lmc_trace
+{
+	FILE *file;
+#ifdef WITH_ZLIB
+	gzFile gz;
+#endif
+	const char *path;
+	unsigned char *bufs[2];
+	unsigned char *cur;
+	unsigned char *limit;
+	int active;
+	int prev_pc;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	unsigned char *pending;
+	size_t pending_len;
+	bool done;
+	bool error;
+};
+
+static unsigned char *
+put_varint(unsigned char *p, unsigned long value)
+{
+	while (value >= 0x80)
+	{
+		*p++ = (value & 0x7f) | 0x80;
+		value >>= 7;
+	}
+
+	*p++ = value;
+	return p;
+}
+
+static unsigned long
+zigzag(int value)
+{
+	return value < 0 ? 2UL * -(long) value - 1 : 2UL * value;
+}
+
+static int
+trace_write(struct lmc_trace *trace, const void *data, size_t len)
+{
+#ifdef WITH_ZLIB
+	if (trace->gz)
+		return gzwrite(trace->gz, data, len) != (int) len;
+#endif
+
+	return fwrite(data, 1, len, trace->file) != len;
+}
+
+static void *
+trace_writer(void *arg)
+{
+	struct lmc_trace *trace = arg;
+
+	pthread_mutex_lock(&trace->lock);
+	for (;;)
+	{
+		unsigned char *data;
+		size_t len;
+		int rc;
+
+		while (!trace->pending && !trace->done)
+			pthread_cond_wait(&trace->cond, &trace->lock);
+
+		if (!trace->pending)
+			break;
+
+		data = trace->pending;
+		len = trace->pending_len;
+		pthread_mutex_unlock(&trace->lock);
+
+		rc = trace_write(trace, data, len);
+
+		pthread_mutex_lock(&trace->lock);
+		if (rc)
+			trace->error = true;
+
+		trace->pending = NULL;
+		pthread_cond_broadcast(&trace->cond);
+	}
+
+	pthread_mutex_unlock(&trace->lock);
+	return NULL;
+}
+
+/* hands the active buffer to the writer thread and switches to the other */
+static void
+trace_flush(struct lmc_trace *trace)
+{
+	unsigned char *buf = trace->bufs[trace->active];
+
+	pthread_mutex_lock(&trace->lock);
+	while (trace->pending)
+		pthread_cond_wait(&trace->cond, &trace->lock);
+
+	trace->pending = buf;
+	trace->pending_len = trace->cur - buf;
+	pthread_cond_broadcast(&trace->cond);
+	pthread_mutex_unlock(&trace->lock);
+
+	trace->active ^= 1;
+	trace->cur = trace->bufs[trace->active];
+	trace->limit = trace->cur + TRACE_BUF_SIZE - TRACE_MAX_RECORD;
+}
+
+static int
+trace_write_header(struct lmc_trace *trace, const struct lmc *lmc)
+{
+	unsigned char *p = trace->bufs[0];
+	int i;
+
+	memcpy(p, TRACE_MAGIC, TRACE_MAGIC_LEN);
+	p += TRACE_MAGIC_LEN;
+	p = put_varint(p, TRACE_VERSION);
+	p = put_varint(p, NUM_MAILBOXES);
+	p = put_varint(p, lmc->cpu.pc);
+
+	for (i = 0; i < NUM_MAILBOXES; ++i)
+	{
+		if (p > trace->bufs[0] + TRACE_BUF_SIZE - TRACE_MAX_RECORD)
+		{
+			if (trace_write(trace, trace->bufs[0],
+					p - trace->bufs[0]))
+			{
+				return 1;
+			}
+
+			p = trace->bufs[0];
+		}
+
+		p = put_varint(p, lmc->mailboxes[i]);
+	}
+
+	return trace_write(trace, trace->bufs[0], p - trace->bufs[0]);
+}
+
+static void
+trace_free(struct lmc_trace *trace)
+{
+#ifdef WITH_ZLIB
+	if (trace->gz)
+		gzclose(trace->gz);
+	else
+#endif
+	if (trace->file)
+		fclose(trace->file);
+
+	free(trace->bufs[0]);
+	free(trace->bufs[1]);
+	free(trace);
+}
+
+struct lmc_trace *
+trace_open(const char *path, bool compress, const struct lmc *lmc)
+{
+	struct lmc_trace *trace;
+
+	trace = calloc(1, sizeof *trace);
+	if (!trace)
+	{
+		fprintf(stderr, "Out of memory\n");
+		return NULL;
+	}
+
+	trace->path = path;
+	trace->bufs[0] = malloc(TRACE_BUF_SIZE);
+	trace->bufs[1] = malloc(TRACE_BUF_SIZE);
+	if (!trace->bufs[0] || !trace->bufs[1])
+	{
+		fprintf(stderr, "Out of memory\n");
+		trace_free(trace);
+		return NULL;
+	}
+
+#ifdef WITH_ZLIB
+	if (compress)
+		trace->gz = gzopen(path, "wb");
+	else
+#endif
+	trace->file = fopen(path, "wb");
+
+#ifdef WITH_ZLIB
+	if (!trace->file && !trace->gz)
+#else
+	if (!trace->file)
+#endif
+	{
+		fprintf(stderr, "Error opening %s: %s\n", path,
+			strerror(errno));
+		trace_free(trace);
+		return NULL;
+	}
+
+#ifndef WITH_ZLIB
+	if (compress)
+		fprintf(stderr, "Built without zlib; trace not compressed\n");
+#endif
+
+	if (trace_write_header(trace, lmc))
+	{
+		fprintf(stderr, "Error writing %s: %s\n", path,
+			strerror(errno));
+		trace_free(trace);
+		return NULL;
+	}
+
+	trace->active = 0;
+	trace->cur = trace->bufs[0];
+	trace->limit = trace->cur + TRACE_BUF_SIZE - TRACE_MAX_RECORD;
+	trace->prev_pc = lmc->cpu.pc - 1;
+
+	pthread_mutex_init(&trace->lock, NULL);
+	pthread_cond_init(&trace->cond, NULL);
+	if (pthread_create(&trace->thread, NULL, trace_writer, trace))
+	{
+		fprintf(stderr, "Failed to start trace writer\n");
+		pthread_mutex_destroy(&trace->lock);
+		pthread_cond_destroy(&trace->cond);
+		trace_free(trace);
+		return NULL;
+	}
+
+	return trace;
+}
+
+int
+trace_close(struct lmc_trace *trace, const struct lmc *lmc)
+{
+	int rc;
+
+	*trace->cur++ = TRACE_END;
+	trace->cur = put_varint(trace->cur, !!lmc->cpu.error);
+	trace_flush(trace);
+
+	pthread_mutex_lock(&trace->lock);
+	trace->done = true;
+	pthread_cond_broadcast(&trace->cond);
+	pthread_mutex_unlock(&trace->lock);
+
+	pthread_join(trace->thread, NULL);
+	pthread_mutex_destroy(&trace->lock);
+	pthread_cond_destroy(&trace->cond);
+
+	rc = trace->error;
+
+#ifdef WITH_ZLIB
+	if (trace->gz)
+	{
+		rc = gzclose(trace->gz) != Z_OK || rc;
+		trace->gz = NULL;
+	}
+#endif
+
+	if (trace->file)
+	{
+		rc = fclose(trace->file) || rc;
+		trace->file = NULL;
+	}
+
+	if (rc)
+		fprintf(stderr, "Error writing %s\n", trace->path);
+
+	trace_free(trace);
+	return rc;
+}
+
+void
+lmc_run_traced(struct lmc *lmc, struct lmc_trace *trace)
+{
+	while (!lmc->cpu.halted)
+	{
+		lmc_op op;
+		unsigned char *p, flags = 0;
+		int pc = lmc->cpu.pc, a = lmc->cpu.a, expected;
+
+		lmc->cpu.instruction = lmc->mailboxes[lmc->cpu.pc++];
+		lmc->cpu.opcode = lmc->cpu.instruction / NUM_MAILBOXES;
+		lmc->cpu.addr = lmc->cpu.instruction % NUM_MAILBOXES;
+
+		if (lmc->cpu.pc == NUM_MAILBOXES) /* wrap around, don't run off */
+			lmc->cpu.pc = 0;
+
+		if (lmc->cpu.opcode > 9 || (op = OPS[lmc->cpu.opcode]) == NULL)
+		{
+			bad_instruction(lmc);
+			break;
+		}
+
+		op(lmc);
+
+		if (trace->cur > trace->limit)
+			trace_flush(trace);
+
+		p = trace->cur + 1;
+
+		expected = trace->prev_pc + 1;
+		if (expected == NUM_MAILBOXES)
+			expected = 0;
+
+		if (pc != expected)
+		{
+			flags |= TRACE_JUMP;
+			p = put_varint(p, pc);
+		}
+
+		if (lmc->cpu.a != a)
+		{
+			flags |= TRACE_ACC;
+			p = put_varint(p, zigzag(lmc->cpu.a - a));
+		}
+
+		if (3 == lmc->cpu.opcode)
+		{
+			flags |= TRACE_WRITE;
+			p = put_varint(p, lmc->cpu.addr);
+		}
+		else if (9 == lmc->cpu.opcode)
+		{
+			if (1 == lmc->cpu.addr)
+				flags |= TRACE_INPUT;
+			else if (2 == lmc->cpu.addr)
+				flags |= TRACE_OUTPUT;
+		}
+
+		if (lmc->cpu.neg)
+			flags |= TRACE_NEG;
+
+		*trace->cur = flags;
+		trace->cur = p;
+		trace->prev_pc = pc;
+	}
+}
@@ -0,0 +1,93 @@
+/*
+ * lmc - Little Man Computer
+ * Copyright (C) 2020 David McMackins II
+ *
+ * Redistributions, modified or unmodified, in whole or in part, must retain
+ * applicable copyright or other legal privilege notices, these conditions, and
+ * the following license terms and disclaimer.  Subject to these conditions,
+ * the holder(s) of copyright or other legal privileges, author(s) or
+ * assembler(s), and contributors of this work hereby grant to any person who
+ * obtains a copy of this work in any form:
+ *
+ * 1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ * use, and/or otherwise deal in the licensed material without restriction.
+ *
+ * 2. A perpetual, worldwide, non-exclusive, royalty-free, irrevocable patent
+ * license to reproduce, modify, distribute, publish, sell, use, and/or
+ * otherwise deal in the licensed material without restriction, for any and all
+ * patents:
+ *
+ *     a. Held by each such holder of copyright or other legal privilege,
+ *     author or assembler, or contributor, necessarily infringed by the
+ *     contributions alone or by combination with the work, of that privilege
+ *     holder, author or assembler, or contributor.
+ *
+ *     b. Necessarily infringed by the work at the time that holder of
+ *     copyright or other privilege, author or assembler, or contributor made
+ *     any contribution to the work.
+ *
+ * NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ * LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ * A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ * ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ * ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT, TORT,
+ * OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR THE USE
+ * OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#ifndef LMC_TRACE_H
+#define LMC_TRACE_H
+
+#include <stdbool.h>
+
+#include "lmc.h"
+
+/*
+ * Trace file format:
+ *
+ *   "LMCTRACE" version num_mailboxes pc mailbox...
+ *   record...
+ *
+ * All numbers after the magic are unsigned LEB128 varints. Each record
+ * describes one executed instruction and begins with a flags byte. The
+ * optional fields follow in this order:
+ *
+ *   TRACE_JUMP   pc, if not the previous pc + 1 (wrapping)
+ *   TRACE_ACC    zigzag-encoded change to the accumulator
+ *   TRACE_WRITE  mailbox stored to; the value is the new accumulator
+ *
+ * TRACE_NEG is the value of the neg flag after the step. TRACE_INPUT and
+ * TRACE_OUTPUT mark I/O; the value moved is the accumulator. The stream
+ * ends with a TRACE_END record, followed by a varint which is 1 if the
+ * machine stopped on an error.
+ */
+
+#define TRACE_MAGIC "LMCTRACE"
+#define TRACE_MAGIC_LEN 8
+#define TRACE_VERSION 1
+
+#define TRACE_JUMP 0x01
+#define TRACE_ACC 0x02
+#define TRACE_WRITE 0x04
+#define TRACE_NEG 0x08
+#define TRACE_INPUT 0x10
+#define TRACE_OUTPUT 0x20
+#define TRACE_END 0x80
+
+struct lmc_trace;
+
+/* the header is written from the machine's current state; compress is
+   only honoured when built WITH_ZLIB */
+struct lmc_trace *
+trace_open(const char *path, bool compress, const struct lmc *lmc);
+
+/* writes the end record, waits for the writer thread and frees trace;
+   returns nonzero if anything could not be written */
+int
+trace_close(struct lmc_trace *trace, const struct lmc *lmc);
+
+void
+lmc_run_traced(struct lmc *lmc, struct lmc_trace *trace);
+
+#endif